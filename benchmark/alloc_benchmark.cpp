@@ -0,0 +1,82 @@
+// SvcWrapper benchmark: overhead of the allocation statistics shims.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: AllocBenchmark [iterations] [threads]
+//        AllocStatsBenchmark [iterations] [threads]
+//
+// Both executables are built from this file, AllocStatsBenchmark links
+// SvcWrapper::AllocStats. Each thread allocates and frees blocks of several
+// sizes the given number of times (default 10000000, 4 threads) and the
+// average time per allocation and deallocation is printed. Compare the output
+// of both executables to see the overhead of counting.
+#ifdef SVCWRAPPER_ALLOC_STATS
+#include "SvcWrapper/svcallocstats.h"
+#endif
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Allocate and free blocks, returns average time per pair [ns]
+static double Run(size_t size, size_t iterations)
+{
+    // Keep a few blocks alive, so the heap can't just hand out the same one
+    void* blocks[16] = {};
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        void*& block = blocks[i % 16];
+        ::operator delete(block);
+        block = ::operator new(size);
+    }
+    double elapsed = chrono::duration<double, nano>(Clock::now() - start).count();
+    for (void* block : blocks)
+        ::operator delete(block);
+    return elapsed / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t threadCount = argc > 2 ? strtoull(argv[2], nullptr, 10) : 4;
+    if (!iterations || !threadCount) {
+        printf("Usage: %s [iterations] [threads]\n", argv[0]);
+        return 1;
+    }
+#ifdef SVCWRAPPER_ALLOC_STATS
+    printf("With allocation statistics, ");
+#else
+    printf("Without allocation statistics, ");
+#endif
+    printf("%zu iterations\n\n", iterations);
+
+    for (size_t size : {16, 64, 1024, 65536}) {
+        double single = Run(size, iterations);
+
+        // Same on several threads at once, to see whether counting contends
+        vector<double> results(threadCount);
+        vector<thread> threads;
+        for (size_t t = 0; t < threadCount; ++t)
+            threads.emplace_back([&results, t, size, iterations] {
+                results[t] = Run(size, iterations);
+            });
+        double multi = 0;
+        for (size_t t = 0; t < threadCount; ++t) {
+            threads[t].join();
+            multi += results[t] / threadCount;
+        }
+        printf("%6zu bytes   1 thread %6.1f ns   %zu threads %6.1f ns\n", size, single,
+               threadCount, multi);
+    }
+
+#ifdef SVCWRAPPER_ALLOC_STATS
+    SvcAllocStats stats;
+    SvcAllocStatsSnapshot(stats);
+    printf("\n%llu allocations, %llu deallocations, %llu bytes live\n", stats.allocations,
+           stats.deallocations, stats.liveBytes);
+#endif
+    return 0;
+}
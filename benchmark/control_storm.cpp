@@ -0,0 +1,599 @@
+// SvcWrapper stress test: control storms against the lifecycle state machine.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: ControlStorm [options]
+//   --runs <n>             Service lifecycles to run (default 200)
+//   --threads <n>          Threads sending controls (default 8)
+//   --seed <n>             Random seed (default 42)
+//   --start-delay <ms>     Maximum time the fake app takes to start (default 20)
+//   --stop-delay <ms>      Maximum time the fake app takes to stop (default 5)
+//   --self-exit <percent>  Runs the fake app exits on it's own (default 10)
+//
+// Replaces the service control manager by an in-process stand-in and runs
+// the service through SvcWrapper() repeatedly, no installation required.
+// While the service starts, runs and stops, the threads fire randomized
+// control sequences at the control handler: stop while starting, duplicate
+// stops, interrogate floods, unsupported codes, an application that never
+// gets ready and one that only listens for stops once it's main callback
+// runs. The fake app randomly reports readiness explicitly, tracks it's
+// work for draining or exits on it's own. Every reported status is checked
+// against the lifecycle invariants, a service that doesn't reach STOPPED
+// within 10 s is reported as wedged. Builds with SVCWRAPPER_ALLOC_CHECK also
+// count failed allocation checks as violations. Prints control handling
+// latency percentiles and returns 1 if any invariant was violated. Runs are
+// reproducible for a given seed, apart from thread timing.
+#include "svcwrapper_impl.h"
+#include "svcalloccheck.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Time [ms] a run may take before the service is considered wedged
+static constexpr unsigned int WedgeTimeout = 10000;
+
+// First code of the range applications may define themselves
+static constexpr DWORD CustomControlBase = 128;
+
+// Stops sent by each thread in the duplicate stop scenario
+static constexpr unsigned int DuplicateStops = 100;
+
+enum Scenario {
+    StopDuringStart,    // Single stop while START_PENDING, interrogates
+    DuplicateStop,      // All threads stop at once when running
+    InterrogateFlood,   // Interrogates, a single stop later on
+    UnsupportedCodes,   // Pause, shutdown, custom codes, a single stop later on
+    NeverReady,         // App never calls SvcReady(), stop or ready timeout
+    StopBeforeMain,     // Stop while START_PENDING, app listens once main runs
+    ScenarioCount
+};
+
+static const char* const ScenarioNames[] = {
+    "stop during start", "duplicate stop", "interrogate flood", "unsupported codes",
+    "never ready", "stop before main"};
+
+struct Options {
+    size_t runs {200};
+    size_t threads {8};
+    unsigned int seed {42};
+    unsigned int startDelay {20};
+    unsigned int stopDelay {5};
+    unsigned int selfExit {10};
+};
+
+struct Report {
+    SERVICE_STATUS status;
+    Clock::time_point time;
+};
+
+// Control handler latencies [ns] by kind of control
+struct Latencies {
+    vector<double> stop;
+    vector<double> interrogate;
+    vector<double> unsupported;
+};
+
+// === Service control manager stand-in ========================================
+
+static struct {
+    // Service table passed to the dispatcher and the control handler
+    const SERVICE_TABLE_ENTRY* table {nullptr};
+    atomic<LPHANDLER_FUNCTION_EX> handler {nullptr};
+    atomic<LPVOID> context {nullptr};
+
+    // Reported status
+    mutex lock;
+    vector<Report> reports;
+    atomic<DWORD> state {SERVICE_STOPPED};
+
+    // Delay the first START_PENDING report, like a slow start (prewarming)
+    // would delay reporting RUNNING
+    atomic<bool> slowStart {false};
+
+    // First stop sent while running, for stop latency
+    atomic<bool> stopSent {false};
+    Clock::time_point stopTime;
+} scm;
+
+// Fake application
+static struct {
+    mutex lock;
+    condition_variable wake;
+    bool stop {false};
+    atomic<int> mainCalls {0};
+    atomic<int> stopCalls {0};
+    unsigned int startDelay {0};
+    unsigned int stopDelay {0};
+    unsigned int exitAfter {0};   // Exit on it's own after [ms], 0 for never
+    bool ready {false};
+    bool neverReady {false};      // Waited for, but never calls SvcReady()
+    bool stopWhileStarting {false};
+    bool lateListener {false};    // Stop callback only works once main runs
+    atomic<int> earlyStops {0};
+    bool drain {false};
+} app;
+
+// Current run
+static Options opt;
+static Scenario scenario;
+static mt19937 runRandom;
+static atomic<bool> stormDone {false};
+static atomic<size_t> violations {0};
+static atomic<size_t> invalidTransitions {0};
+static atomic<size_t> wrongResults {0};
+static atomic<size_t> stopsWhileStarting {0};
+static Latencies latencies;
+static mutex latencyLock;
+static vector<double> stopToStopped;
+
+// Position of a state in the lifecycle
+static int Rank(DWORD state)
+{
+    switch (state) {
+    case SERVICE_START_PENDING: return 1;
+    case SERVICE_RUNNING: return 2;
+    case SERVICE_STOP_PENDING: return 3;
+    case SERVICE_STOPPED: return 4;
+    default: return 0;
+    }
+}
+
+static void Violation(size_t run, const char* what)
+{
+    if (violations++ < 20)
+        printf("run %zu (%s): %s\n", run, ScenarioNames[scenario], what);
+}
+
+static SERVICE_STATUS_HANDLE WINAPI FakeRegisterHandler(LPCSTR, LPHANDLER_FUNCTION_EX handler,
+                                                        LPVOID context)
+{
+    scm.context.store(context);
+    scm.handler.store(handler);
+    return reinterpret_cast<SERVICE_STATUS_HANDLE>(1);
+}
+
+static BOOL WINAPI FakeSetStatus(SERVICE_STATUS_HANDLE, LPSERVICE_STATUS status)
+{
+    // Stand-in for the SCM, it's bookkeeping isn't part of the checked paths
+    SvcAllowAllocScope allowAlloc;
+    Clock::time_point now = Clock::now();
+    {
+        lock_guard<mutex> lock(scm.lock);
+        scm.reports.push_back({*status, now});
+        scm.state.store(status->dwCurrentState);
+        if (status->dwCurrentState == SERVICE_STOPPED)
+            stormDone.store(true);
+    }
+    if (status->dwCurrentState == SERVICE_START_PENDING && scm.slowStart.exchange(false))
+        this_thread::sleep_for(chrono::milliseconds(5));
+    return TRUE;
+}
+
+// Send control to the service like the SCM does, records handler latency
+static void SendControl(DWORD code, Latencies& lat)
+{
+    LPHANDLER_FUNCTION_EX handler = scm.handler.load();
+    if (!handler)
+        return;
+    DWORD state = scm.state.load();
+    if (code == SERVICE_CONTROL_STOP && state == SERVICE_START_PENDING)
+        ++stopsWhileStarting;
+    if (code == SERVICE_CONTROL_STOP && state == SERVICE_RUNNING && !scm.stopSent.exchange(true))
+        scm.stopTime = Clock::now();
+    Clock::time_point start = Clock::now();
+    DWORD result = handler(code, 0, nullptr, scm.context.load());
+    double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+
+    bool supported = code == SERVICE_CONTROL_STOP || code == SERVICE_CONTROL_INTERROGATE;
+    if (result != (supported ? NO_ERROR : ERROR_CALL_NOT_IMPLEMENTED))
+        ++wrongResults;
+    if (code == SERVICE_CONTROL_STOP)
+        lat.stop.push_back(ns);
+    else if (code == SERVICE_CONTROL_INTERROGATE)
+        lat.interrogate.push_back(ns);
+    else
+        lat.unsupported.push_back(ns);
+}
+
+// Fire controls of the current scenario until the service stopped
+static void Storm(size_t index, unsigned int seed)
+{
+    mt19937 random(seed);
+    uniform_int_distribution<unsigned int> pause(0, 50);
+    const DWORD unsupported[] = {SERVICE_CONTROL_PAUSE, SERVICE_CONTROL_CONTINUE,
+                                 SERVICE_CONTROL_SHUTDOWN, SERVICE_CONTROL_PRESHUTDOWN};
+    Latencies lat;
+    bool stopper = index == 0;
+    unsigned int stops = 0;
+    unsigned int stopAfter = uniform_int_distribution<unsigned int>(0, 50)(random);
+    Clock::time_point running {};
+
+    while (!stormDone.load()) {
+        DWORD state = scm.state.load();
+        if (state == SERVICE_RUNNING && running == Clock::time_point {})
+            running = Clock::now();
+        bool stopDue = running != Clock::time_point {} &&
+                       Clock::now() - running >= chrono::milliseconds(stopAfter);
+
+        switch (scenario) {
+        case StopDuringStart:
+            // Stop once running if the start was missed, the service would
+            // never stop otherwise
+            if (stopper && ((state == SERVICE_START_PENDING && scm.handler.load()) ||
+                            state == SERVICE_RUNNING)) {
+                SendControl(SERVICE_CONTROL_STOP, lat);
+                stopper = false;
+            } else {
+                SendControl(SERVICE_CONTROL_INTERROGATE, lat);
+            }
+            break;
+        case DuplicateStop:
+            if ((state == SERVICE_RUNNING || state == SERVICE_STOP_PENDING) &&
+                stops < DuplicateStops) {
+                SendControl(SERVICE_CONTROL_STOP, lat);
+                ++stops;
+            } else {
+                SendControl(SERVICE_CONTROL_INTERROGATE, lat);
+            }
+            break;
+        case InterrogateFlood:
+            if (stopper && stopDue) {
+                SendControl(SERVICE_CONTROL_STOP, lat);
+                stopper = false;
+            } else {
+                SendControl(SERVICE_CONTROL_INTERROGATE, lat);
+            }
+            break;
+        case NeverReady:
+            // The service never gets running, it stops on the stop sent
+            // while starting or when the ready timeout expires
+            if (stopper && app.stopWhileStarting && state == SERVICE_START_PENDING &&
+                scm.handler.load()) {
+                SendControl(SERVICE_CONTROL_STOP, lat);
+                stopper = false;
+            } else {
+                SendControl(SERVICE_CONTROL_INTERROGATE, lat);
+            }
+            break;
+        case StopBeforeMain:
+            // Stop as early as possible, once running if the start was missed
+            if (stopper && scm.handler.load() &&
+                (state == SERVICE_START_PENDING || state == SERVICE_RUNNING)) {
+                SendControl(SERVICE_CONTROL_STOP, lat);
+                stopper = false;
+            } else {
+                SendControl(SERVICE_CONTROL_INTERROGATE, lat);
+            }
+            break;
+        case UnsupportedCodes:
+            if (stopper && stopDue) {
+                SendControl(SERVICE_CONTROL_STOP, lat);
+                stopper = false;
+            } else if (random() % 4 == 0) {
+                SendControl(CustomControlBase + random() % 128, lat);
+            } else {
+                SendControl(unsupported[random() % 4], lat);
+            }
+            break;
+        default:
+            break;
+        }
+        // Yield rather than sleep, which takes at least a scheduler tick
+        if (scenario != DuplicateStop || stops >= DuplicateStops) {
+            for (unsigned int i = pause(random); i > 0; --i)
+                this_thread::yield();
+        }
+    }
+
+    lock_guard<mutex> lock(latencyLock);
+    latencies.stop.insert(latencies.stop.end(), lat.stop.begin(), lat.stop.end());
+    latencies.interrogate.insert(latencies.interrogate.end(), lat.interrogate.begin(),
+                                 lat.interrogate.end());
+    latencies.unsupported.insert(latencies.unsupported.end(), lat.unsupported.begin(),
+                                 lat.unsupported.end());
+}
+
+// Runs the service and the storm threads, returns once the service stopped
+static BOOL WINAPI FakeStartDispatcher(const SERVICE_TABLE_ENTRY* table)
+{
+    scm.table = table;
+    vector<thread> storm;
+    for (size_t i = 0; i < opt.threads; ++i)
+        storm.emplace_back(Storm, i, static_cast<unsigned int>(runRandom()));
+
+    // Service main runs on it's own thread, like the SCM does it
+    mutex lock;
+    condition_variable done;
+    bool finished = false;
+    thread service([&] {
+        char* argv[] = {table[0].lpServiceName};
+        table[0].lpServiceProc(1, argv);
+        lock_guard<mutex> guard(lock);
+        finished = true;
+        done.notify_all();
+    });
+    {
+        unique_lock<mutex> guard(lock);
+        if (!done.wait_for(guard, chrono::milliseconds(WedgeTimeout), [&] { return finished; })) {
+            // Can't recover from here, report what the service did last
+            printf("Service wedged in %s scenario, last reported states:",
+                   ScenarioNames[scenario]);
+            lock_guard<mutex> reportLock(scm.lock);
+            for (size_t i = scm.reports.size() > 10 ? scm.reports.size() - 10 : 0;
+                 i < scm.reports.size(); ++i)
+                printf(" %lu", scm.reports[i].status.dwCurrentState);
+            printf("\nFake app: ready %d, drain %d, exit after %u ms, stop callbacks %d\n",
+                   app.ready, app.drain, app.exitAfter, app.stopCalls.load());
+            fflush(stdout);
+            quick_exit(2);
+        }
+    }
+    service.join();
+    stormDone.store(true);
+    for (thread& t : storm)
+        t.join();
+    return TRUE;
+}
+
+// === Fake application ========================================================
+
+static int AppMain(int, char**)
+{
+    {
+        lock_guard<mutex> lock(app.lock);
+        ++app.mainCalls;
+        app.wake.notify_all();
+    }
+    this_thread::sleep_for(chrono::milliseconds(app.startDelay));
+    if (app.ready)
+        SvcReady();
+
+    // Handle requests until stopped, new requests are refused when draining
+    Clock::time_point start = Clock::now();
+    unique_lock<mutex> lock(app.lock);
+    while (!app.stop) {
+        if (app.exitAfter && Clock::now() - start >= chrono::milliseconds(app.exitAfter))
+            break;
+        SvcWorkGuard work;
+        app.wake.wait_for(lock, chrono::milliseconds(app.drain && work ? 1 : 5));
+    }
+    lock.unlock();
+    this_thread::sleep_for(chrono::milliseconds(app.stopDelay));
+    return 0;
+}
+
+static void AppStop()
+{
+    ++app.stopCalls;
+    unique_lock<mutex> lock(app.lock);
+    // Like an application creating it's event loop in main, a stop before
+    // main is lost. Give a main that was just entered the time to count.
+    if (app.lateListener &&
+        !app.wake.wait_for(lock, chrono::milliseconds(100), [] { return app.mainCalls > 0; }))
+        ++app.earlyStops;
+    app.stop = true;
+    app.wake.notify_all();
+}
+
+static void AppLog(SvcLogLevel level, const char* msg)
+{
+    if (strstr(msg, "Invalid service state transition"))
+        ++invalidTransitions;
+    if (strstr(msg, "Allocation check failed"))
+        ++violations;
+    if (level == Critical)
+        printf("Critical: %s\n", msg);
+}
+
+// === Invariants ==============================================================
+
+// Check reported status of a run, returns number of stale reports
+static size_t CheckRun(size_t run)
+{
+    lock_guard<mutex> lock(scm.lock);
+    const vector<Report>& reports = scm.reports;
+    char what[160];
+    if (reports.empty() || reports.front().status.dwCurrentState != SERVICE_START_PENDING)
+        Violation(run, "first reported state isn't START_PENDING");
+    if (reports.empty() || reports.back().status.dwCurrentState != SERVICE_STOPPED)
+        Violation(run, "last reported state isn't STOPPED");
+
+    // A start that timed out waiting for readiness reports it's hang
+    DWORD exitCode = app.neverReady && !app.stopWhileStarting ? ERROR_SERVICE_START_HANG
+                                                               : NO_ERROR;
+    size_t stale = 0;
+    int highest = 0;
+    bool stopped = false;
+    for (const Report& report : reports) {
+        const SERVICE_STATUS& s = report.status;
+        int rank = Rank(s.dwCurrentState);
+        if (!rank) {
+            snprintf(what, sizeof(what), "unexpected state %lu", s.dwCurrentState);
+            Violation(run, what);
+        }
+        if (stopped && s.dwCurrentState != SERVICE_STOPPED)
+            Violation(run, "state reported after STOPPED");
+        stopped = stopped || s.dwCurrentState == SERVICE_STOPPED;
+
+        // Reports of concurrent threads may overtake each other, the newest
+        // state must always be reported last though
+        if (rank < highest)
+            ++stale;
+        highest = max(highest, rank);
+
+        bool pending = s.dwCurrentState == SERVICE_START_PENDING ||
+                       s.dwCurrentState == SERVICE_STOP_PENDING;
+        if (pending != (s.dwCheckPoint != 0)) {
+            snprintf(what, sizeof(what), "checkpoint %lu reported with state %lu",
+                     s.dwCheckPoint, s.dwCurrentState);
+            Violation(run, what);
+        }
+        DWORD accepted = s.dwCurrentState == SERVICE_RUNNING ? SERVICE_ACCEPT_STOP : 0;
+        if (s.dwControlsAccepted != accepted) {
+            snprintf(what, sizeof(what), "controls 0x%lx accepted in state %lu",
+                     s.dwControlsAccepted, s.dwCurrentState);
+            Violation(run, what);
+        }
+        if (s.dwCurrentState == SERVICE_STOPPED && s.dwWin32ExitCode != exitCode) {
+            snprintf(what, sizeof(what), "STOPPED reported with exit code %lu instead of %lu",
+                     s.dwWin32ExitCode, exitCode);
+            Violation(run, what);
+        }
+        if (app.neverReady && s.dwCurrentState == SERVICE_RUNNING)
+            Violation(run, "RUNNING reported without the app being ready");
+    }
+
+    // The application runs once and is asked to stop at most once
+    if (app.mainCalls != 1)
+        Violation(run, "main callback wasn't invoked exactly once");
+    if (app.stopCalls > 1)
+        Violation(run, "stop callback invoked more than once");
+    if (!app.exitAfter && app.stopCalls != 1)
+        Violation(run, "stop callback wasn't invoked");
+    if (app.earlyStops)
+        Violation(run, "stop callback invoked before main callback");
+
+    // Stop latency as seen by the SCM
+    if (scm.stopSent && !reports.empty())
+        stopToStopped.push_back(
+            chrono::duration<double, milli>(reports.back().time - scm.stopTime).count());
+    return stale;
+}
+
+// === Main ====================================================================
+
+static void Print(const char* name, vector<double>& values, double scale, const char* unit)
+{
+    if (values.empty())
+        return;
+    sort(values.begin(), values.end());
+    auto at = [&](double p) {
+        return values[static_cast<size_t>((values.size() - 1) * p)] / scale;
+    };
+    printf("%-16s %10zu   p50 %8.1f %s   p99 %8.1f %s   p99.9 %8.1f %s   max %8.1f %s\n",
+           name, values.size(), at(0.5), unit, at(0.99), unit, at(0.999), unit,
+           values.back() / scale, unit);
+}
+
+int main(int argc, char* argv[])
+{
+    bool syntaxError = argc % 2 == 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        unsigned long value = strtoul(argv[i + 1], nullptr, 10);
+        if (arg == "--runs")
+            opt.runs = value;
+        else if (arg == "--threads")
+            opt.threads = value;
+        else if (arg == "--seed")
+            opt.seed = value;
+        else if (arg == "--start-delay")
+            opt.startDelay = value;
+        else if (arg == "--stop-delay")
+            opt.stopDelay = value;
+        else if (arg == "--self-exit")
+            opt.selfExit = value;
+        else
+            syntaxError = true;
+    }
+    if (syntaxError || !opt.runs || !opt.threads || opt.selfExit > 100) {
+        printf("Usage: %s [--runs n] [--threads n] [--seed n] [--start-delay ms]\n"
+               "       [--stop-delay ms] [--self-exit percent]\n", argv[0]);
+        return 1;
+    }
+    printf("%zu runs, %zu threads, seed %u\n\n", opt.runs, opt.threads, opt.seed);
+
+    svcScm.startDispatcher = FakeStartDispatcher;
+    svcScm.registerHandler = FakeRegisterHandler;
+    svcScm.setStatus = FakeSetStatus;
+
+    size_t stale = 0;
+    size_t scenarios[ScenarioCount] = {};
+    for (size_t run = 0; run < opt.runs; ++run) {
+        runRandom.seed(opt.seed + static_cast<unsigned int>(run));
+        scenario = static_cast<Scenario>(runRandom() % ScenarioCount);
+        ++scenarios[scenario];
+
+        // Fresh stand-in and application for every run
+        {
+            lock_guard<mutex> lock(scm.lock);
+            scm.reports.clear();
+        }
+        scm.handler.store(nullptr);
+        scm.state.store(SERVICE_STOPPED);
+        scm.stopSent.store(false);
+        stormDone.store(false);
+        app.stop = false;
+        app.mainCalls = 0;
+        app.stopCalls = 0;
+        app.startDelay = opt.startDelay ? runRandom() % (opt.startDelay + 1) : 0;
+        app.stopDelay = opt.stopDelay ? runRandom() % (opt.stopDelay + 1) : 0;
+        app.exitAfter = runRandom() % 100 < opt.selfExit ? 1 + runRandom() % 50 : 0;
+        app.ready = runRandom() % 2;
+        if (scenario == StopDuringStart) {
+            // Keep the service start pending for a while
+            app.ready = true;
+            app.startDelay = max(app.startDelay, 5U);
+        }
+        app.drain = runRandom() % 2;
+        app.neverReady = scenario == NeverReady;
+        app.stopWhileStarting = app.neverReady && runRandom() % 2;
+        app.lateListener = scenario == StopBeforeMain;
+        app.earlyStops = 0;
+        if (app.lateListener)
+            app.exitAfter = 0;
+        scm.slowStart.store(app.lateListener);
+        unsigned int readyTimeout = 30000;
+        if (app.neverReady) {
+            // Without a stop, the ready timeout must end the start
+            app.ready = false;
+            if (!app.stopWhileStarting)
+                app.exitAfter = 0;
+            readyTimeout = app.stopWhileStarting ? 0 : 20 + runRandom() % 50;
+        }
+
+        SvcWrapperConfig cfg;
+        cfg.svcName = "ControlStorm";
+        cfg.svcDisplayName = "ControlStorm";
+        cfg.svcCallbackMain = AppMain;
+        cfg.svcCallbackStop = AppStop;
+        cfg.svcLogCallback = AppLog;
+        cfg.logLevel = Warning;
+        cfg.readyNotify = app.ready || app.neverReady;
+        cfg.readyTimeout = readyTimeout;
+        cfg.drainTimeout = app.drain ? 1000 : 0;
+        char* args[] = {argv[0]};
+        int exitCode = SvcWrapper(1, args, cfg);
+        if (exitCode != SVCWRAPPER_EXITCODE_OK)
+            Violation(run, "SvcWrapper() failed");
+        stale += CheckRun(run);
+    }
+
+    printf("Scenarios:");
+    for (int i = 0; i < ScenarioCount; ++i)
+        printf(" %s %zu%s", ScenarioNames[i], scenarios[i], i + 1 < ScenarioCount ? "," : "\n\n");
+    printf("Control handler latency\n");
+    Print("stop", latencies.stop, 1e3, "us");
+    Print("interrogate", latencies.interrogate, 1e3, "us");
+    Print("unsupported", latencies.unsupported, 1e3, "us");
+    printf("\nStop until STOPPED\n");
+    Print("stop", stopToStopped, 1, "ms");
+
+    printf("\nStops while starting       %zu\n", stopsWhileStarting.load());
+    printf("Stale status reports       %zu\n", stale);
+    printf("Invalid state transitions  %zu\n", invalidTransitions.load());
+    printf("Wrong control results      %zu\n", wrongResults.load());
+    printf("Invariant violations       %zu\n", violations.load());
+    return violations || invalidTransitions || wrongResults ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+// SvcWrapper benchmark: compile-time vs. runtime configured front end.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: FrontendBenchmark [iterations]
+//
+// Measures the cost of dispatching callbacks the way the core does it, through
+// the trampolines of SvcWrapper() (std::function) and of SvcWrapperStatic()
+// (direct call), as well as the cost of setting up the configuration, which
+// for a global SvcWrapperConfig happens during static initialization. Each
+// measurement is repeated the given number of times (default 100000000).
+//
+// Compare the binary sizes of FrontendSizeRuntime and FrontendSizeStatic by
+// building the FrontendSizeReport target.
+#include <SvcWrapper/svcwrapper_static.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Sink preventing the compiler from optimizing the calls away
+static volatile int sink;
+
+static void logHandler(SvcLogLevel level, const char*)
+{
+    sink = level;
+}
+
+static int appMain(int argc, char**)
+{
+    return argc;
+}
+
+static void appStop()
+{
+    sink = 0;
+}
+
+// Runtime front end trampoline, as in svcwrapper.cpp
+static void callLogRuntime(void* context, SvcLogLevel level, const char* msg)
+{
+    static_cast<const SvcWrapperConfig*>(context)->svcLogCallback(level, msg);
+}
+
+// Time per iteration [ns]
+template <typename Fn>
+static double measure(size_t iterations, Fn&& fn)
+{
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+        fn(i);
+    return chrono::duration<double, nano>(Clock::now() - start).count() / iterations;
+}
+
+static constexpr SvcWrapperSettings settings = [] {
+    SvcWrapperSettings s;
+    s.svcName = "FrontendBenchmark";
+    s.svcDisplayName = "SvcWrapper front end benchmark";
+    return s;
+}();
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000000;
+    printf("%-28s %-19s %s\n", "", "SvcWrapper()", "SvcWrapperStatic()");
+
+    // Callback dispatch, through a function pointer as the core does
+    SvcWrapperConfig cfg;
+    cfg.svcLogCallback = logHandler;
+    SvcDetail::Callbacks runtime {nullptr, nullptr, callLogRuntime, &cfg};
+    SvcDetail::Callbacks compiled {nullptr, nullptr, SvcDetail::CallLog<logHandler>, nullptr};
+    SvcDetail::Callbacks* volatile runtimePtr = &runtime;
+    SvcDetail::Callbacks* volatile compiledPtr = &compiled;
+    double dispatchRuntime = measure(iterations, [&](size_t) {
+        runtimePtr->log(runtimePtr->context, Info, "message");
+    });
+    double dispatchStatic = measure(iterations, [&](size_t) {
+        compiledPtr->log(compiledPtr->context, Info, "message");
+    });
+    printf("%-28s %8.2f ns/call    %8.2f ns/call\n", "Log callback dispatch",
+           dispatchRuntime, dispatchStatic);
+
+    // Configuration setup
+    size_t setupIterations = iterations / 10;
+    double setupRuntime = measure(setupIterations, [&](size_t) {
+        SvcWrapperConfig c;
+        c.svcName = "FrontendBenchmark";
+        c.svcDisplayName = "SvcWrapper front end benchmark";
+        c.svcCallbackMain = appMain;
+        c.svcCallbackStop = appStop;
+        c.svcLogCallback = logHandler;
+        sink = c.svcCallbackMain ? 1 : 0;
+    });
+    double setupStatic = measure(setupIterations, [&](size_t) {
+        SvcDetail::Service s;
+        s.settings = &settings;
+        s.callbacks.main = SvcDetail::CallMain<appMain>;
+        s.callbacks.stop = SvcDetail::CallStop<appStop>;
+        s.callbacks.log = SvcDetail::CallLog<logHandler>;
+        sink = s.callbacks.main ? 1 : 0;
+    });
+    printf("%-28s %8.2f ns         %8.2f ns\n", "Configuration setup",
+           setupRuntime, setupStatic);
+    return 0;
+}
@@ -0,0 +1,13 @@
+################################################################################
+# CMake project for the SvcWrapper library                                     #
+# Copyright (c) LASERVORM GmbH 2023                                            #
+################################################################################
+
+# Prints the binary sizes of the front end size benchmarks.
+# Usage: cmake -DRUNTIME=<file> -DSTATIC=<file> -P frontend_size.cmake
+
+file(SIZE "${RUNTIME}" RUNTIME_SIZE)
+file(SIZE "${STATIC}" STATIC_SIZE)
+math(EXPR SAVED "${RUNTIME_SIZE} - ${STATIC_SIZE}")
+message("SvcWrapper()         ${RUNTIME_SIZE} bytes")
+message("SvcWrapperStatic()   ${STATIC_SIZE} bytes (${SAVED} bytes less)")
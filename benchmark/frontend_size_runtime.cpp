@@ -0,0 +1,24 @@
+// SvcWrapper benchmark: minimal service using the runtime configured front end.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Counterpart of frontend_size_static.cpp, only built to compare binary sizes.
+#include <SvcWrapper/svcwrapper.h>
+
+static int appMain(int, char**)
+{
+    return 0;
+}
+
+static void appStop()
+{
+}
+
+int main(int argc, char* argv[])
+{
+    SvcWrapperConfig cfg;
+    cfg.svcName = "SizeRuntime";
+    cfg.svcDisplayName = "SvcWrapper size benchmark (runtime)";
+    cfg.svcCallbackMain = appMain;
+    cfg.svcCallbackStop = appStop;
+    return SvcWrapper(argc, argv, cfg);
+}
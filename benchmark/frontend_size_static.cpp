@@ -0,0 +1,27 @@
+// SvcWrapper benchmark: minimal service using the compile-time front end.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Counterpart of frontend_size_runtime.cpp, only built to compare binary
+// sizes. The CLI is the only optional subsystem linked.
+#include <SvcWrapper/svcwrapper_static.h>
+
+static int appMain(int, char**)
+{
+    return 0;
+}
+
+static void appStop()
+{
+}
+
+static constexpr SvcWrapperSettings settings = [] {
+    SvcWrapperSettings s;
+    s.svcName = "SizeStatic";
+    s.svcDisplayName = "SvcWrapper size benchmark (static)";
+    return s;
+}();
+
+int main(int argc, char* argv[])
+{
+    return SvcWrapperStatic<settings, appMain, appStop, nullptr, SvcFeatureCli>(argc, argv);
+}
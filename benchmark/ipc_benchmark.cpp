@@ -0,0 +1,124 @@
+// SvcWrapper benchmark: control pipe round trips vs. plain echo pipe.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: IpcBenchmark [requests] [payload size]
+//
+// Sends the given number of requests (default 100000) with the given payload
+// size (default 16 bytes) to an in-process control pipe server using the
+// builtin ping command, and the same amount of data to a minimal echo server
+// on a plain named pipe. Prints round trip latency percentiles of both, so
+// the overhead of the control protocol can be seen.
+#include "svcipc.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static void print(const char* name, vector<double>& rtt)
+{
+    sort(rtt.begin(), rtt.end());
+    printf("%-20s p50 %7.1f us   p99 %7.1f us   max %8.1f us\n", name,
+           rtt[rtt.size() / 2], rtt[static_cast<size_t>((rtt.size() - 1) * 0.99)],
+           rtt.back());
+}
+
+// Minimal echo server on a plain named pipe
+static DWORD WINAPI EchoServer(LPVOID param)
+{
+    HANDLE hPipe = static_cast<HANDLE>(param);
+    char buffer[64 * 1024];
+    DWORD bytes;
+    if (!ConnectNamedPipe(hPipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+        return 1;
+    while (ReadFile(hPipe, buffer, sizeof(buffer), &bytes, NULL) && bytes) {
+        DWORD written;
+        WriteFile(hPipe, buffer, bytes, &written, NULL);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t requests = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+    size_t payloadSize = argc > 2 ? strtoull(argv[2], nullptr, 10) : 16;
+    if (!requests || payloadSize > SvcIpcMaxPayload) {
+        printf("Usage: %s [requests] [payload size]\n", argv[0]);
+        return 1;
+    }
+    string payload(payloadSize, 'x');
+    printf("%zu round trips, %zu bytes payload\n\n", requests, payloadSize);
+
+    // Control pipe
+    {
+        string pipeName = SvcIpcPipeName("IpcBenchmark");
+        SvcIpcRegisterBuiltins();
+        auto server = make_unique<SvcIpcServer>(pipeName);
+        if (!server->start()) {
+            printf("Failed to start control pipe server!\n");
+            return 1;
+        }
+        SvcIpcClient client;
+        if (!client.connect(pipeName, 5000)) {
+            printf("Failed to connect to control pipe!\n");
+            return 1;
+        }
+        vector<double> rtt;
+        rtt.reserve(requests);
+        uint32_t id;
+        SvcIpcStatus status;
+        string response;
+        for (size_t i = 0; i < requests; ++i) {
+            Clock::time_point t0 = Clock::now();
+            client.queue("ping", payload.data(), payload.size());
+            if (!client.flush() || !client.receive(&id, &status, &response)) {
+                printf("Control pipe connection broken!\n");
+                return 1;
+            }
+            rtt.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+        }
+        print("Control pipe ping", rtt);
+    }
+
+    // Plain echo pipe
+    {
+        const char* pipeName = "\\\\.\\pipe\\SvcWrapper.IpcBenchmarkEcho";
+        HANDLE hServerPipe = CreateNamedPipe(pipeName, PIPE_ACCESS_DUPLEX,
+                                             PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                                             1, 64 * 1024, 64 * 1024, 0, NULL);
+        HANDLE hThread = CreateThread(NULL, 0, EchoServer, hServerPipe, 0, NULL);
+        HANDLE hPipe = CreateFile(pipeName, GENERIC_READ | GENERIC_WRITE, 0,
+                                  NULL, OPEN_EXISTING, 0, NULL);
+        if (hServerPipe == INVALID_HANDLE_VALUE || hThread == NULL ||
+                hPipe == INVALID_HANDLE_VALUE) {
+            printf("Failed to set up echo pipe!\n");
+            return 1;
+        }
+        vector<double> rtt;
+        rtt.reserve(requests);
+        string buffer(payloadSize, '\0');
+        for (size_t i = 0; i < requests; ++i) {
+            Clock::time_point t0 = Clock::now();
+            DWORD bytes;
+            WriteFile(hPipe, payload.data(), static_cast<DWORD>(payload.size()), &bytes, NULL);
+            for (size_t got = 0; got < payloadSize; got += bytes) {
+                if (!ReadFile(hPipe, &buffer[got], static_cast<DWORD>(payloadSize - got), &bytes, NULL)) {
+                    printf("Echo pipe connection broken!\n");
+                    return 1;
+                }
+            }
+            rtt.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+        }
+        CloseHandle(hPipe);
+        WaitForSingleObject(hThread, INFINITE);
+        CloseHandle(hThread);
+        CloseHandle(hServerPipe);
+        print("Plain echo pipe", rtt);
+    }
+    return 0;
+}
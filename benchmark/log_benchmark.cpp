@@ -0,0 +1,117 @@
+// SvcWrapper benchmark: overhead of log message suppression.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: LogBenchmark [iterations] [max threads]
+//
+// Each thread logs the same warning the given number of times (default
+// 1000000) through SvcLogMessage(), with 1, 2, 4, ... up to the given number
+// of threads (default: number of CPU cores). This is done without any
+// suppression, with rate limiting (10 messages/s), with deduplication and
+// with sampling of Debug messages (1 of 1000). Prints the average time per
+// message and how many of them reached the log callback, so the cost of a
+// suppressed message can be compared to the cost of passing it on.
+#include "svcwrapper_impl.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static GlobalHandles svc;
+static SvcLogSite sites[SvcLogSites];
+alignas(64) static atomic<size_t> delivered {0};
+
+static const char* const Message = "Connection to database lost, retrying in 100 ms";
+
+// Log callback, only counts the messages it gets
+static void CountMessage(void*, SvcLogLevel, const char*)
+{
+    delivered.fetch_add(1, memory_order_relaxed);
+}
+
+static SvcWrapperSettings Settings(unsigned int rateLimit, bool deduplicate,
+                                   unsigned int sampleDebug)
+{
+    SvcWrapperSettings settings;
+    settings.svcName = "LogBenchmark";
+    settings.logRateLimit = rateLimit;
+    settings.logDeduplicate = deduplicate;
+    settings.logSampleDebug = sampleDebug;
+    return settings;
+}
+
+// Log from several threads, returns average time per message [ns]
+static double Run(const SvcWrapperSettings& settings, SvcLogLevel level,
+                  size_t threadCount, size_t iterations)
+{
+    svc.cfg = &settings;
+    svc.logFilter = settings.logRateLimit || settings.logDeduplicate ||
+                    settings.logSampleDebug > 1;
+    svc.logSites = settings.logRateLimit ? sites : nullptr;
+    delivered.store(0);
+
+    vector<double> results(threadCount);
+    vector<thread> threads;
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.emplace_back([&, t] {
+            hSvc = &svc;
+            Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < iterations; ++i)
+                SvcLogMessage(level, Message);
+            results[t] = chrono::duration<double, nano>(Clock::now() - start).count();
+        });
+    double total = 0;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads[t].join();
+        total += results[t] / threadCount;
+    }
+    hSvc = &svc;
+    SvcLogFlush();
+    return total / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t maxThreads = argc > 2 ? strtoull(argv[2], nullptr, 10)
+                                 : max(1U, thread::hardware_concurrency());
+    if (!iterations || !maxThreads) {
+        printf("Usage: %s [iterations] [max threads]\n", argv[0]);
+        return 1;
+    }
+    printf("%zu messages per thread\n\n", iterations);
+
+    svc.callbacks.log = CountMessage;
+    static const SvcWrapperSettings unfiltered = Settings(0, false, 1);
+    static const SvcWrapperSettings rateLimited = Settings(10, false, 1);
+    static const SvcWrapperSettings deduplicated = Settings(0, true, 1);
+    static const SvcWrapperSettings sampled = Settings(0, false, 1000);
+    struct Mode {
+        const char* name;
+        const SvcWrapperSettings* settings;
+        SvcLogLevel level;
+    };
+    const Mode modes[] = {
+        {"unfiltered", &unfiltered, Warning},
+        {"rate limited", &rateLimited, Warning},
+        {"deduplicated", &deduplicated, Warning},
+        {"sampled", &sampled, Debug},
+    };
+
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        printf("%zu threads\n", threads);
+        for (const Mode& mode : modes) {
+            double ns = Run(*mode.settings, mode.level, threads, iterations);
+            printf("  %-14s %7.1f ns per message   %10zu delivered\n", mode.name, ns,
+                   delivered.load());
+        }
+    }
+    printf("\n%llu rate limited, %llu deduplicated, %llu sampled\n",
+           svc.logRateLimited.load(), svc.logDeduplicated.load(), svc.logSampled.load());
+    return 0;
+}
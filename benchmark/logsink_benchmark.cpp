@@ -0,0 +1,116 @@
+// SvcWrapper benchmark: file log sink vs. plain std::ofstream.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: LogSinkBenchmark [lines] [threads]
+//
+// Writes the given number of lines (default 1000000) through each sink, split
+// across the given number of threads (default 1), and prints the throughput
+// and per line write latency percentiles.
+#include <SvcWrapper/svclogsink.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static const char* const Message =
+        "Connection to backend 10.0.0.17:5432 lost, retrying in 250 ms";
+
+// Run benchmark for given sink and print results
+static void run(const char* name, size_t lines, unsigned int threads,
+                const function<void(SvcLogLevel, const char*)>& sink)
+{
+    vector<vector<uint32_t>> latencies(threads);
+    size_t perThread = lines / threads;
+    Clock::time_point start = Clock::now();
+    vector<thread> workers;
+    for (unsigned int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            vector<uint32_t>& lat = latencies[t];
+            lat.reserve(perThread);
+            for (size_t i = 0; i < perThread; ++i) {
+                Clock::time_point t0 = Clock::now();
+                sink(Info, Message);
+                lat.push_back(static_cast<uint32_t>(
+                    chrono::duration_cast<chrono::nanoseconds>(Clock::now() - t0).count()));
+            }
+        });
+    }
+    for (thread& w : workers)
+        w.join();
+    double secs = chrono::duration<double>(Clock::now() - start).count();
+
+    vector<uint32_t> all;
+    for (const vector<uint32_t>& lat : latencies)
+        all.insert(all.end(), lat.begin(), lat.end());
+    sort(all.begin(), all.end());
+    auto pct = [&](double p) { return all[static_cast<size_t>(p * (all.size() - 1))]; };
+    printf("%-24s %12.0f lines/s   p50 %6u ns   p99 %7u ns   max %9u ns\n",
+           name, all.size() / secs, pct(0.5), pct(0.99), all.back());
+}
+
+// Typical hand written file logger
+class StreamSink
+{
+public:
+    StreamSink(const char* path, bool flushEachLine)
+        : m_file(path, ios::trunc), m_flush(flushEachLine) {}
+
+    void operator()(SvcLogLevel, const char* msg)
+    {
+        char ts[32];
+        time_t now = time(nullptr);
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", gmtime(&now));
+        lock_guard<mutex> lock(m_lock);
+        m_file << ts << " [Info] " << msg;
+        if (m_flush)
+            m_file << endl;
+        else
+            m_file << '\n';
+    }
+
+private:
+    mutex m_lock;
+    ofstream m_file;
+    bool m_flush;
+};
+
+int main(int argc, char* argv[])
+{
+    size_t lines = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    unsigned int threads = argc > 2 ? static_cast<unsigned int>(atoi(argv[2])) : 1;
+    if (!lines || !threads) {
+        printf("Usage: %s [lines] [threads]\n", argv[0]);
+        return 1;
+    }
+    printf("Writing %zu lines using %u thread(s)\n\n", lines, threads);
+
+    {
+        SvcFileLogSink::Options opt;
+        opt.maxFileSize = 64 * 1024 * 1024;
+        opt.keepFiles = 1;
+        SvcFileLogSink sink("bench_svcsink.log", opt);
+        if (!sink.isOpen()) {
+            printf("Failed to open SvcFileLogSink!\n");
+            return 1;
+        }
+        run("SvcFileLogSink", lines, threads, ref(sink));
+    }
+    {
+        StreamSink sink("bench_ofstream.log", false);
+        run("ofstream", lines, threads, ref(sink));
+    }
+    {
+        StreamSink sink("bench_ofstream_endl.log", true);
+        run("ofstream + endl", lines, threads, ref(sink));
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// SvcWrapper benchmark: sustained output forwarding throughput.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: OutputPumpBenchmark [megabytes] [line length]
+//
+// Writes the given amount of output (default 256 MB) of lines with the given
+// length (default 80 bytes) into a pipe as fast as possible and forwards it
+// through SvcOutputPump: line by line to a log callback, directly from the
+// reader thread (child process mode) and through the ring buffer (output
+// capturing), and as is to a file (child output file). Prints the sustained
+// throughput in MB/s and lines/s from the first write until everything has
+// been forwarded, along with the number of lines the log callback got.
+#include "svcoutputpump.h"
+#include "svcwrapper_impl.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Same sizes as used for output capturing
+static constexpr DWORD PipeBufferSize = 1024 * 1024;
+static constexpr DWORD RingBufferSize = 4 * 1024 * 1024;
+
+// Size of a single write to the pipe
+static constexpr size_t ChunkSize = 64 * 1024;
+
+static GlobalHandles svc;
+static SvcWrapperSettings settings;
+static atomic<size_t> delivered {0};
+
+// Log callback, only counts the lines it gets
+static void CountLine(void*, SvcLogLevel level, const char*)
+{
+    if (level == Info)
+        delivered.fetch_add(1, memory_order_relaxed);
+}
+
+// Forward output of given size through a pump, returns elapsed time [s]
+static double Run(const vector<char>& chunk, size_t chunks, bool toFile, DWORD ringSize)
+{
+    HANDLE hRead, hWrite;
+    if (!CreatePipe(&hRead, &hWrite, NULL, PipeBufferSize))
+        return 0;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    if (toFile) {
+        hFile = CreateFile("OutputPumpBenchmark.tmp", GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            CloseHandle(hRead);
+            CloseHandle(hWrite);
+            return 0;
+        }
+    }
+    delivered.store(0);
+
+    SvcOutputPump pump(hRead, hFile, Info, ringSize);
+    Clock::time_point start = Clock::now();
+    if (!pump.start()) {
+        CloseHandle(hWrite);
+        return 0;
+    }
+    for (size_t i = 0; i < chunks; ++i) {
+        DWORD written;
+        WriteFile(hWrite, chunk.data(), static_cast<DWORD>(chunk.size()), &written, NULL);
+    }
+    CloseHandle(hWrite);
+    pump.join();
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    size_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 10) : 256;
+    size_t lineLength = argc > 2 ? strtoull(argv[2], nullptr, 10) : 80;
+    if (!megabytes || lineLength < 2 || lineLength > ChunkSize) {
+        printf("Usage: %s [megabytes] [line length]\n", argv[0]);
+        return 1;
+    }
+
+    // Chunk of complete lines, so every write ends on a line boundary
+    size_t linesPerChunk = ChunkSize / lineLength;
+    vector<char> chunk(linesPerChunk * lineLength, 'x');
+    for (size_t i = 1; i <= linesPerChunk; ++i)
+        chunk[i * lineLength - 1] = '\n';
+    size_t chunks = megabytes * 1000000 / chunk.size();
+    size_t bytes = chunks * chunk.size();
+    size_t lines = chunks * linesPerChunk;
+    printf("%zu bytes in %zu lines of %zu bytes\n\n", bytes, lines, lineLength);
+
+    // Forward to a counting log callback, the pump's own summary is Debug
+    settings.svcName = "OutputPumpBenchmark";
+    svc.cfg = &settings;
+    svc.callbacks.log = CountLine;
+    svc.logLevel.store(Info);
+    hSvc = &svc;
+
+    struct Mode {
+        const char* name;
+        bool toFile;
+        DWORD ringSize;
+    };
+    const Mode modes[] = {
+        {"log callback", false, 0},
+        {"log ring buffer", false, RingBufferSize},
+        {"file", true, 0},
+    };
+    for (const Mode& mode : modes) {
+        double s = Run(chunk, chunks, mode.toFile, mode.ringSize);
+        if (s <= 0) {
+            printf("%-16s failed\n", mode.name);
+            return 1;
+        }
+        printf("%-16s %8.1f MB/s   %12.0f lines/s   %10zu lines delivered\n", mode.name,
+               bytes / 1e6 / s, lines / s, mode.toFile ? lines : delivered.load());
+    }
+    return 0;
+}
@@ -0,0 +1,129 @@
+// SvcWrapper benchmark: first request latency with and without prewarming.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: PrewarmBenchmark [data size MiB] [requests] [directory]
+//
+// Writes a data file of the given size (default 256 MiB) to the given
+// directory (default: current directory) with unbuffered I/O, so none of it's
+// pages are in the file cache, and serves requests from a mapping of it. Each
+// request reads 64 random pages, like a lookup in an index would. This is done
+// once with a cold file and once with a file warmed by SvcPrewarm beforehand.
+// Prints the latency of the first request and percentiles of all of them,
+// along with the time spent prewarming.
+#include "svcprewarm.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static constexpr size_t PagesPerRequest = 64;
+
+// Write a file bypassing the file cache, returns false on error
+static bool WriteColdFile(const string& path, ULONGLONG size)
+{
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    const DWORD chunk = 1024 * 1024;
+    char* buffer = static_cast<char*>(VirtualAlloc(NULL, chunk, MEM_COMMIT, PAGE_READWRITE));
+    for (DWORD i = 0; buffer && i < chunk; ++i)
+        buffer[i] = static_cast<char>(i * 31);
+    bool ok = buffer != nullptr;
+    for (ULONGLONG written = 0; ok && written < size; written += chunk) {
+        DWORD bytes;
+        ok = WriteFile(hFile, buffer, chunk, &bytes, NULL) && bytes == chunk;
+    }
+    if (buffer)
+        VirtualFree(buffer, 0, MEM_RELEASE);
+    CloseHandle(hFile);
+    return ok;
+}
+
+// Serve requests from a mapping of the file, returns latencies [us]
+static vector<double> Serve(const string& path, ULONGLONG size, size_t requests)
+{
+    vector<double> latency;
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return latency;
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    const char* data = hMapping ? static_cast<const char*>(
+                                      MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0))
+                                : nullptr;
+    if (data) {
+        mt19937_64 random(42);
+        uniform_int_distribution<ULONGLONG> page(0, size / 4096 - 1);
+        volatile unsigned sum = 0;
+        for (size_t r = 0; r < requests; ++r) {
+            Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < PagesPerRequest; ++i)
+                sum = sum + static_cast<unsigned char>(data[page(random) * 4096]);
+            latency.push_back(chrono::duration<double, micro>(Clock::now() - start).count());
+        }
+        UnmapViewOfFile(data);
+    }
+    if (hMapping)
+        CloseHandle(hMapping);
+    CloseHandle(hFile);
+    return latency;
+}
+
+static void print(const char* name, vector<double> latency)
+{
+    double first = latency.front();
+    sort(latency.begin(), latency.end());
+    printf("%-16s first %10.1f us   p50 %8.1f us   p99 %8.1f us\n", name, first,
+           latency[latency.size() / 2],
+           latency[static_cast<size_t>((latency.size() - 1) * 0.99)]);
+}
+
+int main(int argc, char* argv[])
+{
+    ULONGLONG size = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 256) * 1024 * 1024;
+    size_t requests = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1000;
+    string dir = argc > 3 ? argv[3] : ".";
+    if (!size || !requests) {
+        printf("Usage: %s [data size MiB] [requests] [directory]\n", argv[0]);
+        return 1;
+    }
+    printf("%llu MiB data, %zu requests of %zu random pages\n\n", size / (1024 * 1024),
+           requests, PagesPerRequest);
+
+    // Cold file, pages are faulted in by the requests
+    string coldPath = dir + "\\PrewarmBenchmark.cold";
+    if (!WriteColdFile(coldPath, size)) {
+        printf("Failed to write %s\n", coldPath.c_str());
+        return 1;
+    }
+    vector<double> cold = Serve(coldPath, size, requests);
+    DeleteFile(coldPath.c_str());
+
+    // Prewarmed file
+    string warmPath = dir + "\\PrewarmBenchmark.warm";
+    if (!WriteColdFile(warmPath, size)) {
+        printf("Failed to write %s\n", warmPath.c_str());
+        return 1;
+    }
+    SvcPrewarm prewarm(warmPath.c_str(), false, false);
+    prewarm.run();
+    vector<double> warm = Serve(warmPath, size, requests);
+    DeleteFile(warmPath.c_str());
+
+    if (cold.empty() || warm.empty()) {
+        printf("Failed to map data file\n");
+        return 1;
+    }
+    print("Without prewarm", cold);
+    print("With prewarm", warm);
+    printf("\nPrewarming took %llu ms for %llu MiB\n", prewarm.elapsed(),
+           prewarm.bytes() / (1024 * 1024));
+    return 0;
+}
@@ -0,0 +1,78 @@
+// SvcWrapper benchmark: timer wheel with many timers.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: TimerBenchmark [timers] [max interval ms]
+//
+// Starts the given number of one-shot timers (default 200000) with random
+// intervals up to the given maximum (default 5000 ms), and the same number of
+// timers that are cancelled right away. Prints the time it takes to start and
+// cancel a timer and how late the jobs ran compared to their due time.
+#include "svctimer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 200000;
+    unsigned int maxInterval = argc > 2 ? strtoul(argv[2], nullptr, 10) : 5000;
+    if (!count || !maxInterval) {
+        printf("Usage: %s [timers] [max interval ms]\n", argv[0]);
+        return 1;
+    }
+    printf("%zu timers, intervals up to %u ms\n\n", count, maxInterval);
+
+    SvcTimerWheel wheel;
+    if (!wheel.start()) {
+        printf("Failed to start timer thread\n");
+        return 1;
+    }
+
+    mt19937 random(42);
+    uniform_int_distribution<unsigned int> interval(1, maxInterval);
+    vector<Clock::time_point> due(count);
+    vector<double> lateness(count);
+    atomic<size_t> fired {0};
+
+    // Start timers
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        unsigned int ms = interval(random);
+        due[i] = Clock::now() + chrono::milliseconds(ms);
+        wheel.schedule("benchmark", ms, false, [&, i] {
+            lateness[i] = chrono::duration<double, milli>(Clock::now() - due[i]).count();
+            ++fired;
+        }, nullptr);
+    }
+    double scheduleNs = chrono::duration<double, nano>(Clock::now() - start).count() / count;
+
+    // Start and cancel timers
+    vector<SvcTimerId> ids(count);
+    for (size_t i = 0; i < count; ++i)
+        ids[i] = wheel.schedule("cancelled", interval(random), false, [] {}, nullptr);
+    start = Clock::now();
+    for (SvcTimerId id : ids)
+        wheel.cancel(id);
+    double cancelNs = chrono::duration<double, nano>(Clock::now() - start).count() / count;
+
+    // Wait for all jobs
+    while (fired < count)
+        this_thread::sleep_for(chrono::milliseconds(100));
+    wheel.stop();
+
+    sort(lateness.begin(), lateness.end());
+    printf("Start timer   %8.1f ns\n", scheduleNs);
+    printf("Cancel timer  %8.1f ns\n", cancelNs);
+    printf("Lateness      p50 %6.1f ms   p99 %6.1f ms   max %6.1f ms\n",
+           lateness[count / 2], lateness[static_cast<size_t>((count - 1) * 0.99)],
+           lateness.back());
+    return 0;
+}
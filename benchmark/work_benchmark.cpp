@@ -0,0 +1,74 @@
+// SvcWrapper benchmark: in-flight work guards vs. a single shared counter.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: WorkBenchmark [iterations] [max threads]
+//
+// Each thread creates and releases a SvcWorkGuard the given number of times
+// (default 10000000), with 1, 2, 4, ... up to the given number of threads
+// (default: number of CPU cores). The same is done with a single atomic
+// counter shared by all threads. Prints the average time per unit of work, so
+// the benefit of per core shards can be seen under contention.
+#include "svcwrapper_impl.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+static GlobalHandles svc;
+alignas(64) static atomic<LONGLONG> sharedCount {0};
+
+// Run function on several threads, returns average time per iteration [ns]
+template <typename Function>
+static double Run(size_t threadCount, size_t iterations, Function function)
+{
+    vector<double> results(threadCount);
+    vector<thread> threads;
+    for (size_t t = 0; t < threadCount; ++t)
+        threads.emplace_back([&, t] {
+            hSvc = &svc;
+            Clock::time_point start = Clock::now();
+            for (size_t i = 0; i < iterations; ++i)
+                function();
+            results[t] = chrono::duration<double, nano>(Clock::now() - start).count();
+        });
+    double total = 0;
+    for (size_t t = 0; t < threadCount; ++t) {
+        threads[t].join();
+        total += results[t] / threadCount;
+    }
+    return total / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : 10000000;
+    size_t maxThreads = argc > 2 ? strtoull(argv[2], nullptr, 10)
+                                 : max(1U, thread::hardware_concurrency());
+    if (!iterations || !maxThreads) {
+        printf("Usage: %s [iterations] [max threads]\n", argv[0]);
+        return 1;
+    }
+    printf("%zu iterations per thread\n\n", iterations);
+
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        double guard = Run(threads, iterations, [] {
+            SvcWorkGuard work;
+            if (!work)
+                abort();
+        });
+        double shared = Run(threads, iterations, [] {
+            sharedCount.fetch_add(1, memory_order_seq_cst);
+            sharedCount.fetch_sub(1, memory_order_release);
+        });
+        printf("%3zu threads   SvcWorkGuard %6.1f ns   shared counter %6.1f ns\n", threads,
+               guard, shared);
+    }
+    printf("\n%zu in flight\n", static_cast<size_t>(SvcWorkCount(&svc)));
+    return 0;
+}
@@ -36,6 +36,8 @@ class SvcWrapperConan(ConanFile):
     def generate(self):
         tc = CMakeToolchain(self)
         tc.variables["SVCWRAPPER_EXAMPLE"] = False
+        tc.variables["SVCWRAPPER_BENCHMARK"] = False
+        tc.variables["SVCWRAPPER_ALLOC_CHECK"] = False
         tc.generate()
     
     def build(self):
@@ -0,0 +1,97 @@
+# SvcWrapper overhead report
+# Copyright (c) LASERVORM GmbH 2023
+#
+# Runs the load generator against the RpcServer example, first standalone and
+# then wrapped as service, and prints throughput and latency of both runs and
+# the relative difference. Installing the service requires administrative
+# permissions. Invoked by the RpcOverheadReport target, may also be run by hand:
+#
+#   compare_overhead.ps1 -Server RpcServer.exe -Service RpcServerService.exe
+#                        -LoadGen RpcLoadGen.exe [-Duration 10] [-Connections 64]
+#                        [-Depth 16] [-OutDir .]
+
+param(
+    [Parameter(Mandatory)] [string] $Server,
+    [Parameter(Mandatory)] [string] $Service,
+    [Parameter(Mandatory)] [string] $LoadGen,
+    [int] $Duration = 10,
+    [int] $Connections = 64,
+    [int] $Depth = 16,
+    [string] $OutDir = "."
+)
+
+$ErrorActionPreference = "Stop"
+$Port = 12346
+
+# Run load generator, returns the key=value pairs of it's RESULT line
+function Invoke-LoadGen([string] $Name) {
+    $hgrm = Join-Path $OutDir "$Name.hgrm"
+    $output = & $LoadGen --port $Port --connections $Connections --depth $Depth `
+                         --duration $Duration --hgrm $hgrm
+    $output | Write-Host
+    $line = $output | Where-Object { $_ -like "RESULT *" } | Select-Object -Last 1
+    if (-not $line) {
+        throw "Load generator failed for $Name run"
+    }
+    $result = @{}
+    foreach ($pair in $line.Substring(7).Split(" ")) {
+        $key, $value = $pair.Split("=")
+        $result[$key] = [double] $value
+    }
+    return $result
+}
+
+# Wait until the server accepts connections
+function Wait-Port {
+    for ($i = 0; $i -lt 100; ++$i) {
+        $client = New-Object System.Net.Sockets.TcpClient
+        try {
+            $client.Connect("127.0.0.1", $Port)
+            return
+        } catch {
+            Start-Sleep -Milliseconds 100
+        } finally {
+            $client.Dispose()
+        }
+    }
+    throw "Server didn't start listening on port $Port"
+}
+
+# Standalone run
+Write-Host "=== Standalone ==="
+$proc = Start-Process -FilePath $Server -PassThru -WindowStyle Hidden
+try {
+    Wait-Port
+    $standalone = Invoke-LoadGen "standalone"
+} finally {
+    Stop-Process -Id $proc.Id -Force -ErrorAction SilentlyContinue
+    $proc.WaitForExit()
+}
+
+# Service run
+Write-Host "`n=== Service ==="
+& $Service install | Write-Host
+if ($LASTEXITCODE -ne 0) {
+    throw "Failed to install service, administrative permissions required"
+}
+try {
+    & $Service start --wait | Write-Host
+    if ($LASTEXITCODE -ne 0) {
+        throw "Failed to start service"
+    }
+    Wait-Port
+    $service = Invoke-LoadGen "service"
+} finally {
+    & $Service stop --wait | Write-Host
+    & $Service uninstall | Write-Host
+}
+
+# Report, positive overhead means the service is worse
+Write-Host "`n=== Wrapper overhead ==="
+Write-Host ("{0,-10} {1,14} {2,14} {3,10}" -f "", "standalone", "service", "overhead")
+foreach ($key in "rps", "p50_us", "p99_us", "p999_us", "max_us") {
+    $a = $standalone[$key]
+    $b = $service[$key]
+    $overhead = if ($a -eq 0) { 0 } elseif ($key -eq "rps") { ($a - $b) / $a * 100 } else { ($b - $a) / $a * 100 }
+    Write-Host ("{0,-10} {1,14:N1} {2,14:N1} {3,9:N1}%" -f $key, $a, $b, $overhead)
+}
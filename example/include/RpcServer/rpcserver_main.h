@@ -0,0 +1,9 @@
+// RpcServer high throughput example wrapped as shared library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef RPCSERVER_MAIN_H
+#define RPCSERVER_MAIN_H
+
+int rpcserver_main(int argc, char* argv[]);
+void rpcserver_shutdown();
+
+#endif // RPCSERVER_MAIN_H
@@ -0,0 +1,305 @@
+// SvcWrapper load generator for the RpcServer example.
+// Copyright (c) LASERVORM GmbH 2023
+//
+// Usage: RpcLoadGen [options]
+//   --host <ip>            Server address (default 127.0.0.1)
+//   --port <port>          Server port (default 12346)
+//   --connections <n>      Number of connections, one thread each (default 64)
+//   --depth <n>            Requests in flight per connection (default 16)
+//   --payload <bytes>      Request size including the newline (default 64)
+//   --duration <s>         Measured time (default 10)
+//   --warmup <s>           Time before measuring starts (default 2)
+//   --hgrm <file>          Write latency distribution in HdrHistogram format
+//
+// Every connection keeps the given number of requests in flight: it sends a
+// new request as soon as a response arrives (closed loop). The round trip time
+// of every request is recorded in a log-linear histogram with a precision of
+// better than 1%. Prints throughput and latency percentiles, followed by a
+// single RESULT line of key=value pairs for scripts.
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+// Log-linear latency histogram [ns], 64 sub buckets per power of two
+class Histogram
+{
+public:
+    static constexpr int SubBits = 6;
+    static constexpr int Sub = 1 << SubBits;
+
+    Histogram() : m_counts(Sub * 2 + Sub * 40, 0) {}
+
+    void record(unsigned long long value)
+    {
+        size_t index = indexOf(value);
+        if (index >= m_counts.size())
+            index = m_counts.size() - 1;
+        ++m_counts[index];
+        ++m_total;
+        m_sum += static_cast<double>(value);
+        m_sumSquares += static_cast<double>(value) * value;
+        m_max = max(m_max, value);
+    }
+
+    void add(const Histogram& other)
+    {
+        for (size_t i = 0; i < m_counts.size(); ++i)
+            m_counts[i] += other.m_counts[i];
+        m_total += other.m_total;
+        m_sum += other.m_sum;
+        m_sumSquares += other.m_sumSquares;
+        m_max = max(m_max, other.m_max);
+    }
+
+    // Highest value equivalent to the value at a percentile [0..100]
+    unsigned long long percentile(double p) const
+    {
+        unsigned long long target = static_cast<unsigned long long>(ceil(p / 100 * m_total));
+        unsigned long long count = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i) {
+            count += m_counts[i];
+            if (count >= max(1ULL, target))
+                return min(m_max, upperBound(i));
+        }
+        return m_max;
+    }
+
+    unsigned long long total() const { return m_total; }
+    unsigned long long maxValue() const { return m_max; }
+    double mean() const { return m_total ? m_sum / m_total : 0; }
+    double stdDev() const
+    {
+        if (!m_total)
+            return 0;
+        double mean = this->mean();
+        return sqrt(max(0.0, m_sumSquares / m_total - mean * mean));
+    }
+
+    // Write percentile distribution like HdrHistogram's outputPercentileDistribution()
+    void writeHgrm(FILE* out, double scale) const
+    {
+        fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount",
+                "1/(1-Percentile)");
+        unsigned long long count = 0;
+        size_t i = 0;
+        for (int half = 0; half < 30; ++half) {
+            for (int tick = 0; tick < 5; ++tick) {
+                double p = 1 - pow(0.5, half) + tick * pow(0.5, half + 1) / 5;
+                unsigned long long target = static_cast<unsigned long long>(ceil(p * m_total));
+                while (i < m_counts.size() && count + m_counts[i] < max(1ULL, target))
+                    count += m_counts[i++];
+                if (i >= m_counts.size() || target >= m_total)
+                    break;
+                fprintf(out, "%12.3f %2.12f %10llu %14.2f\n",
+                        min(m_max, upperBound(i)) / scale, p, count + m_counts[i], 1 / (1 - p));
+            }
+            if (ldexp(1.0, half) > m_total)
+                break;
+        }
+        fprintf(out, "%12.3f %2.12f %10llu\n", m_max / scale, 1.0, m_total);
+        fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", mean() / scale,
+                stdDev() / scale);
+        fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n", m_max / scale, m_total);
+        fprintf(out, "#[Buckets = %12zu, SubBuckets     = %12d]\n", m_counts.size() / Sub, Sub);
+    }
+
+private:
+    static size_t indexOf(unsigned long long value)
+    {
+        int shift = 0;
+        while ((value >> shift) >= 2 * Sub)
+            ++shift;
+        return static_cast<size_t>(shift) * Sub + static_cast<size_t>(value >> shift);
+    }
+
+    static unsigned long long upperBound(size_t index)
+    {
+        size_t shift = index < 2 * Sub ? 0 : index / Sub - 1;
+        unsigned long long sub = index - shift * Sub;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    vector<unsigned long long> m_counts;
+    unsigned long long m_total {0};
+    unsigned long long m_max {0};
+    double m_sum {0};
+    double m_sumSquares {0};
+};
+
+struct Options {
+    string host {"127.0.0.1"};
+    unsigned short port {12346};
+    size_t connections {64};
+    size_t depth {16};
+    size_t payload {64};
+    double duration {10};
+    double warmup {2};
+    string hgrm;
+};
+
+// One connection, returns false on connection errors
+static bool RunConnection(const Options& opt, Clock::time_point measureStart,
+                          Clock::time_point end, Histogram& histogram)
+{
+    SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (s == INVALID_SOCKET)
+        return false;
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+    BOOL noDelay = TRUE;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay),
+               sizeof(noDelay));
+    if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        closesocket(s);
+        return false;
+    }
+
+    string request(max<size_t>(1, opt.payload) - 1, 'x');
+    request += '\n';
+    vector<Clock::time_point> sent(opt.depth);
+    size_t head = 0, tail = 0, inFlight = 0;
+
+    // Fill the pipeline
+    string out;
+    for (size_t i = 0; i < opt.depth; ++i) {
+        out += request;
+        sent[tail] = Clock::now();
+        tail = (tail + 1) % opt.depth;
+        ++inFlight;
+    }
+    bool ok = send(s, out.data(), static_cast<int>(out.size()), 0) == static_cast<int>(out.size());
+
+    // Answer every response with a new request until the time is up
+    vector<char> in(64 * 1024);
+    while (ok && inFlight) {
+        int n = recv(s, in.data(), static_cast<int>(in.size()), 0);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        Clock::time_point now = Clock::now();
+        bool sending = now < end;
+        out.clear();
+        for (int i = 0; i < n; ++i) {
+            if (in[i] != '\n')
+                continue;
+            if (now >= measureStart) {
+                histogram.record(static_cast<unsigned long long>(
+                    chrono::duration_cast<chrono::nanoseconds>(now - sent[head]).count()));
+            }
+            head = (head + 1) % opt.depth;
+            --inFlight;
+            if (sending) {
+                out += request;
+                sent[tail] = now;
+                tail = (tail + 1) % opt.depth;
+                ++inFlight;
+            }
+        }
+        if (!out.empty())
+            ok = send(s, out.data(), static_cast<int>(out.size()), 0) == static_cast<int>(out.size());
+    }
+    closesocket(s);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    Options opt;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        string arg = argv[i];
+        if (arg == "--host")
+            opt.host = argv[i + 1];
+        else if (arg == "--port")
+            opt.port = static_cast<unsigned short>(strtoul(argv[i + 1], nullptr, 10));
+        else if (arg == "--connections")
+            opt.connections = strtoull(argv[i + 1], nullptr, 10);
+        else if (arg == "--depth")
+            opt.depth = strtoull(argv[i + 1], nullptr, 10);
+        else if (arg == "--payload")
+            opt.payload = strtoull(argv[i + 1], nullptr, 10);
+        else if (arg == "--duration")
+            opt.duration = strtod(argv[i + 1], nullptr);
+        else if (arg == "--warmup")
+            opt.warmup = strtod(argv[i + 1], nullptr);
+        else if (arg == "--hgrm")
+            opt.hgrm = argv[i + 1];
+        else
+            opt.connections = 0;
+    }
+    if (argc % 2 == 0 || !opt.connections || !opt.depth || opt.duration <= 0) {
+        printf("Usage: %s [--host ip] [--port port] [--connections n] [--depth n]\n"
+               "       [--payload bytes] [--duration s] [--warmup s] [--hgrm file]\n", argv[0]);
+        return 1;
+    }
+
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+        return 1;
+    printf("%zu connections, %zu requests in flight each, %zu bytes payload\n",
+           opt.connections, opt.depth, opt.payload);
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point measureStart = start + chrono::duration_cast<Clock::duration>(
+                                                 chrono::duration<double>(opt.warmup));
+    Clock::time_point end = measureStart + chrono::duration_cast<Clock::duration>(
+                                               chrono::duration<double>(opt.duration));
+    vector<Histogram> histograms(opt.connections);
+    atomic<size_t> failed {0};
+    vector<thread> threads;
+    for (size_t i = 0; i < opt.connections; ++i)
+        threads.emplace_back([&, i] {
+            if (!RunConnection(opt, measureStart, end, histograms[i]))
+                ++failed;
+        });
+    for (thread& t : threads)
+        t.join();
+    WSACleanup();
+
+    Histogram total;
+    for (const Histogram& h : histograms)
+        total.add(h);
+    if (failed)
+        printf("%zu connection(s) failed!\n", failed.load());
+    if (!total.total()) {
+        printf("No responses received, is the server running?\n");
+        return 1;
+    }
+
+    double rps = total.total() / opt.duration;
+    printf("\n%llu requests, %.0f requests/s\n", total.total(), rps);
+    printf("p50 %8.1f us   p90 %8.1f us   p99 %8.1f us   p99.9 %8.1f us   max %8.1f us\n",
+           total.percentile(50) / 1e3, total.percentile(90) / 1e3, total.percentile(99) / 1e3,
+           total.percentile(99.9) / 1e3, total.maxValue() / 1e3);
+    printf("RESULT requests=%llu rps=%.0f p50_us=%.1f p90_us=%.1f p99_us=%.1f "
+           "p999_us=%.1f max_us=%.1f failed=%zu\n",
+           total.total(), rps, total.percentile(50) / 1e3, total.percentile(90) / 1e3,
+           total.percentile(99) / 1e3, total.percentile(99.9) / 1e3, total.maxValue() / 1e3,
+           failed.load());
+
+    // Latency distribution in microseconds
+    if (!opt.hgrm.empty()) {
+        FILE* out = fopen(opt.hgrm.c_str(), "w");
+        if (!out) {
+            printf("Failed to write %s\n", opt.hgrm.c_str());
+            return 1;
+        }
+        total.writeHgrm(out, 1e3);
+        fclose(out);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+// RpcServer high throughput example wrapped as shared library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "rpcserver.h"
+#include <QDebug>
+#include <QTcpSocket>
+
+RpcConnection::RpcConnection(qintptr socketDescriptor, QObject* parent)
+    : QObject{parent},
+      m_socket(new QTcpSocket(this))
+{
+    connect(m_socket, &QTcpSocket::readyRead, this, &RpcConnection::process);
+    connect(m_socket, &QTcpSocket::disconnected, this, &QObject::deleteLater);
+    if (!m_socket->setSocketDescriptor(socketDescriptor)) {
+        deleteLater();
+        return;
+    }
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+}
+
+/*
+ * Requests are newline terminated lines, each one is answered by echoing it.
+ * Clients may pipeline requests, all complete requests received so far are
+ * answered with a single write. Nothing is logged per request, as that would
+ * cost more than serving it.
+ */
+void RpcConnection::process()
+{
+    m_in.append(m_socket->readAll());
+    int begin = 0;
+    for (;;) {
+        int end = m_in.indexOf('\n', begin);
+        if (end < 0)
+            break;
+        m_out.append(m_in.constData() + begin, end + 1 - begin);
+        begin = end + 1;
+    }
+    m_in.remove(0, begin);
+    if (!m_out.isEmpty()) {
+        m_socket->write(m_out);
+        m_out.clear();
+    }
+}
+
+void RpcWorker::addConnection(qintptr socketDescriptor)
+{
+    new RpcConnection(socketDescriptor, this);
+}
+
+RpcServer::RpcServer(quint16 port, int threads)
+    : QTcpServer{nullptr},
+      m_port(port)
+{
+    // Accept connections in this thread, serve them in the workers
+    for (int i = 0; i < qMax(1, threads); ++i) {
+        QThread* thread = new QThread(this);
+        RpcWorker* worker = new RpcWorker;
+        worker->moveToThread(thread);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        thread->start();
+        m_threads.append(thread);
+        m_workers.append(worker);
+    }
+    setMaxPendingConnections(1024);
+}
+
+RpcServer::~RpcServer()
+{
+    stopWorkers();
+}
+
+void RpcServer::startup()
+{
+    bool res = listen(QHostAddress::LocalHost, m_port);
+    if (res) {
+        qInfo() << "Server listening on port" << serverPort()
+                << "with" << m_threads.size() << "worker threads";
+        return;
+    }
+
+    qCritical() << "Server startup failed!";
+    emit done(1);
+}
+
+void RpcServer::shutdown()
+{
+    close();
+    stopWorkers();
+    emit done(0);
+}
+
+void RpcServer::incomingConnection(qintptr socketDescriptor)
+{
+    // Distribute connections round robin
+    RpcWorker* worker = m_workers[m_next];
+    m_next = (m_next + 1) % m_workers.size();
+    QMetaObject::invokeMethod(worker, [worker, socketDescriptor]() {
+        worker->addConnection(socketDescriptor);
+    }, Qt::QueuedConnection);
+}
+
+void RpcServer::stopWorkers()
+{
+    for (QThread* thread : m_threads) {
+        thread->quit();
+        thread->wait();
+    }
+}
@@ -0,0 +1,65 @@
+// RpcServer high throughput example wrapped as shared library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef RPCSERVER_H
+#define RPCSERVER_H
+
+#include <QByteArray>
+#include <QObject>
+#include <QTcpServer>
+#include <QThread>
+#include <QVector>
+
+class QTcpSocket;
+
+// Client connection, lives in a worker thread
+class RpcConnection : public QObject
+{
+    Q_OBJECT
+public:
+    RpcConnection(qintptr socketDescriptor, QObject* parent);
+
+private slots:
+    void process();
+
+private:
+    QTcpSocket* m_socket;
+    QByteArray m_in;
+    QByteArray m_out;
+};
+
+// Worker thread's event loop serving connections
+class RpcWorker : public QObject
+{
+    Q_OBJECT
+public:
+    void addConnection(qintptr socketDescriptor);
+};
+
+class RpcServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    RpcServer(quint16 port, int threads);
+    ~RpcServer();
+
+public:
+    void startup();
+    void shutdown();
+
+signals:
+    void done(int exitCode);
+
+protected:
+    void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+    void stopWorkers();
+
+private:
+    quint16 m_port;
+    QVector<QThread*> m_threads;
+    QVector<RpcWorker*> m_workers;
+    int m_next {0};
+};
+
+#endif // RPCSERVER_H
@@ -0,0 +1,43 @@
+// RpcServer high throughput example wrapped as shared library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "RpcServer/rpcserver_main.h"
+#include <QCoreApplication>
+#include <QThread>
+#include "rpcserver.h"
+
+static RpcServer* hSrv {nullptr};
+
+/*
+ * Main function of the high throughput example. Optional arguments are the
+ * port to listen on (default 12346) and the number of worker threads
+ * (default: number of CPU cores).
+ */
+int rpcserver_main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList args = app.arguments();
+    quint16 port = args.size() > 1 ? args[1].toUShort() : 12346;
+    int threads = args.size() > 2 ? args[2].toInt() : QThread::idealThreadCount();
+
+    RpcServer srv(port, threads);
+    hSrv = &srv;
+    QObject::connect(&srv, &RpcServer::done,
+                     &app, &QCoreApplication::exit, Qt::QueuedConnection);
+    QMetaObject::invokeMethod(&srv, &RpcServer::startup, Qt::QueuedConnection);
+
+    int exitCode = app.exec();
+    hSrv = nullptr;
+    return exitCode;
+}
+
+/*
+ * Shutdown handler of the high throughput example, thread safe by using a
+ * queued connection.
+ */
+void rpcserver_shutdown()
+{
+    if (!hSrv)
+        return;
+    QMetaObject::invokeMethod(hSrv, &RpcServer::shutdown,
+                              Qt::QueuedConnection);
+}
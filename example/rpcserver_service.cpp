@@ -0,0 +1,28 @@
+// SvcWrapper high throughput service example.
+// This version of the high throughput example runs it as Windows service, so
+// it's performance can be compared to the standalone version.
+// Copyright (c) LASERVORM GmbH 2023
+#include <SvcWrapper/svcwrapper.h>
+#include <RpcServer/rpcserver_main.h>
+#include <QDebug>
+
+// Only warnings and worse, the wrapper's own messages must not skew results
+void logHandler(SvcLogLevel level, const char* msg)
+{
+    if (level <= Warning)
+        qWarning() << msg;
+}
+
+int main(int argc, char* argv[])
+{
+    SvcWrapperConfig cfg;
+    cfg.svcName = "RpcServer";
+    cfg.svcDisplayName = "RpcServer example";
+    cfg.svcDescription = "High throughput example of the SvcWrapper library";
+    cfg.svcCallbackMain = rpcserver_main;
+    cfg.svcCallbackStop = rpcserver_shutdown;
+    cfg.svcLogCallback = logHandler;
+    cfg.logLevel = Warning;
+
+    return SvcWrapper(argc, argv, cfg);
+}
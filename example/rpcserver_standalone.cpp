@@ -0,0 +1,9 @@
+// SvcWrapper high throughput standalone example.
+// Copyright (c) LASERVORM GmbH 2023
+#include "RpcServer/rpcserver_main.h"
+
+// Baseline for measuring the wrapper's overhead, see compare_overhead.ps1
+int main(int argc, char* argv[])
+{
+    return rpcserver_main(argc, argv);
+}
@@ -0,0 +1,73 @@
+/* Allocation statistics of the SvcWrapper library.
+ *
+ * Link the optional CMake target SvcWrapper::AllocStats into your service
+ * executable to count heap allocations without running a heap profiler. It
+ * replaces the global operator new and delete by counting shims, the wrapper
+ * then logs the statistics when a service stops and reports them through the
+ * `stats` control command. Use SvcAllocStatsSnapshot() to read them from your
+ * application.
+ *
+ * Counters are kept per thread and only summed up when a snapshot is taken,
+ * so counting doesn't add contention between threads. Statistics cover the
+ * whole process, including all services hosted by it.
+ *
+ * Copyright (c) LASERVORM GmbH 2023
+ */
+#ifndef SVCALLOCSTATS_H
+#define SVCALLOCSTATS_H
+
+#include <cstddef>
+
+/*!
+ * \brief Allocation statistics
+ * \details Snapshot of the allocation counters of the process.
+ * \sa SvcAllocStatsSnapshot()
+ */
+struct SvcAllocStats {
+    /*!
+     * \brief Number of size classes
+     * \details Size class `i` counts allocations of up to `16 << i` bytes,
+     * the last class counts all larger ones.
+     */
+    static constexpr size_t SizeClasses = 16;
+
+    //! \brief Time [ms] since counting started
+    unsigned long long uptime {0};
+
+    //! \brief Number of allocations
+    unsigned long long allocations {0};
+
+    //! \brief Number of deallocations
+    unsigned long long deallocations {0};
+
+    //! \brief Bytes allocated in total
+    unsigned long long bytesAllocated {0};
+
+    //! \brief Bytes deallocated in total
+    unsigned long long bytesFreed {0};
+
+    //! \brief Bytes currently allocated
+    unsigned long long liveBytes {0};
+
+    //! \brief Average allocations per second since counting started
+    double allocationsPerSec {0};
+
+    //! \brief Average bytes allocated per second since counting started
+    double bytesPerSec {0};
+
+    //! \brief Number of allocations by size class
+    unsigned long long sizeClasses[SizeClasses] {};
+};
+
+/*!
+ * \brief Take allocation statistics snapshot
+ * \details Sums up the counters of all threads. Counters keep running
+ * meanwhile, so the values of a snapshot may be off by the allocations done
+ * while it is taken. Take two snapshots and compare them to get the rates of
+ * a certain interval.
+ * \note Only available if SvcWrapper::AllocStats is linked.
+ * \param stats Filled with the current statistics
+ */
+void SvcAllocStatsSnapshot(SvcAllocStats& stats);
+
+#endif // SVCALLOCSTATS_H
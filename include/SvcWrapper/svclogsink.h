@@ -0,0 +1,116 @@
+/* Public header of the SvcWrapper library: file log sink.
+ *
+ * SvcWrapper is a library that allows to wrap any C/C++ application into a
+ * fully functional Windows service.
+ * Source code and readme can be found at:
+ * https://github.com/LASERVORM/SvcWrapper
+ *
+ * Copyright (c) LASERVORM GmbH 2023
+ */
+#ifndef SVCLOGSINK_H
+#define SVCLOGSINK_H
+
+#include "SvcWrapper/svcwrapper.h"
+#include <cstddef>
+
+/*!
+ * \brief Memory mapped file log sink
+ * \details The SvcFileLogSink class implements a ready to use log handler
+ * for SvcWrapperConfig::svcLogCallback, which writes log lines into a
+ * preallocated memory mapped file. Writing a line just costs formatting it's
+ * timestamp, a memcpy and an atomic offset increment, no system call is made
+ * unless the file needs to be rotated. As the data is written to the file
+ * mapping directly, it is persisted by Windows even if the process crashes.
+ *
+ * The log file is rotated when it is full or, if configured, when it gets too
+ * old. Rotated files are renamed to `<path>.1`, `<path>.2` and so on. An
+ * existing log file is rotated when the sink is created, so each run starts
+ * with a new file.
+ *
+ * Additionally, all messages (regardless of their log level) are written to
+ * a small ring buffer file named `<path>.flight`, the flight recorder. It
+ * always contains the most recent messages, including debug output you don't
+ * want to have in the log file. The flight recorder of the previous run is
+ * kept as `<path>.flight.1`.
+ *
+ * Usage example:
+ * \code
+ * SvcFileLogSink sink("C:\\ProgramData\\MyApp\\service.log");
+ * cfg.svcLogCallback = std::ref(sink);
+ * \endcode
+ *
+ * \note As the file is preallocated, it's tail is filled with zero bytes
+ * until it is closed or rotated. Lines are never split across files.
+ * \note The flight recorder file starts with a 64 byte header, containing
+ * the magic `SVCFLT1`, the total number of bytes ever written (the ring
+ * buffer's write position is this value modulo the ring size) and the ring
+ * size as 64 bit little endian integers at offsets 8 and 16.
+ */
+class SvcFileLogSink
+{
+public:
+    /*!
+     * \brief Sink options
+     * \details The Options struct contains optional settings of the sink.
+     */
+    struct Options {
+        //! \brief Size of a log file before it's rotated [bytes]
+        size_t maxFileSize {16 * 1024 * 1024};
+
+        //! \brief Maximum age of a log file before it's rotated [s], 0 = none
+        unsigned int maxFileAge {0};
+
+        //! \brief Number of rotated log files to keep
+        unsigned int keepFiles {5};
+
+        //! \brief Least severe level written to the log file
+        SvcLogLevel fileLevel {Info};
+
+        //! \brief Size of the flight recorder ring buffer [bytes], 0 = disable
+        size_t flightRecorderSize {64 * 1024};
+    };
+
+    /*!
+     * \brief Create file log sink
+     * \details Opens the log file and flight recorder. Check isOpen() to see
+     * if this succeeded, messages passed to a sink that failed to open are
+     * dropped silently.
+     * \param path Path of the log file
+     * \param options Sink options
+     */
+    explicit SvcFileLogSink(const char* path, const Options& options);
+    explicit SvcFileLogSink(const char* path);
+    ~SvcFileLogSink();
+
+    SvcFileLogSink(const SvcFileLogSink&) = delete;
+    SvcFileLogSink& operator=(const SvcFileLogSink&) = delete;
+
+    /*!
+     * \brief Check if sink is ready
+     * \return true if the log file is open for writing
+     */
+    bool isOpen() const;
+
+    /*!
+     * \brief Write log message
+     * \details Appends a line to the log file and flight recorder.
+     * \note This function is thread safe.
+     * \param level Log level
+     * \param msg Message text
+     */
+    void operator()(SvcLogLevel level, const char* msg);
+
+    /*!
+     * \brief Flush log file
+     * \details Flushes the file mapping to disk. This is only needed to be
+     * safe against OS crashes or power loss, a process crash doesn't lose
+     * any data.
+     */
+    void flush();
+
+private:
+    struct Impl;
+    Impl* d;
+};
+
+#endif // SVCLOGSINK_H
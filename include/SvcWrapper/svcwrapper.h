@@ -10,6 +10,7 @@
 #ifndef SVCWRAPPER_H
 #define SVCWRAPPER_H
 
+#include <cstddef>
 #include <functional>
 
 // === SvcWrapper exitcodes ====================================================
@@ -28,6 +29,12 @@
 // druing a CLI operation. Details may be found in console output.
 #define SVCWRAPPER_EXITCODE_CLI_SCM_ERROR 3
 
+// The CLI failed to communicate with the service through it's control pipe.
+#define SVCWRAPPER_EXITCODE_CLI_CONTROL_ERROR 4
+
+// The CLI couldn't read the run history journal of the service.
+#define SVCWRAPPER_EXITCODE_CLI_HISTORY_ERROR 5
+
 // The service process couldn't be attached to the Windows Service controller.
 // This happens, when a service executable is started manually.
 #define SVCWRAPPER_EXITCODE_SVC_CTRL_DISPATCHER_FAILED 1000
@@ -36,6 +43,9 @@
 // Control Manager.
 #define SVCWRAPPER_EXITCODE_SVC_REG_CTRL_HANDLER_FAILED 1001
 
+// The configured child process executable couldn't be started.
+#define SVCWRAPPER_EXITCODE_CHILD_START_FAILED 1002
+
 // === SvcWrapper logging ======================================================
 
 /*!
@@ -53,12 +63,13 @@ enum SvcLogLevel {
 
 // === SvcWrapper configuration ================================================
 /*!
- * \brief SvcWrapper configuration
- * \details The SvcWrapperConfig struct contains the configuration for a
- * SvcWrapper service. It should be created within `main` and passed to
- * the SvcWrapper function.
+ * \brief SvcWrapper settings
+ * \details The SvcWrapperSettings struct contains all settings of a
+ * SvcWrapper service except the callbacks. It is a literal type, so it can
+ * be defined `constexpr` and checked at compile time by SvcWrapperStatic().
+ * \sa SvcWrapperConfig
  */
-struct SvcWrapperConfig {
+struct SvcWrapperSettings {
     /*!
      * \brief Service start types
      * \details The StartType enum defines possible start types for the service.
@@ -133,22 +144,272 @@ struct SvcWrapperConfig {
      */
     UserType svcUserType {UserType::UserTypeLocalService};
 
+    /*!
+     * \brief Service dependencies
+     * \details Optional comma separated list of services (e.g.
+     * `"Tcpip, MyAppBroker"`) that must be running before this service is
+     * started. The `install` command registers them with the Service Control
+     * Manager, the `start --wait` command starts dependencies first.
+     * \sa readyNotify
+     */
+    const char* svcDependencies {nullptr};
+
+    /*!
+     * \brief Report readiness explicitly
+     * \details By default, the service is reported running as soon as the
+     * application's main callback is invoked. If enabled, the service stays
+     * start pending until the application calls SvcReady(), so dependent
+     * services and `start --wait` wait for it to be actually ready.
+     * The default value is false.
+     * \sa SvcReady(), readyTimeout
+     */
+    bool readyNotify {false};
+
+    /*!
+     * \brief Ready timeout [ms]
+     * \details Time the application may take to call SvcReady() if
+     * readyNotify is enabled. If it expires, the start fails: the application
+     * is asked to stop and the service is reported stopped with the exit code
+     * ERROR_SERVICE_START_HANG. If this value is 0, the wrapper waits until
+     * the application is ready or the service is stopped.
+     * The default value is 30000 (30s).
+     */
+    unsigned int readyTimeout {30000};
+
+    /*!
+     * \brief Prewarm paths
+     * \details Optional semicolon separated list of files and directories
+     * (e.g. `"C:\\MyApp\\index.db; C:\\MyApp\\templates"`) to be read into
+     * memory when the service starts, directories are read recursively
+     * without following junctions and directory symlinks. Pages of these
+     * files are faulted in in parallel before the service is reported
+     * running, so the first requests don't wait for lazy page faults.
+     * The time spent and the amount of data is logged and reported by the
+     * `stats` control command.
+     * \sa prewarmImages, prewarmLock
+     */
+    const char* prewarmPaths {nullptr};
+
+    /*!
+     * \brief Prewarm images
+     * \details If enabled, the code and data pages of the executable and all
+     * libraries loaded by the time the service starts are faulted in along
+     * with prewarmPaths. The default value is false.
+     */
+    bool prewarmImages {false};
+
+    /*!
+     * \brief Lock prewarmed pages
+     * \details If enabled, prewarmed pages are locked into the working set
+     * until the service stops, so they aren't paged out when the service is
+     * idle. The working set quota of the process is raised accordingly.
+     * Only use this for small, hot data sets. The default value is false.
+     */
+    bool prewarmLock {false};
+
     /*!
      * \brief Service shutdown timeout [ms]
      * \details Specifies the timeout in milliseconds for the wrapped
      * application to shutdown safely after the shutdown callback was invoked,
      * before it's thread will be terminated. If this value is 0, the wrapper
-     * will wait until the applications main function returns.
+     * will wait until the applications main function returns, telling the
+     * SCM to expect 30s. The stop checkpoint isn't advanced beyond that, so
+     * the SCM can tell a hanging stop.
      * The default value is 30000 (30s).
      */
     unsigned int shutdownTimeout {30000};
 
+    /*!
+     * \brief Drain timeout [ms]
+     * \details If this value is not 0, stopping the service drains the work
+     * in flight first: SvcWorkGuard stops admitting new work, and the wrapper
+     * waits until all guards have been released or this timeout expired.
+     * Only then svcCallbackStop is invoked and shutdownTimeout applies. The
+     * drain time and the number of requests cut off are logged. Not available
+     * in child process mode. The default value is 0 (stop right away).
+     * \sa SvcWorkGuard, drainControlPipe
+     */
+    unsigned int drainTimeout {0};
+
+    /*!
+     * \brief Close control pipe when draining
+     * \details If enabled, the control pipe stops accepting clients as soon
+     * as draining starts, so health checks using it see the service going
+     * away. Otherwise it's served until the service stopped, which allows to
+     * watch the drain with the `stats` command. The default value is false.
+     * \sa drainTimeout, controlPipe
+     */
+    bool drainControlPipe {false};
+
+    /*!
+     * \brief Idle timeout [s]
+     * \details If this value is not 0, the wrapper stops the service cleanly
+     * once the application hasn't reported any activity through SvcTouch()
+     * for the given number of seconds. This is meant for rarely used services
+     * that should not stay resident all the time, combine it with
+     * svcTriggerPipe to have them started again on demand.
+     * The default value is 0 (never stop on idle).
+     * \sa SvcTouch()
+     */
+    unsigned int idleTimeout {0};
+
+    /*!
+     * \brief Start trigger pipe name
+     * \details Optional name of a named pipe (without the `\\.\pipe\` prefix).
+     * If set, the `install` command registers a service trigger, so the
+     * Service Control Manager starts the service as soon as a client tries to
+     * open this pipe. Your application is expected to serve the pipe once it
+     * is running.
+     */
+    const char* svcTriggerPipe {nullptr};
+
+    /*!
+     * \brief Child process executable
+     * \details Optional path to an executable that should be run as the
+     * service instead of svcCallbackMain. The wrapper spawns it when the
+     * service starts and reports its exit code when it terminates. To stop it,
+     * a Ctrl+Break event is sent to the child's console, followed by a hard
+     * kill if it didn't exit within shutdownTimeout.
+     */
+    const char* childExecutable {nullptr};
+
+    /*!
+     * \brief Child process args
+     * \details Optional string of whitespace separated arguments to pass to
+     * childExecutable, just as you would type them into command prompt.
+     */
+    const char* childArgs {nullptr};
+
+    /*!
+     * \brief Child process output file
+     * \details Optional path to a file the child's stdout and stderr should be
+     * appended to. If not set, the output will be forwarded line by line to
+     * svcLogCallback using childLogLevel.
+     */
+    const char* childLogFile {nullptr};
+
+    /*!
+     * \brief Child process output log level
+     * \details Log level used for forwarding the child's output lines to
+     * svcLogCallback. The default value is SvcLogLevel::Info.
+     */
+    SvcLogLevel childLogLevel {Info};
+
+    /*!
+     * \brief Capture application output
+     * \details If enabled, stdout and stderr of the service process are
+     * redirected into a pipe before svcCallbackMain is invoked. Everything
+     * your application or it's libraries print via `std::cout`, `printf` etc.
+     * will be forwarded line by line to svcLogCallback using captureLogLevel.
+     * The default value is false, as services have no console, this output
+     * is lost otherwise.
+     *
+     * \note Captured output passes a 4 MiB buffer, so writing to stdout
+     * doesn't wait for svcLogCallback. If your log handler can't keep up and
+     * the buffer is full, further output is dropped until there is space
+     * again. A warning containing the number of dropped bytes is logged then.
+     * \note stdout keeps being buffered by the C runtime, flush it to get
+     * lines delivered immediately. stderr is unbuffered.
+     * \warning svcLogCallback must not write to stdout or stderr while output
+     * is captured, e.g. via `std::cerr` or a logging library's console sink.
+     * Every forwarded line would be captured again and forwarded once more,
+     * endlessly. Write to a file, the event log or the debugger instead.
+     */
+    bool captureOutput {false};
+
+    /*!
+     * \brief Captured output log level
+     * \details Log level used for forwarding captured output lines to
+     * svcLogCallback. The default value is SvcLogLevel::Info.
+     * \sa captureOutput
+     */
+    SvcLogLevel captureLogLevel {Info};
+
+    /*!
+     * \brief Log level
+     * \details Least severe level of messages passed to svcLogCallback. It
+     * can be changed at runtime with the `loglevel` control command.
+     * The default value is SvcLogLevel::Debug (log everything).
+     */
+    SvcLogLevel logLevel {Debug};
+
+    /*!
+     * \brief Log rate limit [messages/s]
+     * \details If this value is not 0, messages are rate limited per call
+     * site (the code calling SvcLogMessage() or the wrapper's logging), so a
+     * warning logged in a loop can't flood svcLogCallback. Each call site may
+     * log a burst of this many messages, then this many per second. Output
+     * captured from the application counts as one call site. Suppressed
+     * messages are summarized once per second, along with the text of the
+     * first one. Critical messages are never suppressed. Each service with
+     * rate limiting reserves 8 KiB for it's 64 call site buckets at startup,
+     * there's no limit to the number of such services sharing a process.
+     * The default value is 0 (no limit).
+     * \sa logDeduplicate, logSampleInfo
+     */
+    unsigned int logRateLimit {0};
+
+    /*!
+     * \brief Collapse repeated log messages
+     * \details If enabled, a message identical to the previous one (same
+     * level and text) isn't passed to svcLogCallback again. Instead, a
+     * "Last message repeated N times" summary is logged once a different
+     * message arrives, and once per second while it keeps repeating.
+     * Critical messages are never collapsed. The default value is false.
+     */
+    bool logDeduplicate {false};
+
+    /*!
+     * \brief Info message sampling
+     * \details Only every n-th message of level Info is passed to
+     * svcLogCallback, the others are dropped and counted. Values of 0 and 1
+     * pass all messages, which is the default.
+     */
+    unsigned int logSampleInfo {1};
+
+    /*!
+     * \brief Debug message sampling
+     * \details Only every n-th message of level Debug is passed to
+     * svcLogCallback, like logSampleInfo. The default value is 1 (all).
+     */
+    unsigned int logSampleDebug {1};
+
+    /*!
+     * \brief Enable control pipe
+     * \details If enabled, the wrapper serves the named pipe
+     * `\\.\pipe\SvcWrapper.<svcName>` while the service is running. It
+     * accepts control commands with payloads and replies to them, see
+     * SvcRegisterControlCommand(). Use the `ctl` CLI command of the service
+     * executable to send commands. The default value is false.
+     */
+    bool controlPipe {false};
+
+    /*!
+     * \brief Run history file
+     * \details Optional path of a binary journal recording every run of the
+     * service: start, ready and stop durations, exit codes, the reason for
+     * stopping and the peak working set. The journal keeps the last 1024
+     * runs (64 KiB), the oldest ones are overwritten. Use the `history` CLI
+     * command to show them along with startup trends across deployments.
+     * The service account needs write access to the file.
+     */
+    const char* historyFile {nullptr};
+};
+
+/*!
+ * \brief SvcWrapper configuration
+ * \details The SvcWrapperConfig struct contains the configuration for a
+ * SvcWrapper service. It should be created within `main` and passed to
+ * the SvcWrapper function.
+ */
+struct SvcWrapperConfig : SvcWrapperSettings {
     /*!
      * \brief Application main callback
      * \details Callback function to your applications `main` function, this
-     * is mandatory. This function will be invoked in a new thread when the
-     * service starts, it will be passed argc and argv from the service
-     * controller and is expected to return an exit code.
+     * is mandatory unless childExecutable is set. This function will be
+     * invoked in a new thread when the service starts, it will be passed argc
+     * and argv from the service controller and is expected to return an exit
+     * code.
      * \note This function needs to block as long as the service is running, so
      * this is the right place to execute your frameworks/own event loop.
      */
@@ -157,9 +418,10 @@ struct SvcWrapperConfig {
     /*!
      * \brief Application shutdown callback
      * \details Callback to your applications shutdown routine, this is
-     * mandatory. This function will be called, when the Windows Service
-     * Control Manager wants the service to stop. It should instruct your
-     * application to initiate shutdown but return immediately.
+     * mandatory unless childExecutable is set. This function will be called,
+     * when the Windows Service Control Manager wants the service to stop. It
+     * should instruct your application to initiate shutdown but return
+     * immediately.
      * \note This function will be called from SvcWrappers thread, so it
      * must be thread safe!
      */
@@ -191,4 +453,265 @@ struct SvcWrapperConfig {
  */
 int SvcWrapper(int argc, char* argv[], const SvcWrapperConfig &svcConfig);
 
+/*!
+ * \brief SvcWrapper main function for multiple services
+ * \details Hosts several services in one process, sharing the runtime, the
+ * loaded libraries and the wrapper's resources among them. Every service has
+ * it's own status, control handler and worker thread and is started and
+ * stopped independently by the SCM. The `install` and `uninstall` commands
+ * handle all services at once, other CLI commands refer to the first one.
+ * \param argc pass from your main
+ * \param argv pass from your main
+ * \param svcConfigs Configurations of your services, names must be unique
+ * \param svcCount Number of configurations
+ * \return application exit code
+ * \note Application activity reported by SvcTouch(), SvcWorkGuard and
+ * SvcLogMessage() is accounted to the service whose main callback runs the
+ * calling thread. Threads created by the application account to the first
+ * service, unless they are bound to theirs with SvcBindThread(). Output
+ * capturing is shared by all services, it's logged through the service that
+ * started capturing first.
+ * \sa SvcWrapperConfig, SvcCurrentService()
+ */
+int SvcWrapper(int argc, char* argv[], const SvcWrapperConfig* svcConfigs, size_t svcCount);
+
+//! \brief Opaque service handle, see SvcCurrentService()
+struct SvcService;
+using SvcHandle = SvcService*;
+
+/*!
+ * \brief Service of the calling thread
+ * \details Returns the service the calling thread works for. In a shared
+ * process, call it from your main callback and pass the handle to
+ * SvcBindThread() in the threads your application creates for the service.
+ * \return Service handle, nullptr if no service is hosted
+ */
+SvcHandle SvcCurrentService();
+
+/*!
+ * \brief Bind thread to service
+ * \details Makes the calling thread work for the given service, so
+ * SvcTouch(), SvcReady(), SvcWorkGuard, SvcWorkInFlight(), SvcLogMessage()
+ * and timers refer to it from now on. Threads that aren't bound work for the
+ * service whose main callback runs them, or the first service of the process.
+ * \note Only needed when hosting multiple services in one process.
+ * \param service Handle obtained from SvcCurrentService()
+ * \return true on success, false if the handle doesn't refer to a hosted
+ * service
+ */
+bool SvcBindThread(SvcHandle service);
+
+/*!
+ * \brief Report application activity
+ * \details Tells the wrapper that the application is busy, which resets the
+ * idle timer of the service. This only stores a timestamp to an atomic, so it
+ * is cheap enough to be called on every request your application handles.
+ * \note This function is thread safe and may be called at any time, it does
+ * nothing if the service isn't running.
+ * \sa SvcWrapperConfig::idleTimeout
+ */
+void SvcTouch();
+
+/*!
+ * \brief Report application readiness
+ * \details Tells the wrapper that the application has finished starting up,
+ * which reports the service running to the SCM. Only needed if
+ * SvcWrapperConfig::readyNotify is enabled, does nothing otherwise.
+ * \note This function is thread safe. Call it before the main callback
+ * returns, from the thread running it in case of a shared process.
+ * \sa SvcWrapperConfig::readyNotify
+ */
+void SvcReady();
+
+/*!
+ * \brief Log message
+ * \details Passes a message to svcLogCallback of the calling thread's
+ * service through the wrapper's log path, so it's subject to the log level
+ * as well as the rate limiting, deduplication and sampling settings. The
+ * code calling this function is the call site messages are rate limited by,
+ * so call it where messages originate rather than from a common log helper.
+ * \note This function is thread safe. Deciding whether to suppress a
+ * message is lock free and doesn't allocate.
+ * \param level Log level
+ * \param msg Message text
+ * \sa SvcWrapperConfig::logRateLimit
+ */
+void SvcLogMessage(SvcLogLevel level, const char* msg);
+
+// === SvcWrapper in-flight work ===============================================
+
+struct SvcWorkShard;
+
+/*!
+ * \brief In-flight work guard
+ * \details Counts a unit of work (e.g. a request) as in flight for as long as
+ * the guard exists, so stopping the service can wait for it to finish, see
+ * SvcWrapperConfig::drainTimeout. Create one at the start of each request
+ * and check admitted(): once the service is draining, new work is refused
+ * and should be rejected by the application. The counters are sharded by
+ * CPU core, so guards on different cores don't contend.
+ *
+ *   void handleRequest(Request& req)
+ *   {
+ *       SvcWorkGuard work;
+ *       if (!work)
+ *           return req.reject("Service unavailable");
+ *       ...
+ *   }
+ *
+ * \note Guards are thread safe and may be moved to and released by another
+ * thread. Work is accounted to the service of the creating thread, just as
+ * SvcTouch(). If the application isn't running as service, work is always
+ * admitted but not counted.
+ */
+class SvcWorkGuard
+{
+public:
+    SvcWorkGuard();
+    SvcWorkGuard(SvcWorkGuard&& other) noexcept;
+    SvcWorkGuard(const SvcWorkGuard&) = delete;
+    SvcWorkGuard& operator=(const SvcWorkGuard&) = delete;
+    ~SvcWorkGuard();
+
+    //! \brief Whether the work has been admitted
+    bool admitted() const { return m_admitted; }
+
+    //! \brief Same as admitted()
+    explicit operator bool() const { return m_admitted; }
+
+private:
+    SvcWorkShard* m_shard {nullptr};
+    bool m_admitted {true};
+};
+
+/*!
+ * \brief Work in flight
+ * \return Number of SvcWorkGuard objects of the current thread's service
+ */
+size_t SvcWorkInFlight();
+
+// === SvcWrapper thread registry ==============================================
+
+/*!
+ * \brief Register thread
+ * \details Registers the calling thread under a name and role, so it's CPU
+ * usage is sampled and shown by the control command `threads`. The name is
+ * also set as thread description, where supported (Windows 10 1607 and later),
+ * so debuggers and profilers show it as well. Registering an already registered
+ * thread renames it. The wrapper's own threads are registered with the role
+ * `wrapper`.
+ * \note The registry is process wide and limited to 256 threads. Threads that
+ * exit without unregistering are dropped by the next sample.
+ * \param name Thread name (max. 63 chars)
+ * \param role Thread role, e.g. "worker" or "io" (max. 31 chars, whitespace
+ * is replaced by underscores)
+ * \return true on success, false if the name is empty or the registry is full
+ */
+bool SvcRegisterThread(const char* name, const char* role = nullptr);
+
+/*!
+ * \brief Unregister thread
+ * \details Removes the calling thread from the thread registry.
+ */
+void SvcUnregisterThread();
+
+// === SvcWrapper timers =======================================================
+
+//! \brief Timer id, 0 is never a valid id
+using SvcTimerId = unsigned long long;
+
+//! \brief Timer job
+using SvcTimerJob = std::function<void()>;
+
+/*!
+ * \brief Timer statistics
+ * \details Runtime statistics of a timer job.
+ * \sa SvcQueryTimer()
+ */
+struct SvcTimerStats {
+    /*!
+     * \brief Number of histogram buckets
+     * \details Bucket `i` counts runs taking less than `2^i` microseconds,
+     * the last bucket counts all longer ones.
+     */
+    static constexpr size_t Buckets = 16;
+
+    //! \brief Number of runs
+    unsigned long long runs {0};
+
+    //! \brief Total runtime [us]
+    unsigned long long totalTime {0};
+
+    //! \brief Longest runtime [us]
+    unsigned long long maxTime {0};
+
+    //! \brief Number of runs by runtime
+    unsigned long long histogram[Buckets] {};
+};
+
+/*!
+ * \brief Start timer
+ * \details Schedules a job on the wrapper's timer thread, e.g. for cache
+ * expiry, flushing statistics or heartbeats. All jobs of the process share a
+ * single thread, so they should return quickly. Jobs run late by at most 10 ms
+ * plus the resolution of the system timer. Periodic jobs keep their schedule,
+ * runs missed due to a long running job are skipped. Timers are cancelled
+ * automatically when the service stops.
+ * \param name Job name, used by the `timers` control command
+ * \param interval Time [ms] until the job runs and between runs
+ * \param periodic Run repeatedly until cancelled, otherwise run once
+ * \param job Job to run
+ * \return Timer id, 0 if the service isn't running
+ * \note This function is thread safe, it may be called from a job too.
+ */
+SvcTimerId SvcStartTimer(const char* name, unsigned int interval, bool periodic,
+                         const SvcTimerJob& job);
+
+/*!
+ * \brief Cancel timer
+ * \details Cancels a timer started by SvcStartTimer(). If it's job is running
+ * meanwhile, it isn't run again but may not have returned yet.
+ * \param id Timer id
+ * \return true if the timer was scheduled
+ */
+bool SvcCancelTimer(SvcTimerId id);
+
+/*!
+ * \brief Query timer statistics
+ * \param id Timer id
+ * \param stats Filled with the runtime statistics of the timer's job
+ * \return true if the timer is scheduled
+ */
+bool SvcQueryTimer(SvcTimerId id, SvcTimerStats& stats);
+
+// === SvcWrapper control commands =============================================
+
+/*!
+ * \brief Control command handler
+ * \details Handles a command received through the service's control pipe.
+ * The first two arguments are the request payload and it's size. The response
+ * payload is written to the buffer passed as third argument, the last argument
+ * points to the buffer's capacity (64 KiB) and must be set to the size of the
+ * response. Return 0 on success, any other value reports failure to the client.
+ * \note Handlers are invoked from the wrapper's control thread, so they must
+ * be thread safe!
+ */
+using SvcControlHandler = std::function<int(const char*, size_t, char*, size_t*)>;
+
+/*!
+ * \brief Register control command
+ * \details Registers a handler for a command of the control pipe. Registering
+ * a handler for an existing command replaces it. The wrapper itself handles
+ * the commands `ping` (echoes payload), `stats` (service status as key=value
+ * lines), `timers` (timer jobs, see SvcStartTimer()), `threads` (registered threads
+ * and their CPU usage, see SvcRegisterThread()) and `loglevel`
+ * (payload: Critical, Warning, Info or Debug).
+ * \param name Command name (max. 255 chars)
+ * \param handler Command handler
+ * \return true on success, false if the name is invalid or there are too
+ * many commands registered.
+ * \sa SvcWrapperConfig::controlPipe
+ */
+bool SvcRegisterControlCommand(const char* name, const SvcControlHandler& handler);
+
 #endif // SVCWRAPPER_H
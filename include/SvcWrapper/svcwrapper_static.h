@@ -0,0 +1,272 @@
+/* Compile-time front end of the SvcWrapper library.
+ *
+ * SvcWrapperStatic() is an alternative to SvcWrapper() for services whose
+ * configuration is known at compile time. Settings are a constexpr
+ * SvcWrapperSettings object and callbacks are template arguments, so they are
+ * validated by static_assert and invoked without std::function. Optional
+ * subsystems are selected by feature policies, anything not selected isn't
+ * referenced and therefore not linked into the executable.
+ *
+ * Example:
+ *
+ *   static constexpr SvcWrapperSettings settings = [] {
+ *       SvcWrapperSettings s;
+ *       s.svcName = "EchoServer";
+ *       s.svcDisplayName = "Echo Server";
+ *       return s;
+ *   }();
+ *
+ *   int main(int argc, char* argv[])
+ *   {
+ *       return SvcWrapperStatic<settings, appMain, appStop, appLog,
+ *                               SvcFeatureCli>(argc, argv);
+ *   }
+ *
+ * Copyright (c) LASERVORM GmbH 2023
+ */
+#ifndef SVCWRAPPER_STATIC_H
+#define SVCWRAPPER_STATIC_H
+
+#include "SvcWrapper/svcwrapper.h"
+#include <cstddef>
+#include <type_traits>
+
+// === SvcWrapper feature policies =============================================
+
+//! \brief Command line interface (install, start, ctl, apply, ...)
+struct SvcFeatureCli {};
+
+//! \brief Child process mode, see SvcWrapperSettings::childExecutable
+struct SvcFeatureChild {};
+
+//! \brief Output capturing, see SvcWrapperSettings::captureOutput
+struct SvcFeatureCapture {};
+
+//! \brief Control pipe, see SvcWrapperSettings::controlPipe
+struct SvcFeatureControlPipe {};
+
+//! \brief Startup prewarming, see SvcWrapperSettings::prewarmPaths
+struct SvcFeaturePrewarm {};
+
+//! \brief Run history journal, see SvcWrapperSettings::historyFile
+struct SvcFeatureHistory {};
+
+// === SvcWrapper core interface ===============================================
+// Interface between the front ends and the core of the library, not meant to
+// be used directly.
+
+namespace SvcDetail {
+
+//! \brief Application callbacks as plain function pointers
+struct Callbacks {
+    int (*main)(void* context, int argc, char** argv) {nullptr};
+    void (*stop)(void* context) {nullptr};
+    void (*log)(void* context, SvcLogLevel level, const char* msg) {nullptr};
+    void* context {nullptr};
+};
+
+//! \brief Service to be hosted by the core
+struct Service {
+    const SvcWrapperSettings* settings {nullptr};
+    Callbacks callbacks;
+};
+
+//! \brief Command line interface subsystem
+struct CliFeature {
+    int (*run)(int argc, char* argv[], const SvcWrapperSettings& settings,
+               const char* const* hosted, size_t hostedCount);
+};
+
+//! \brief Child process subsystem
+struct ChildFeature {
+    int (*run)();
+    void (*stop)();
+    void (*kill)();
+};
+
+//! \brief Output capturing subsystem
+struct CaptureFeature {
+    bool (*start)();
+    void (*stop)();
+};
+
+//! \brief Control pipe subsystem
+struct ControlPipeFeature {
+    bool (*start)();
+    void (*stop)();
+};
+
+//! \brief Startup prewarming subsystem
+struct PrewarmFeature {
+    bool (*start)();
+    void (*stop)();
+};
+
+//! \brief Run history subsystem
+struct HistoryFeature {
+    bool (*start)();
+    void (*running)();
+    void (*stop)(unsigned long win32ExitCode);
+};
+
+// Subsystems, each defined in it's own translation unit
+extern const CliFeature Cli;
+extern const ChildFeature Child;
+extern const CaptureFeature Capture;
+extern const ControlPipeFeature ControlPipe;
+extern const PrewarmFeature Prewarm;
+extern const HistoryFeature History;
+
+//! \brief Subsystems available to the core, nullptr if not linked
+struct Features {
+    const CliFeature* cli {nullptr};
+    const ChildFeature* child {nullptr};
+    const CaptureFeature* capture {nullptr};
+    const ControlPipeFeature* controlPipe {nullptr};
+    const PrewarmFeature* prewarm {nullptr};
+    const HistoryFeature* history {nullptr};
+};
+
+/*!
+ * \brief Run services
+ * \details Core of SvcWrapper() and SvcWrapperStatic(), runs the CLI or the
+ * services with the given subsystems.
+ * \param argc pass from your main
+ * \param argv pass from your main
+ * \param services Services to host, names must be unique
+ * \param count Number of services
+ * \param features Available subsystems
+ * \return application exit code
+ */
+int Run(int argc, char* argv[], const Service* services, size_t count,
+        const Features& features);
+
+// Compile-time string length, 0 for nullptr
+constexpr size_t Length(const char* str)
+{
+    size_t len = 0;
+    while (str && str[len])
+        ++len;
+    return len;
+}
+
+// Check whether a policy is part of a policy list
+template <typename Feature, typename... Policies>
+constexpr bool Has = (std::is_same_v<Feature, Policies> || ...);
+
+// Callback trampolines, the target is known at compile time and inlined
+template <int (*Main)(int, char**)>
+int CallMain(void*, int argc, char** argv)
+{
+    return Main(argc, argv);
+}
+
+template <void (*Stop)()>
+void CallStop(void*)
+{
+    Stop();
+}
+
+template <void (*Log)(SvcLogLevel, const char*)>
+void CallLog(void*, SvcLogLevel level, const char* msg)
+{
+    Log(level, msg);
+}
+
+// Subsystems selected by policies, only these are referenced
+template <typename... Policies>
+Features MakeFeatures()
+{
+    Features features;
+    if constexpr (Has<SvcFeatureCli, Policies...>)
+        features.cli = &Cli;
+    if constexpr (Has<SvcFeatureChild, Policies...>)
+        features.child = &Child;
+    if constexpr (Has<SvcFeatureCapture, Policies...>)
+        features.capture = &Capture;
+    if constexpr (Has<SvcFeatureControlPipe, Policies...>)
+        features.controlPipe = &ControlPipe;
+    if constexpr (Has<SvcFeaturePrewarm, Policies...>)
+        features.prewarm = &Prewarm;
+    if constexpr (Has<SvcFeatureHistory, Policies...>)
+        features.history = &History;
+    return features;
+}
+
+} // namespace SvcDetail
+
+// === SvcWrapper compile-time front end =======================================
+
+/*!
+ * \brief SvcWrapper main function with compile-time configuration
+ * \details Does the same as SvcWrapper(), but takes the settings and
+ * callbacks as template arguments. The settings are checked at compile time,
+ * callbacks are called directly and only the subsystems selected by the
+ * feature policies (SvcFeatureCli, SvcFeatureChild, SvcFeatureCapture,
+ * SvcFeatureControlPipe, SvcFeaturePrewarm, SvcFeatureHistory) are linked.
+ * \tparam Settings constexpr service settings
+ * \tparam Main Application main callback, nullptr in child process mode
+ * \tparam Stop Application shutdown callback, nullptr in child process mode
+ * \tparam Log Log message callback, may be nullptr
+ * \tparam Policies Feature policies
+ * \param argc pass from your main
+ * \param argv pass from your main
+ * \return application exit code
+ * \sa SvcWrapperConfig for the meaning of the callbacks
+ */
+template <const SvcWrapperSettings& Settings,
+          int (*Main)(int, char**),
+          void (*Stop)(),
+          void (*Log)(SvcLogLevel, const char*) = nullptr,
+          typename... Policies>
+int SvcWrapperStatic(int argc, char* argv[])
+{
+    using namespace SvcDetail;
+
+    // Same checks as SvcWrapperVerifyConfig() does at runtime
+    static_assert(Length(Settings.svcName) > 0 && Length(Settings.svcName) <= 255,
+                  "svcName is mandatory and limited to 255 characters");
+    static_assert(Length(Settings.svcDisplayName) > 0 && Length(Settings.svcDisplayName) <= 255,
+                  "svcDisplayName is mandatory and limited to 255 characters");
+    static_assert(Length(Settings.svcDescription) <= 255,
+                  "svcDescription is limited to 255 characters");
+    static_assert(!Settings.svcTriggerPipe ||
+                      (Length(Settings.svcTriggerPipe) > 0 && Length(Settings.svcTriggerPipe) <= 256),
+                  "svcTriggerPipe must have 1 to 256 characters");
+
+    // Callbacks and the subsystems required by the settings
+    static_assert(Settings.childExecutable || (Main && Stop),
+                  "Main and Stop callbacks are mandatory unless running a child process");
+    static_assert(!Settings.childExecutable || Length(Settings.childExecutable) > 0,
+                  "childExecutable must not be empty");
+    static_assert(!Settings.childExecutable || Has<SvcFeatureChild, Policies...>,
+                  "childExecutable requires the SvcFeatureChild policy");
+    static_assert(!Settings.childExecutable || !Settings.drainTimeout,
+                  "drainTimeout is not available in child process mode");
+    static_assert(!Settings.captureOutput || Has<SvcFeatureCapture, Policies...>,
+                  "captureOutput requires the SvcFeatureCapture policy");
+    // The Log callback must not write to stdout or stderr, which can't be
+    // checked here, see SvcWrapperSettings::captureOutput
+    static_assert(!Settings.captureOutput || Log,
+                  "captureOutput requires a Log callback");
+    static_assert(!Settings.controlPipe || Has<SvcFeatureControlPipe, Policies...>,
+                  "controlPipe requires the SvcFeatureControlPipe policy");
+    static_assert((!Settings.prewarmPaths && !Settings.prewarmImages) ||
+                      Has<SvcFeaturePrewarm, Policies...>,
+                  "prewarmPaths and prewarmImages require the SvcFeaturePrewarm policy");
+    static_assert(!Settings.historyFile ||
+                      (Length(Settings.historyFile) > 0 && Has<SvcFeatureHistory, Policies...>),
+                  "historyFile must not be empty and requires the SvcFeatureHistory policy");
+
+    Service service;
+    service.settings = &Settings;
+    if constexpr (Main != nullptr)
+        service.callbacks.main = CallMain<Main>;
+    if constexpr (Stop != nullptr)
+        service.callbacks.stop = CallStop<Stop>;
+    if constexpr (Log != nullptr)
+        service.callbacks.log = CallLog<Log>;
+    return Run(argc, argv, &service, 1, MakeFeatures<Policies...>());
+}
+
+#endif // SVCWRAPPER_STATIC_H
@@ -0,0 +1,84 @@
+// Allocation checks of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcalloccheck.h"
+#include "svcwrapper_impl.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+// Nesting depth of allocation free scopes and allocations of this thread
+static thread_local int noAllocDepth {0};
+static thread_local unsigned int allocations {0};
+
+void* operator new(std::size_t size)
+{
+    if (noAllocDepth > 0)
+        ++allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+// Over-aligned types use separate overloads, which must be hooked as well
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    if (noAllocDepth > 0)
+        ++allocations;
+    void* p = _aligned_malloc(size ? size : 1, static_cast<std::size_t>(align));
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    _aligned_free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    _aligned_free(p);
+}
+
+SvcNoAllocScope::SvcNoAllocScope(const char* path)
+    : m_path(path), m_allocations(allocations)
+{
+    ++noAllocDepth;
+}
+
+SvcNoAllocScope::~SvcNoAllocScope()
+{
+    --noAllocDepth;
+    if (allocations == m_allocations)
+        return;
+    char msg[100];
+    snprintf(msg, sizeof(msg), "Allocation check failed: %u allocation(s) on %s path",
+             allocations - m_allocations, m_path);
+    SvcLog(Critical, msg);
+    assert(!"Allocation on allocation free path");
+}
+
+SvcAllowAllocScope::SvcAllowAllocScope()
+    : m_depth(noAllocDepth)
+{
+    noAllocDepth = 0;
+}
+
+SvcAllowAllocScope::~SvcAllowAllocScope()
+{
+    noAllocDepth = m_depth;
+}
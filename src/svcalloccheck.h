@@ -0,0 +1,76 @@
+// Allocation checks of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCALLOCCHECK_H
+#define SVCALLOCCHECK_H
+
+/* Allocation checks
+ *
+ * Stopping, interrogating and reporting the status of a service must work
+ * under memory pressure, so these paths must not allocate. Builds with the
+ * CMake option SVCWRAPPER_ALLOC_CHECK replace the global operator new by a
+ * counting one and fail an assertion (after logging a critical message) if
+ * the wrapper allocates within a SvcNoAllocScope. Application callbacks are
+ * invoked within a SvcAllowAllocScope, as they are free to allocate.
+ *
+ * Only operator new (including it's aligned overload) is hooked, array new
+ * forwards to it. The wrapper itself never calls malloc
+ * directly, and the C runtime's allocator can't be replaced portably.
+ * Without SVCWRAPPER_ALLOC_CHECK both scopes compile to nothing.
+ */
+
+#ifdef SVCWRAPPER_ALLOC_CHECK
+
+/*!
+ * \brief Allocation free scope
+ * \details Checks that the current thread doesn't allocate while the scope
+ * exists. Scopes may be nested.
+ */
+class SvcNoAllocScope
+{
+public:
+    /*!
+     * \brief Enter allocation free scope
+     * \param path Name of the checked path, used for reporting
+     */
+    explicit SvcNoAllocScope(const char* path);
+    ~SvcNoAllocScope();
+
+private:
+    const char* m_path;
+    unsigned int m_allocations;
+};
+
+/*!
+ * \brief Allocating scope
+ * \details Suspends all SvcNoAllocScope checks of the current thread while
+ * the scope exists.
+ */
+class SvcAllowAllocScope
+{
+public:
+    SvcAllowAllocScope();
+    ~SvcAllowAllocScope();
+
+private:
+    int m_depth;
+};
+
+#else // SVCWRAPPER_ALLOC_CHECK
+
+class SvcNoAllocScope
+{
+public:
+    explicit SvcNoAllocScope(const char*) {}
+    ~SvcNoAllocScope() {}
+};
+
+class SvcAllowAllocScope
+{
+public:
+    SvcAllowAllocScope() {}
+    ~SvcAllowAllocScope() {}
+};
+
+#endif // SVCWRAPPER_ALLOC_CHECK
+
+#endif // SVCALLOCCHECK_H
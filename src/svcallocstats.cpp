@@ -0,0 +1,211 @@
+// Allocation statistics of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "SvcWrapper/svcallocstats.h"
+#include "svcwrapper_impl.h"
+
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+using namespace std;
+
+/* Counting shims
+ *
+ * Every block is prefixed by a header holding it's size, so deallocations
+ * are accounted without asking the heap. Counters live in per thread blocks
+ * that are only written by their owning thread, a snapshot sums up all of
+ * them. Blocks of exited threads are handed over to new threads, so their
+ * counts keep adding to the totals.
+ */
+
+namespace {
+
+// Size of the block header, keeps the alignment guaranteed by malloc
+constexpr size_t HeaderSize = alignof(max_align_t) < 16 ? 16 : alignof(max_align_t);
+
+// Counters of one thread
+struct ThreadStats {
+    atomic<unsigned long long> allocations;
+    atomic<unsigned long long> deallocations;
+    atomic<unsigned long long> bytesAllocated;
+    atomic<unsigned long long> bytesFreed;
+    atomic<unsigned long long> sizeClasses[SvcAllocStats::SizeClasses];
+    atomic<bool> inUse;
+    ThreadStats* next;
+};
+
+// All counter blocks ever created, never shrinks
+atomic<ThreadStats*> threadList {nullptr};
+
+// Counter block of this thread
+thread_local ThreadStats* threadStats {nullptr};
+
+// Single writer increment, avoids the cost of an atomic read-modify-write
+inline void Add(atomic<unsigned long long>& counter, unsigned long long value)
+{
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+ULONGLONG StartTick()
+{
+    static const ULONGLONG startTick = GetTickCount64();
+    return startTick;
+}
+
+// Hand the counter block over to other threads once this one exits
+void WINAPI ReleaseThreadStats(PVOID block)
+{
+    if (block)
+        static_cast<ThreadStats*>(block)->inUse.store(false, memory_order_release);
+}
+
+DWORD FlsIndex()
+{
+    static const DWORD index = FlsAlloc(ReleaseThreadStats);
+    return index;
+}
+
+ThreadStats* AcquireThreadStats()
+{
+    // Reuse the block of an exited thread...
+    ThreadStats* block = threadList.load(memory_order_acquire);
+    for (; block; block = block->next) {
+        bool free = false;
+        if (block->inUse.compare_exchange_strong(free, true, memory_order_acquire))
+            break;
+    }
+
+    // ...or add a new one, not using operator new of course
+    if (!block) {
+        block = static_cast<ThreadStats*>(calloc(1, sizeof(ThreadStats)));
+        if (!block)
+            return nullptr;
+        block->inUse.store(true, memory_order_relaxed);
+        block->next = threadList.load(memory_order_relaxed);
+        while (!threadList.compare_exchange_weak(block->next, block, memory_order_release,
+                                                 memory_order_relaxed)) {}
+    }
+    StartTick();
+    FlsSetValue(FlsIndex(), block);
+    threadStats = block;
+    return block;
+}
+
+size_t SizeClass(size_t size)
+{
+    size_t sizeClass = 0;
+    for (size_t limit = 16; size > limit && sizeClass < SvcAllocStats::SizeClasses - 1; limit <<= 1)
+        ++sizeClass;
+    return sizeClass;
+}
+
+void CountAllocation(size_t size)
+{
+    ThreadStats* stats = threadStats ? threadStats : AcquireThreadStats();
+    if (!stats)
+        return;
+    Add(stats->allocations, 1);
+    Add(stats->bytesAllocated, size);
+    Add(stats->sizeClasses[SizeClass(size)], 1);
+}
+
+void CountDeallocation(size_t size)
+{
+    ThreadStats* stats = threadStats ? threadStats : AcquireThreadStats();
+    if (!stats)
+        return;
+    Add(stats->deallocations, 1);
+    Add(stats->bytesFreed, size);
+}
+
+// Allocate memory like operator new does, calling the new handler on failure
+void* Allocate(size_t size, size_t align)
+{
+    for (;;) {
+        void* p = align <= HeaderSize ? malloc(size + HeaderSize)
+                                      : _aligned_malloc(size + align, align);
+        if (p)
+            return p;
+        new_handler handler = get_new_handler();
+        if (!handler)
+            throw bad_alloc();
+        handler();
+    }
+}
+
+void* CountedNew(size_t size, size_t align)
+{
+    size_t header = align <= HeaderSize ? HeaderSize : align;
+    char* p = static_cast<char*>(Allocate(size, align));
+    *reinterpret_cast<size_t*>(p + header - sizeof(size_t)) = size;
+    CountAllocation(size);
+    return p + header;
+}
+
+void CountedDelete(void* ptr, size_t align)
+{
+    if (!ptr)
+        return;
+    size_t header = align <= HeaderSize ? HeaderSize : align;
+    char* p = static_cast<char*>(ptr) - header;
+    CountDeallocation(*reinterpret_cast<size_t*>(p + header - sizeof(size_t)));
+    if (align <= HeaderSize)
+        free(p);
+    else
+        _aligned_free(p);
+}
+
+} // namespace
+
+void* operator new(size_t size)
+{
+    return CountedNew(size, HeaderSize);
+}
+
+void* operator new(size_t size, align_val_t align)
+{
+    return CountedNew(size, static_cast<size_t>(align));
+}
+
+void operator delete(void* p) noexcept
+{
+    CountedDelete(p, HeaderSize);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    CountedDelete(p, HeaderSize);
+}
+
+void operator delete(void* p, align_val_t align) noexcept
+{
+    CountedDelete(p, static_cast<size_t>(align));
+}
+
+void operator delete(void* p, size_t, align_val_t align) noexcept
+{
+    CountedDelete(p, static_cast<size_t>(align));
+}
+
+void SvcAllocStatsSnapshot(SvcAllocStats& stats)
+{
+    stats = SvcAllocStats();
+    for (ThreadStats* block = threadList.load(memory_order_acquire); block; block = block->next) {
+        stats.allocations += block->allocations.load(memory_order_relaxed);
+        stats.deallocations += block->deallocations.load(memory_order_relaxed);
+        stats.bytesAllocated += block->bytesAllocated.load(memory_order_relaxed);
+        stats.bytesFreed += block->bytesFreed.load(memory_order_relaxed);
+        for (size_t i = 0; i < SvcAllocStats::SizeClasses; ++i)
+            stats.sizeClasses[i] += block->sizeClasses[i].load(memory_order_relaxed);
+    }
+    if (stats.bytesAllocated > stats.bytesFreed)
+        stats.liveBytes = stats.bytesAllocated - stats.bytesFreed;
+    stats.uptime = GetTickCount64() - StartTick();
+    if (stats.uptime) {
+        stats.allocationsPerSec = stats.allocations * 1000.0 / stats.uptime;
+        stats.bytesPerSec = stats.bytesAllocated * 1000.0 / stats.uptime;
+    }
+}
+
+// Let the wrapper report the statistics
+static const bool hookRegistered = (SvcAllocStatsHook = SvcAllocStatsSnapshot, true);
@@ -0,0 +1,60 @@
+// Fixed memory arena of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcarena.h"
+
+#include <windows.h>
+#include <atomic>
+
+using namespace std;
+
+alignas(64) static unsigned char arenaBuffer[SvcArena::Capacity];
+static atomic<size_t> arenaUsed {0};
+
+// Buffer in use, the static one unless a larger one has been reserved
+static unsigned char* arenaBase {arenaBuffer};
+static size_t arenaCapacity {SvcArena::Capacity};
+
+bool SvcArena::reserve(size_t size)
+{
+    if (size <= arenaCapacity)
+        return true;
+    if (arenaUsed.load(memory_order_relaxed) != 0)
+        return false;
+
+    // Committed right away, page aligned and zeroed like the static buffer
+    void* buffer = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buffer)
+        return false;
+    if (arenaBase != arenaBuffer)
+        VirtualFree(arenaBase, 0, MEM_RELEASE);
+    arenaBase = static_cast<unsigned char*>(buffer);
+    arenaCapacity = size;
+    return true;
+}
+
+void* SvcArena::allocate(size_t size, size_t align)
+{
+    size_t used = arenaUsed.load(memory_order_relaxed);
+    size_t offset;
+    do {
+        offset = (used + align - 1) & ~(align - 1);
+        if (offset > arenaCapacity || size > arenaCapacity - offset)
+            return nullptr;
+    } while (!arenaUsed.compare_exchange_weak(used, offset + size, memory_order_relaxed));
+    return arenaBase + offset;
+}
+
+void SvcArena::reset()
+{
+    arenaUsed.store(0, memory_order_relaxed);
+    if (arenaBase != arenaBuffer) {
+        VirtualFree(arenaBase, 0, MEM_RELEASE);
+        arenaBase = arenaBuffer;
+        arenaCapacity = Capacity;
+    }
+}
+
+size_t SvcArena::used()
+{
+    return arenaUsed.load(memory_order_relaxed);
+}
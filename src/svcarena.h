@@ -0,0 +1,57 @@
+// Fixed memory arena of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCARENA_H
+#define SVCARENA_H
+
+#include <cstddef>
+
+/*!
+ * \brief Fixed memory arena
+ * \details Hands out memory from a static buffer, so the wrapper's state is
+ * set up once at startup without touching the heap and stays valid for the
+ * lifetime of the process, even under memory pressure. Hosts needing more
+ * than the static buffer reserve a larger one at startup. Memory is released
+ * all at once by reset().
+ */
+class SvcArena
+{
+public:
+    //! \brief Capacity of the static buffer [bytes]
+    static constexpr size_t Capacity = 64 * 1024;
+
+    /*!
+     * \brief Reserve memory
+     * \details Makes sure the arena can hold the given number of bytes. If
+     * the static buffer is too small, a buffer of that size is allocated
+     * once. Must be called before anything is allocated from the arena and
+     * not concurrently with any other member.
+     * \param size Number of bytes, including alignment padding
+     * \return true on success, false if the memory couldn't be allocated
+     */
+    static bool reserve(size_t size);
+
+    /*!
+     * \brief Allocate memory
+     * \details Lock free, may be called from any thread.
+     * \param size Number of bytes
+     * \param align Alignment, must be a power of two
+     * \return Pointer to the memory, nullptr if the arena is exhausted
+     */
+    static void* allocate(size_t size, size_t align);
+
+    /*!
+     * \brief Release all memory
+     * \details Objects placed in the arena must have been destroyed before.
+     * A buffer allocated by reserve() is freed, the arena falls back to the
+     * static buffer.
+     */
+    static void reset();
+
+    /*!
+     * \brief Used memory
+     * \return Number of bytes allocated, including alignment padding
+     */
+    static size_t used();
+};
+
+#endif // SVCARENA_H
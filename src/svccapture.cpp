@@ -0,0 +1,116 @@
+// Output capturing of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svccapture.h"
+#include "svcwrapper_impl.h"
+#include "svcoutputpump.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <io.h>
+#include <mutex>
+
+using namespace std;
+
+// Size hint for the capture pipe's buffer
+static constexpr DWORD PipeBufferSize = 1024 * 1024;
+
+// Size of the ring buffer holding captured output not yet delivered
+static constexpr DWORD RingBufferSize = 4 * 1024 * 1024;
+
+// Pump forwarding the captured output
+static SvcOutputPump* capturePump {nullptr};
+
+// Services sharing the capture pipe and lock guarding it
+static int captureUsers {0};
+static mutex captureLock;
+
+// Standard handles to be restored when capturing stops
+static HANDLE origStdOut {INVALID_HANDLE_VALUE};
+static HANDLE origStdErr {INVALID_HANDLE_VALUE};
+
+bool SvcCaptureStart()
+{
+    // Standard streams are process wide, co-hosted services share them
+    lock_guard<mutex> lock(captureLock);
+    if (capturePump) {
+        ++captureUsers;
+        return true;
+    }
+
+    // Without log callback, output would be fed back to stderr. The same
+    // applies to a callback writing to stdout or stderr, which is documented.
+    if (!hSvc->callbacks.log) {
+        SvcLog(Warning, "Output capturing requires a log callback!");
+        return false;
+    }
+
+    HANDLE hRead, hWrite;
+    if (!CreatePipe(&hRead, &hWrite, NULL, PipeBufferSize)) {
+        SvcLog(Warning, "Failed to create output capture pipe!");
+        return false;
+    }
+    int fd = _open_osfhandle(reinterpret_cast<intptr_t>(hWrite), _O_BINARY | _O_WRONLY);
+    if (fd == -1) {
+        CloseHandle(hRead);
+        CloseHandle(hWrite);
+        SvcLog(Warning, "Failed to open output capture pipe!");
+        return false;
+    }
+
+    capturePump = new SvcOutputPump(hRead, INVALID_HANDLE_VALUE,
+                                    hSvc->cfg->captureLogLevel, RingBufferSize);
+    if (!capturePump->start()) {
+        // Thread (if any) exits once the pipe is closed
+        _close(fd);
+        delete capturePump;
+        capturePump = nullptr;
+        SvcLog(Warning, "Failed to start output capture thread!");
+        return false;
+    }
+
+    /* Redirect the C runtime streams
+     *
+     * Services have no console, so stdout and stderr aren't associated with
+     * valid file descriptors at all. Reopening them to NUL first gives them
+     * one we can replace by the pipe.
+     */
+    fflush(stdout);
+    fflush(stderr);
+    origStdOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    origStdErr = GetStdHandle(STD_ERROR_HANDLE);
+    freopen("NUL", "w", stdout);
+    freopen("NUL", "w", stderr);
+    _dup2(fd, _fileno(stdout));
+    _dup2(fd, _fileno(stderr));
+    _close(fd);
+    setvbuf(stderr, NULL, _IONBF, 0);
+
+    // Redirect the Windows standard handles
+    SetStdHandle(STD_OUTPUT_HANDLE, reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stdout))));
+    SetStdHandle(STD_ERROR_HANDLE, reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(stderr))));
+    SvcLog(Debug, "Capturing stdout and stderr");
+    captureUsers = 1;
+    return true;
+}
+
+void SvcCaptureStop()
+{
+    lock_guard<mutex> lock(captureLock);
+    if (!capturePump || --captureUsers > 0)
+        return;
+
+    // Detach streams from the pipe, which closes it's write end
+    fflush(stdout);
+    fflush(stderr);
+    SetStdHandle(STD_OUTPUT_HANDLE, origStdOut);
+    SetStdHandle(STD_ERROR_HANDLE, origStdErr);
+    freopen("NUL", "w", stdout);
+    freopen("NUL", "w", stderr);
+
+    // Wait for remaining output to be forwarded
+    capturePump->join();
+    delete capturePump;
+    capturePump = nullptr;
+}
+
+const SvcDetail::CaptureFeature SvcDetail::Capture {SvcCaptureStart, SvcCaptureStop};
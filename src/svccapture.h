@@ -0,0 +1,24 @@
+// Output capturing of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCCAPTURE_H
+#define SVCCAPTURE_H
+
+/*!
+ * \brief Start capturing output
+ * \details Redirects stdout and stderr of the process, both the C runtime's
+ * file descriptors and the Windows standard handles, into a pipe that is
+ * forwarded line by line to the wrapper's log. Services sharing a process
+ * share the capture, output is logged by the service starting it first.
+ * \return true on success, false if output couldn't be redirected
+ */
+bool SvcCaptureStart();
+
+/*!
+ * \brief Stop capturing output
+ * \details Once the last service sharing the capture stops it, flushes the
+ * standard streams, detaches them from the capture pipe and waits until all
+ * captured output has been forwarded.
+ */
+void SvcCaptureStop();
+
+#endif // SVCCAPTURE_H
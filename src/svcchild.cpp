@@ -0,0 +1,166 @@
+// Child process mode of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcchild.h"
+#include "svcwrapper_impl.h"
+#include "svcoutputpump.h"
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Size hint for the output pipe's buffer, large enough to let the child write
+// bursts of output without blocking on our pump thread
+static constexpr DWORD PipeBufferSize = 1024 * 1024;
+
+// Send Ctrl+Break to the child, childLock must be held
+static void SvcChildSignal(DWORD pid)
+{
+    // A process has only one console, co-hosted services take turns
+    static mutex consoleLock;
+    lock_guard<mutex> consoleGuard(consoleLock);
+
+    // Attach to the child's console to send Ctrl+Break to it's process group
+    if (!AttachConsole(pid)) {
+        SvcLog(Warning, "Failed to attach to child console, "
+                        "child will be killed after shutdown timeout!");
+        return;
+    }
+    if (!GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, pid))
+        SvcLog(Warning, "Failed to send Ctrl+Break to child process!");
+    FreeConsole();
+}
+
+int SvcChildRun()
+{
+    const SvcWrapperSettings* cfg = hSvc->cfg;
+    char msg[80];
+
+    // Create inheritable pipe for the child's output
+    SECURITY_ATTRIBUTES sa;
+    sa.nLength = sizeof(sa);
+    sa.lpSecurityDescriptor = NULL;
+    sa.bInheritHandle = TRUE;
+    HANDLE hRead, hWrite;
+    if (!CreatePipe(&hRead, &hWrite, &sa, PipeBufferSize)) {
+        snprintf(msg, sizeof(msg), "Failed to create output pipe: %lu", GetLastError());
+        SvcLog(Critical, msg);
+        return SVCWRAPPER_EXITCODE_CHILD_START_FAILED;
+    }
+    SetHandleInformation(hRead, HANDLE_FLAG_INHERIT, 0);
+
+    // Open output file, if configured
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    if (cfg->childLogFile) {
+        hFile = CreateFile(cfg->childLogFile, FILE_APPEND_DATA, FILE_SHARE_READ,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) {
+            SvcLog(Warning, "Failed to open child output file, "
+                            "forwarding output to log instead!");
+        }
+    }
+    auto pump = make_unique<SvcOutputPump>(hRead, hFile, cfg->childLogLevel);
+
+    /* Inherit nothing but the write end
+     *
+     * Other inheritable handles of the process, like the output pipes of
+     * co-hosted services' children, would be inherited as well. Those pipes
+     * wouldn't break once their own child exited then.
+     */
+    SIZE_T attributesSize = 0;
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attributesSize);
+    vector<char> attributesBuffer(attributesSize);
+    LPPROC_THREAD_ATTRIBUTE_LIST attributes =
+        reinterpret_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(attributesBuffer.data());
+    if (!InitializeProcThreadAttributeList(attributes, 1, 0, &attributesSize)) {
+        snprintf(msg, sizeof(msg), "Failed to create child attributes: %lu", GetLastError());
+        SvcLog(Critical, msg);
+        CloseHandle(hWrite);
+        return SVCWRAPPER_EXITCODE_CHILD_START_FAILED;
+    }
+    BOOL started = UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+                                             &hWrite, sizeof(hWrite), NULL, NULL);
+
+    // Spawn child in it's own process group, so we can signal it separately
+    string cmdLine = string("\"") + cfg->childExecutable + "\"";
+    if (cfg->childArgs != nullptr && strlen(cfg->childArgs))
+        cmdLine.append(" ").append(cfg->childArgs);
+    STARTUPINFOEX si;
+    ZeroMemory(&si, sizeof(si));
+    si.StartupInfo.cb = sizeof(si);
+    si.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+    si.StartupInfo.hStdInput = NULL;
+    si.StartupInfo.hStdOutput = hWrite;
+    si.StartupInfo.hStdError = hWrite;
+    si.lpAttributeList = attributes;
+    PROCESS_INFORMATION pi;
+    if (started) {
+        started = CreateProcess(cfg->childExecutable, &cmdLine[0], NULL, NULL, TRUE,
+                                CREATE_NEW_PROCESS_GROUP | CREATE_NO_WINDOW |
+                                EXTENDED_STARTUPINFO_PRESENT,
+                                NULL, NULL, &si.StartupInfo, &pi);
+    }
+    DWORD error = GetLastError();
+    DeleteProcThreadAttributeList(attributes);
+    // Close our write end, so the pipe breaks once the child has exited
+    CloseHandle(hWrite);
+    if (!started) {
+        snprintf(msg, sizeof(msg), "Failed to start child process: %lu", error);
+        SvcLog(Critical, msg);
+        return SVCWRAPPER_EXITCODE_CHILD_START_FAILED;
+    }
+    CloseHandle(pi.hThread);
+    snprintf(msg, sizeof(msg), "Started child process %lu", pi.dwProcessId);
+    SvcLog(Info, msg);
+    {
+        // The service may have been stopped while spawning the child
+        lock_guard<mutex> lock(hSvc->childLock);
+        hSvc->childProcess = pi.hProcess;
+        hSvc->childPid = pi.dwProcessId;
+        if (hSvc->childStopPending) {
+            SvcLog(Debug, "Signaling child process to stop, stop was requested while spawning");
+            SvcChildSignal(pi.dwProcessId);
+        }
+    }
+    if (!pump->start())
+        SvcLog(Warning, "Failed to start output pump thread!");
+
+    // Wait for child to exit and collect remaining output
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    DWORD exitCode = 0;
+    GetExitCodeProcess(pi.hProcess, &exitCode);
+    pump->join();
+    {
+        lock_guard<mutex> lock(hSvc->childLock);
+        CloseHandle(hSvc->childProcess);
+        hSvc->childProcess = NULL;
+        hSvc->childPid = 0;
+    }
+    snprintf(msg, sizeof(msg), "Child process exited with code %lu", exitCode);
+    SvcLog(exitCode ? Warning : Info, msg);
+    return static_cast<int>(exitCode);
+}
+
+void SvcChildStop()
+{
+    lock_guard<mutex> lock(hSvc->childLock);
+    if (!hSvc->childPid) {
+        // Not spawned yet, SvcChildRun() signals it right after spawning
+        hSvc->childStopPending = true;
+        return;
+    }
+    SvcChildSignal(hSvc->childPid);
+}
+
+void SvcChildKill()
+{
+    lock_guard<mutex> lock(hSvc->childLock);
+    if (!hSvc->childProcess)
+        return;
+    SvcLog(Warning, "Child process didn't stop in time, killing it!");
+    TerminateProcess(hSvc->childProcess, ERROR_PROCESS_ABORTED);
+}
+
+const SvcDetail::ChildFeature SvcDetail::Child {SvcChildRun, SvcChildStop, SvcChildKill};
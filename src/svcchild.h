@@ -0,0 +1,35 @@
+// Child process mode of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCCHILD_H
+#define SVCCHILD_H
+
+#include <windows.h>
+
+// Time [ms] to wait for the worker thread after killing the child process
+constexpr DWORD SvcChildKillTimeout = 5000;
+
+/*!
+ * \brief Run child process
+ * \details Spawns the configured child executable with its stdout and stderr
+ * redirected to an output pump and blocks until the child has exited.
+ * \return Exit code of the child process, or
+ * SVCWRAPPER_EXITCODE_CHILD_START_FAILED if it couldn't be started.
+ */
+int SvcChildRun();
+
+/*!
+ * \brief Request child process to stop
+ * \details Sends a Ctrl+Break event to the console of the child process and
+ * returns immediately. If the child hasn't been spawned yet, the event is
+ * sent right after spawning it.
+ */
+void SvcChildStop();
+
+/*!
+ * \brief Kill child process
+ * \details Terminates the child process the hard way. Used when it didn't
+ * stop within the configured shutdown timeout.
+ */
+void SvcChildKill();
+
+#endif // SVCCHILD_H
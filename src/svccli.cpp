@@ -2,21 +2,58 @@
 // Copyright (c) LASERVORM GmbH 2023
 #include "svccli.h"
 #include "SvcWrapper/svcwrapper.h"
+#include "SvcWrapper/svcwrapper_static.h"
+#include "svcipc.h"
+#include "svcscm.h"
+#include "svcmanifest.h"
+#include "svchistory.h"
 
 #include <windows.h>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <string>
 #include <iostream>
 #include <filesystem>
+#include <mutex>
+#include <thread>
 
 #define ECODE_OK SVCWRAPPER_EXITCODE_OK
 #define ECODE_SYNTAX SVCWRAPPER_EXITCODE_CLI_SYNTAX_ERROR
 #define ECODE_SCM SVCWRAPPER_EXITCODE_CLI_SCM_ERROR
+#define ECODE_CONTROL SVCWRAPPER_EXITCODE_CLI_CONTROL_ERROR
+#define ECODE_HISTORY SVCWRAPPER_EXITCODE_CLI_HISTORY_ERROR
 
 using std::cout, std::cerr, std::endl;
 
-SvcCli::SvcCli(int argc, char *argv[], const SvcWrapperConfig& svcConfig)
-    : m_argc(argc), m_svcCfg(svcConfig)
+// Escape string for JSON output
+static std::string JsonEscape(const std::string& str)
+{
+    std::string out;
+    out.reserve(str.size());
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            out.push_back('\\');
+        if (static_cast<unsigned char>(c) >= 0x20)
+            out.push_back(c);
+    }
+    return out;
+}
+
+// Entry point of the CLI subsystem
+static int SvcCliRun(int argc, char* argv[], const SvcWrapperSettings& settings,
+                     const char* const* hosted, size_t hostedCount)
+{
+    SvcCli p(argc, argv, settings, std::vector<std::string>(hosted, hosted + hostedCount));
+    return p.run();
+}
+
+const SvcDetail::CliFeature SvcDetail::Cli {SvcCliRun};
+
+SvcCli::SvcCli(int argc, char *argv[], const SvcWrapperSettings& svcConfig,
+               const std::vector<std::string>& hostedServices)
+    : m_argc(argc), m_svcCfg(svcConfig), m_hostedServices(hostedServices)
 {
     // Convert char*'s to strings
     m_argv.resize(m_argc);
@@ -64,6 +101,17 @@ int SvcCli::run()
         return install();
     } else if (m_argv[1] == "uninstall") {
         return uninstall();
+    } else if (m_argv[1] == "ctl") {
+        return control();
+    } else if (m_argv[1] == "status" || m_argv[1] == "start" ||
+               m_argv[1] == "stop" || m_argv[1] == "restart") {
+        return controlServices(m_argv[1]);
+    } else if (m_argv[1] == "apply") {
+        return apply();
+    } else if (m_argv[1] == "history") {
+        return history();
+    } else if (m_argv[1] == "threads") {
+        return threads();
     }
 
     cerr << "Unknown command!" << endl;
@@ -78,6 +126,14 @@ int SvcCli::help() const
          << "  help         Displays this message.\n"
          << "  install      Installs the " << m_svcName << " service. (Needs admin privileges!)\n"
          << "  uninstall    Uninstalls the " << m_svcName << " service. (Needs admin privileges!)\n"
+         << "  status       Shows the state of the " << m_svcName << " service.\n"
+         << "  start        Starts the " << m_svcName << " service.\n"
+         << "  stop         Stops the " << m_svcName << " service.\n"
+         << "  restart      Restarts the " << m_svcName << " service.\n"
+         << "  apply        Installs, updates or removes services listed in a manifest.\n"
+         << "  ctl          Sends a command to the running " << m_svcName << " service.\n"
+         << "  history      Shows recent runs of the " << m_svcName << " service.\n"
+         << "  threads      Shows the busiest threads of the running " << m_svcName << " service.\n"
          << endl;
     return ECODE_OK;
 }
@@ -93,7 +149,7 @@ int SvcCli::install()
 
     // Determine start user and password
     switch (m_svcCfg.svcUserType) {
-    case SvcWrapperConfig::UserTypeCustom: {
+    case SvcWrapperSettings::UserTypeCustom: {
         // Parse auth options
         bool hasError = (m_argc < 4 || m_argv[2] != "-u");
         if (!hasError) {
@@ -130,20 +186,20 @@ int SvcCli::install()
         }
         break;
     }
-    case SvcWrapperConfig::UserTypeLocalService:
+    case SvcWrapperSettings::UserTypeLocalService:
         svcUser = R"(NT AUTHORITY\LocalService)";
         svcUserPtr = svcUser.c_str();
         break;
-    case SvcWrapperConfig::UserTypeLocalNetwork:
+    case SvcWrapperSettings::UserTypeLocalNetwork:
         svcUser = R"(NT AUTHORITY\NetworkService)";
         svcUserPtr = svcUser.c_str();
-    case SvcWrapperConfig::UserTypeSystem: [[fallthrough]];
+    case SvcWrapperSettings::UserTypeSystem: [[fallthrough]];
     default:
         break;
     }
 
     // Verify syntax for other user types
-    if (m_svcCfg.svcUserType != SvcWrapperConfig::UserTypeCustom && m_argc > 2) {
+    if (m_svcCfg.svcUserType != SvcWrapperSettings::UserTypeCustom && m_argc > 2) {
         cout << "Usage: " << m_binaryName << " install" << endl;
         return ECODE_SYNTAX;
     }
@@ -151,7 +207,7 @@ int SvcCli::install()
     cout << "Installing " << m_svcName << " service..." << endl;
 
     // Check CLI params
-    if (m_svcCfg.svcUserType == SvcWrapperConfig::UserTypeCustom) {
+    if (m_svcCfg.svcUserType == SvcWrapperSettings::UserTypeCustom) {
         // Parse custom user args
     } else {
 
@@ -178,19 +234,23 @@ int SvcCli::install()
     }
 
     // Install service
+    std::string deps;
+    if (m_svcCfg.svcDependencies != nullptr)
+        deps = SvcDependencyList(SvcParseDependencies(m_svcCfg.svcDependencies));
     if (code == ECODE_OK) {
         hSvc = CreateService(
                 m_hSCM, // ServiceManager database
                 m_svcCfg.svcName, // Service internal name
                 m_svcCfg.svcDisplayName, // Service display name
                 GENERIC_WRITE, // Service access rights [1]
-                SERVICE_WIN32_OWN_PROCESS, // Service runs in own process
+                m_hostedServices.size() > 1 ? SERVICE_WIN32_SHARE_PROCESS // Service shares process
+                                : SERVICE_WIN32_OWN_PROCESS, // Service runs in own process
                 convertStartType(m_svcCfg.svcStartType), // Service start type
                 SERVICE_ERROR_NORMAL, // Service error handling
                 binPath.c_str(), // Service binary path
                 NULL, // Service does not belong to a group
                 NULL, // No tar var pointer, as we don't belong to a group
-                NULL, // No dependencies
+                deps.empty() ? NULL : deps.c_str(), // Dependencies
                 svcUserPtr, // Service username
                 svcPassPtr); // Service password
         /*
@@ -214,6 +274,32 @@ int SvcCli::install()
         }
     }
 
+    // Register start trigger on named pipe access
+    if (code == ECODE_OK && hSvc != NULL && m_svcCfg.svcTriggerPipe != nullptr) {
+        // NAMED_PIPE_EVENT_GUID {1F81D131-3FAC-4537-9E0C-7E7B0C2F4B55}
+        GUID pipeEvent = {0x1f81d131, 0x3fac, 0x4537,
+                          {0x9e, 0x0c, 0x7e, 0x7b, 0x0c, 0x2f, 0x4b, 0x55}};
+        SERVICE_TRIGGER_SPECIFIC_DATA_ITEM pipeName;
+        pipeName.dwDataType = SERVICE_TRIGGER_DATA_TYPE_STRING;
+        pipeName.cbData = static_cast<DWORD>(strlen(m_svcCfg.svcTriggerPipe) + 1);
+        pipeName.pData = reinterpret_cast<BYTE*>(
+                    const_cast<char*>(m_svcCfg.svcTriggerPipe));
+        SERVICE_TRIGGER trigger;
+        trigger.dwTriggerType = SERVICE_TRIGGER_TYPE_NETWORK_ENDPOINT;
+        trigger.dwAction = SERVICE_TRIGGER_ACTION_SERVICE_START;
+        trigger.pTriggerSubtype = &pipeEvent;
+        trigger.cDataItems = 1;
+        trigger.pDataItems = &pipeName;
+        SERVICE_TRIGGER_INFO triggerInfo;
+        triggerInfo.cTriggers = 1;
+        triggerInfo.pTriggers = &trigger;
+        triggerInfo.pReserved = NULL;
+        if (ChangeServiceConfig2(hSvc, SERVICE_CONFIG_TRIGGER_INFO, &triggerInfo) == FALSE) {
+            cout << "WARNING: Failed to register start trigger for pipe "
+                 << m_svcCfg.svcTriggerPipe << ": " << GetLastError() << endl;
+        }
+    }
+
     // Clean up
     if (hSvc != NULL) {
         CloseServiceHandle(hSvc);
@@ -282,6 +368,672 @@ int SvcCli::uninstall()
     return code;
 }
 
+int SvcCli::control()
+{
+    // Parse args
+    unsigned long count = 0;
+    bool hasPayload = false;
+    std::string payload;
+    bool hasError = (m_argc < 3);
+    for (int i = 3; i < m_argc && !hasError; ++i) {
+        if (m_argv[i] == "-n" && i + 1 < m_argc) {
+            count = strtoul(m_argv[++i].c_str(), nullptr, 10);
+            hasError = (count == 0);
+        } else if (!hasPayload) {
+            payload = m_argv[i];
+            hasPayload = true;
+        } else {
+            hasError = true;
+        }
+    }
+    if (hasError) {
+        cout << "Usage: " << m_binaryName << " ctl command [payload] [-n count]\n\n"
+             << "  command    Control command, builtin commands are:\n"
+                "               ping      Echoes the payload\n"
+                "               stats     Prints service status\n"
+                "               threads   Prints registered threads and their CPU usage\n"
+                "               loglevel  Sets log level (Critical, Warning, Info, Debug)\n"
+             << "  payload    Command payload (optional)\n"
+             << "  -n count   Send command count times and print round trip latencies\n"
+             << endl;
+        return ECODE_SYNTAX;
+    }
+    const std::string& command = m_argv[2];
+
+    // Connect to service
+    SvcIpcClient client;
+    if (!client.connect(SvcIpcPipeName(m_svcName.c_str()), 2000)) {
+        cerr << "Failed to connect to control pipe of service " << m_svcName
+             << "! Is it running with control pipe enabled? (Error code: "
+             << GetLastError() << ")" << endl;
+        return ECODE_CONTROL;
+    }
+
+    uint32_t id;
+    SvcIpcStatus status = SvcIpcOk;
+    std::string response;
+    auto failed = [&]() {
+        cerr << "Control pipe connection broken!" << endl;
+        return ECODE_CONTROL;
+    };
+
+    // Single command
+    if (!count) {
+        client.queue(command.c_str(), payload.data(), payload.size());
+        if (!client.flush() || !client.receive(&id, &status, &response))
+            return failed();
+        switch (status) {
+        case SvcIpcOk:
+            cout << response;
+            if (!response.empty() && response.back() != '\n')
+                cout << endl;
+            return ECODE_OK;
+        case SvcIpcUnknownCommand:
+            cerr << "Unknown command " << command << "!" << endl;
+            break;
+        case SvcIpcFailed:
+            cerr << "Command " << command << " failed: " << response << endl;
+            break;
+        default:
+            cerr << "Service rejected the request!" << endl;
+            break;
+        }
+        return ECODE_CONTROL;
+    }
+
+    // Measure sequential round trips
+    using Clock = std::chrono::steady_clock;
+    std::vector<double> rtt;
+    rtt.reserve(count);
+    for (unsigned long i = 0; i < count; ++i) {
+        Clock::time_point t0 = Clock::now();
+        client.queue(command.c_str(), payload.data(), payload.size());
+        if (!client.flush() || !client.receive(&id, &status, &response))
+            return failed();
+        rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+    }
+    std::sort(rtt.begin(), rtt.end());
+    cout << count << " sequential requests: p50 " << rtt[rtt.size() / 2]
+         << " us, p99 " << rtt[static_cast<size_t>((rtt.size() - 1) * 0.99)]
+         << " us, max " << rtt.back() << " us" << endl;
+
+    // Measure pipelined requests, sending batches of up to 32 KiB
+    Clock::time_point t0 = Clock::now();
+    unsigned long sent = 0;
+    while (sent < count) {
+        unsigned long batch = 0;
+        while (sent + batch < count && client.queued() < 32 * 1024) {
+            client.queue(command.c_str(), payload.data(), payload.size());
+            ++batch;
+        }
+        if (!client.flush())
+            return failed();
+        for (unsigned long i = 0; i < batch; ++i) {
+            if (!client.receive(&id, &status, &response))
+                return failed();
+        }
+        sent += batch;
+    }
+    double total = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+    cout << count << " pipelined requests: " << total << " us total, "
+         << total / count << " us per request" << endl;
+    return status == SvcIpcOk ? ECODE_OK : ECODE_CONTROL;
+}
+
+int SvcCli::controlServices(const std::string& command)
+{
+    // Parse args
+    bool wait = false;
+    DWORD timeout = 30000;
+    std::vector<std::string> patterns;
+    bool hasError = false;
+    for (int i = 2; i < m_argc && !hasError; ++i) {
+        if (m_argv[i] == "--wait") {
+            wait = true;
+        } else if (m_argv[i] == "--timeout" && i + 1 < m_argc) {
+            timeout = strtoul(m_argv[++i].c_str(), nullptr, 10);
+            hasError = (timeout == 0);
+        } else if (m_argv[i].rfind("--", 0) == 0) {
+            hasError = true;
+        } else {
+            patterns.push_back(m_argv[i]);
+        }
+    }
+    if (hasError) {
+        cout << "Usage: " << m_binaryName << " " << command
+             << " [service ...] [--wait] [--timeout ms]\n\n"
+             << "  service       Service name or wildcard pattern (e.g. \"MyApp*\"),\n"
+                "                defaults to the services of this executable. Multiple\n"
+                "                services are processed concurrently.\n"
+             << "  --wait        Wait for the services to reach their target state.\n"
+                "                Services depending on each other are processed in\n"
+                "                waves, in dependency order.\n"
+             << "  --timeout ms  Maximum time to wait, default is 30000 ms.\n"
+             << endl;
+        return ECODE_SYNTAX;
+    }
+    if (patterns.empty() && m_hostedServices.empty())
+        patterns.push_back(m_svcName);
+    else if (patterns.empty())
+        patterns = m_hostedServices;
+
+    // Open SCM
+    int code = initSCM(ScmAccessQuery);
+    if (code != ECODE_OK)
+        return code;
+
+    // Resolve patterns
+    std::vector<ControlJob> jobs;
+    for (const std::string& pattern : patterns) {
+        std::vector<std::string> names;
+        if (!SvcIsWildcard(pattern)) {
+            names.push_back(pattern);
+        } else if (!SvcEnumServices(m_hSCM, pattern, names)) {
+            cerr << "Failed to enumerate services: " << GetLastError() << endl;
+            return ECODE_SCM;
+        } else if (names.empty()) {
+            cerr << "WARNING: No service matches " << pattern << endl;
+        }
+        for (const std::string& name : names) {
+            auto known = std::find_if(jobs.begin(), jobs.end(),
+                                      [&](const ControlJob& j) { return j.name == name; });
+            if (known == jobs.end())
+                jobs.emplace_back().name = name;
+        }
+    }
+    if (jobs.empty()) {
+        cerr << "No services to " << command << "!" << endl;
+        return ECODE_SCM;
+    }
+
+    // Order services by dependencies when waiting for them, so they start
+    // once their dependencies are running and stop before them
+    size_t waveCount = 1;
+    if (wait && command != "status" && jobs.size() > 1) {
+        std::vector<std::string> names;
+        std::vector<std::vector<std::string>> dependencies(jobs.size());
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            names.push_back(jobs[i].name);
+            SvcQueryDependencies(m_hSCM, jobs[i].name, dependencies[i]);
+            for (size_t j = 0; j < jobs.size(); ++j) {
+                for (const std::string& dep : dependencies[i]) {
+                    if (j != i && SvcEqualsNoCase(jobs[j].name, dep))
+                        jobs[i].dependsOn.push_back(j);
+                }
+            }
+        }
+        std::vector<size_t> waves;
+        if (!SvcDependencyWaves(names, dependencies, waves)) {
+            cerr << "Services have cyclic dependencies!" << endl;
+            return ECODE_SCM;
+        }
+        waveCount = *std::max_element(waves.begin(), waves.end()) + 1;
+        for (size_t i = 0; i < jobs.size(); ++i)
+            jobs[i].wave = waves[i];
+    }
+
+    // Stopping goes against dependency order, so ordered restarts stop all
+    // services first and start them again afterwards
+    struct Phase {
+        std::string command;
+        bool reverse;
+    };
+    std::vector<Phase> phases;
+    if (waveCount > 1 && command == "restart")
+        phases = {{"stop", true}, {"start", false}};
+    else
+        phases = {{command, command == "stop"}};
+
+    // Execute jobs wave by wave, jobs of a wave concurrently, printing
+    // results as they come in
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+    std::mutex outputLock;
+    for (size_t p = 0; p < phases.size(); ++p) {
+        const Phase& phase = phases[p];
+        bool lastPhase = (p + 1 == phases.size());
+        for (size_t wave = 0; wave < waveCount; ++wave) {
+            Clock::time_point waveStart = Clock::now();
+            std::vector<std::thread> threads;
+            for (ControlJob& job : jobs) {
+                if ((phase.reverse ? waveCount - 1 - job.wave : job.wave) != wave ||
+                        (p > 0 && !job.ok))
+                    continue;
+                // Don't start services whose dependencies failed to start
+                auto failedDep = std::find_if(job.dependsOn.begin(), job.dependsOn.end(),
+                                              [&](size_t d) { return !jobs[d].ok; });
+                bool skip = phase.command != "stop" && failedDep != job.dependsOn.end();
+                if (skip) {
+                    job.ok = false;
+                    job.error = "Dependency " + jobs[*failedDep].name + " failed";
+                }
+                threads.emplace_back([&, skip, lastPhase, this]() {
+                    DWORD fromState = job.fromState;
+                    double ms = job.ms;
+                    if (!skip)
+                        runControlJob(job, phase.command, wait, timeout);
+                    if (p > 0) {
+                        job.fromState = fromState;
+                        job.ms += ms;
+                    }
+                    if (!lastPhase && job.ok)
+                        return;
+                    std::lock_guard<std::mutex> lock(outputLock);
+                    cout << job.name << ": " << SvcStateName(job.fromState);
+                    if (command != "status") {
+                        cout << " -> " << SvcStateName(job.toState)
+                             << " (" << static_cast<unsigned long>(job.ms) << " ms)";
+                    }
+                    if (!job.ok)
+                        cout << " FAILED: " << job.error;
+                    cout << endl;
+                });
+            }
+            for (std::thread& t : threads)
+                t.join();
+            if (waveCount > 1) {
+                double waveMs = std::chrono::duration<double, std::milli>(Clock::now() - waveStart).count();
+                cout << "Wave " << wave + 1 << "/" << waveCount << " " << phase.command
+                     << " done (" << threads.size() << " services, "
+                     << static_cast<unsigned long>(waveMs) << " ms)" << endl;
+            }
+        }
+    }
+    double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    // Machine readable summary
+    size_t failed = 0;
+    cout << "{\"command\":\"" << command << "\",\"total_ms\":"
+         << static_cast<unsigned long>(totalMs) << ",\"waves\":" << waveCount
+         << ",\"services\":[";
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const ControlJob& job = jobs[i];
+        failed += job.ok ? 0 : 1;
+        cout << (i ? "," : "")
+             << "{\"name\":\"" << JsonEscape(job.name) << "\""
+             << ",\"from\":\"" << SvcStateName(job.fromState) << "\""
+             << ",\"to\":\"" << SvcStateName(job.toState) << "\""
+             << ",\"wave\":" << job.wave
+             << ",\"ms\":" << static_cast<unsigned long>(job.ms)
+             << ",\"ok\":" << (job.ok ? "true" : "false")
+             << ",\"error\":\"" << JsonEscape(job.error) << "\"}";
+    }
+    cout << "],\"failed\":" << failed << "}" << endl;
+    return failed ? ECODE_SCM : ECODE_OK;
+}
+
+int SvcCli::apply()
+{
+    // Parse args
+    bool dryRun = (m_argc == 4 && m_argv[3] == "--dry-run");
+    if (m_argc < 3 || (m_argc > 3 && !dryRun)) {
+        cout << "Usage: " << m_binaryName << " apply manifest [--dry-run]\n\n"
+             << "  manifest    Manifest file listing the desired services\n"
+             << "  --dry-run   Only print the operations needed\n"
+             << endl;
+        return ECODE_SYNTAX;
+    }
+
+    // Defaults are this executable's service configuration
+    SvcManifestEntry defaults;
+    defaults.binary = m_binaryPath;
+    defaults.args = m_svcCfg.svcArgs ? m_svcCfg.svcArgs : "";
+    defaults.description = m_svcCfg.svcDescription ? m_svcCfg.svcDescription : "";
+    defaults.startType = convertStartType(m_svcCfg.svcStartType);
+    if (m_svcCfg.svcDependencies != nullptr)
+        defaults.dependencies = SvcParseDependencies(m_svcCfg.svcDependencies);
+    switch (m_svcCfg.svcUserType) {
+    case SvcWrapperSettings::UserTypeSystem: defaults.user = "LocalSystem"; break;
+    case SvcWrapperSettings::UserTypeLocalNetwork: defaults.user = "NetworkService"; break;
+    default: defaults.user = "LocalService"; break; // Custom users must be set per service
+    }
+
+    // Parse manifest
+    std::vector<SvcManifestEntry> entries;
+    std::string error;
+    if (!SvcParseManifest(m_argv[2], defaults, entries, error)) {
+        cerr << "Invalid manifest: " << error << endl;
+        return ECODE_SYNTAX;
+    }
+
+    // Open SCM
+    int code = initSCM(ScmAccessModify);
+    if (code != ECODE_OK)
+        return code;
+
+    // Apply all entries concurrently, they don't depend on each other
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+    std::vector<SvcApplyResult> results(entries.size());
+    std::vector<double> durations(entries.size());
+    std::vector<bool> succeeded(entries.size());
+    std::mutex outputLock;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        threads.emplace_back([&, i]() {
+            Clock::time_point start = Clock::now();
+            bool ok = SvcApplyManifestEntry(m_hSCM, entries[i], dryRun, results[i]);
+            durations[i] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(outputLock);
+            succeeded[i] = ok;
+            cout << entries[i].name << ": " << (results[i].action.empty() ? "?" : results[i].action);
+            for (size_t c = 0; c < results[i].changes.size(); ++c)
+                cout << (c ? ", " : " (") << results[i].changes[c];
+            if (!results[i].changes.empty())
+                cout << ")";
+            if (!ok)
+                cout << " FAILED: " << results[i].error;
+            cout << endl;
+        });
+    }
+    for (std::thread& t : threads)
+        t.join();
+    double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+
+    // Machine readable summary
+    size_t failed = 0;
+    cout << "{\"command\":\"apply\",\"dry_run\":" << (dryRun ? "true" : "false")
+         << ",\"total_ms\":" << static_cast<unsigned long>(totalMs) << ",\"services\":[";
+    for (size_t i = 0; i < entries.size(); ++i) {
+        failed += succeeded[i] ? 0 : 1;
+        cout << (i ? "," : "")
+             << "{\"name\":\"" << JsonEscape(entries[i].name) << "\""
+             << ",\"action\":\"" << results[i].action << "\""
+             << ",\"ms\":" << static_cast<unsigned long>(durations[i])
+             << ",\"ok\":" << (succeeded[i] ? "true" : "false")
+             << ",\"error\":\"" << JsonEscape(results[i].error) << "\"}";
+    }
+    cout << "],\"failed\":" << failed << "}" << endl;
+    return failed ? ECODE_SCM : ECODE_OK;
+}
+
+// Format FILETIME (UTC) as local time
+static std::string FormatTime(uint64_t fileTime)
+{
+    FILETIME utc, local;
+    SYSTEMTIME st;
+    utc.dwLowDateTime = static_cast<DWORD>(fileTime);
+    utc.dwHighDateTime = static_cast<DWORD>(fileTime >> 32);
+    if (!FileTimeToLocalFileTime(&utc, &local) || !FileTimeToSystemTime(&local, &st))
+        return "?";
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04u-%02u-%02u %02u:%02u:%02u", st.wYear, st.wMonth,
+             st.wDay, st.wHour, st.wMinute, st.wSecond);
+    return buf;
+}
+
+// Median of a list of durations, 0 if empty
+static uint32_t Median(std::vector<uint32_t> values)
+{
+    if (values.empty())
+        return 0;
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+int SvcCli::history()
+{
+    // Parse args
+    unsigned long count = 20;
+    bool hasError = (m_svcCfg.historyFile == nullptr);
+    for (int i = 2; i < m_argc && !hasError; ++i) {
+        if (m_argv[i] == "-n" && i + 1 < m_argc) {
+            count = strtoul(m_argv[++i].c_str(), nullptr, 10);
+            hasError = (count == 0);
+        } else {
+            hasError = true;
+        }
+    }
+    if (hasError) {
+        if (m_svcCfg.historyFile == nullptr)
+            cerr << "Run history is not enabled for service " << m_svcName << "!" << endl;
+        cout << "Usage: " << m_binaryName << " history [-n count]\n\n"
+             << "  -n count   Number of runs to show (default 20)\n"
+             << endl;
+        return ECODE_SYNTAX;
+    }
+
+    // Read journal
+    SvcHistory journal(m_svcCfg.historyFile);
+    std::vector<SvcHistory::Record> runs;
+    if (!journal.open(false) || !journal.read(runs)) {
+        cerr << "Failed to read run history " << m_svcCfg.historyFile << " (Error code: "
+             << GetLastError() << ")" << endl;
+        return ECODE_HISTORY;
+    }
+    if (runs.empty()) {
+        cout << "No runs of service " << m_svcName << " recorded yet." << endl;
+        return ECODE_OK;
+    }
+
+    // Latest runs, startup is measured from process creation until running
+    char line[200];
+    cout << "Runs of service " << m_svcName << ", all durations in ms:\n\n";
+    snprintf(line, sizeof(line), "%6s  %-19s  %-8s  %7s  %7s  %9s  %7s  %6s  %11s  %9s  %s",
+             "Run", "Started", "Build", "Startup", "Ready", "Run [s]", "Stop", "Drain",
+             "Exit code", "Peak KiB", "Reason");
+    cout << line << "\n";
+    for (size_t i = runs.size() - std::min<size_t>(count, runs.size()); i < runs.size(); ++i) {
+        const SvcHistory::Record& run = runs[i];
+        snprintf(line, sizeof(line), "%6llu  %-19s  %08x  %7lu  %7lu  %9lu  %7lu  %6lu  %5d/%-5lu  %9lu  %s",
+                 static_cast<unsigned long long>(run.sequence), FormatTime(run.startTime).c_str(),
+                 run.build, static_cast<unsigned long>(run.launchMs + run.readyMs),
+                 static_cast<unsigned long>(run.readyMs),
+                 static_cast<unsigned long>(run.runSeconds),
+                 static_cast<unsigned long>(run.stopMs), static_cast<unsigned long>(run.drainMs),
+                 run.exitCode, static_cast<unsigned long>(run.win32ExitCode),
+                 static_cast<unsigned long>(run.peakWorkingSet), SvcStopReasonName(run.stopReason));
+        cout << line << "\n";
+    }
+
+    // Trend per deployment, consecutive runs of the same build form one
+    struct Deployment {
+        uint32_t build;
+        uint64_t firstRun;
+        std::vector<uint32_t> startup;
+        std::vector<uint32_t> stop;
+        size_t runs {0};
+        size_t failed {0};
+    };
+    std::vector<Deployment> deployments;
+    for (const SvcHistory::Record& run : runs) {
+        if (deployments.empty() || deployments.back().build != run.build)
+            deployments.push_back({run.build, run.sequence, {}, {}});
+        Deployment& deployment = deployments.back();
+        ++deployment.runs;
+        if (run.stopReason == SvcStopCrashed || run.stopReason == SvcStopStartFailed)
+            ++deployment.failed;
+        if (run.readyMs)
+            deployment.startup.push_back(run.launchMs + run.readyMs);
+        if (run.stopReason == SvcStopScm || run.stopReason == SvcStopIdle)
+            deployment.stop.push_back(run.stopMs);
+    }
+    if (deployments.size() > 10)
+        deployments.erase(deployments.begin(), deployments.end() - 10);
+
+    cout << "\nMedian per deployment:\n\n";
+    snprintf(line, sizeof(line), "%-8s  %9s  %6s  %7s  %7s  %7s  %s", "Build", "First run",
+             "Runs", "Failed", "Startup", "Stop", "Startup trend");
+    cout << line << "\n";
+    for (size_t i = 0; i < deployments.size(); ++i) {
+        const Deployment& deployment = deployments[i];
+        uint32_t startup = Median(deployment.startup);
+        std::string trend;
+        if (i > 0 && startup && Median(deployments[i - 1].startup)) {
+            double previous = Median(deployments[i - 1].startup);
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%+.0f%%", (startup - previous) * 100 / previous);
+            trend = buf;
+        }
+        snprintf(line, sizeof(line), "%08x  %9llu  %6zu  %7zu  %7lu  %7lu  %s", deployment.build,
+                 static_cast<unsigned long long>(deployment.firstRun), deployment.runs,
+                 deployment.failed, static_cast<unsigned long>(startup),
+                 static_cast<unsigned long>(Median(deployment.stop)), trend.c_str());
+        cout << line << "\n";
+    }
+    cout << "\n";
+
+    // Machine readable summary
+    cout << "{\"command\":\"history\",\"runs\":" << runs.size() << ",\"deployments\":[";
+    for (size_t i = 0; i < deployments.size(); ++i) {
+        const Deployment& deployment = deployments[i];
+        snprintf(line, sizeof(line), "%08x", deployment.build);
+        cout << (i ? "," : "")
+             << "{\"build\":\"" << line << "\""
+             << ",\"first_run\":" << deployment.firstRun
+             << ",\"runs\":" << deployment.runs
+             << ",\"failed\":" << deployment.failed
+             << ",\"startup_ms\":" << Median(deployment.startup)
+             << ",\"stop_ms\":" << Median(deployment.stop) << "}";
+    }
+    cout << "]}" << endl;
+    return ECODE_OK;
+}
+
+int SvcCli::threads()
+{
+    // Parse args
+    unsigned long count = 10;
+    bool hasError = false;
+    for (int i = 2; i < m_argc && !hasError; ++i) {
+        if (m_argv[i] == "-n" && i + 1 < m_argc) {
+            count = strtoul(m_argv[++i].c_str(), nullptr, 10);
+            hasError = (count == 0);
+        } else {
+            hasError = true;
+        }
+    }
+    if (hasError) {
+        cout << "Usage: " << m_binaryName << " threads [-n count]\n\n"
+             << "  -n count   Number of threads to show (default 10)\n"
+             << endl;
+        return ECODE_SYNTAX;
+    }
+
+    // Query registered threads
+    SvcIpcClient client;
+    if (!client.connect(SvcIpcPipeName(m_svcName.c_str()), 2000)) {
+        cerr << "Failed to connect to control pipe of service " << m_svcName
+             << "! Is it running with control pipe enabled? (Error code: "
+             << GetLastError() << ")" << endl;
+        return ECODE_CONTROL;
+    }
+    uint32_t id;
+    SvcIpcStatus status = SvcIpcOk;
+    std::string response;
+    client.queue("threads", "", 0);
+    if (!client.flush() || !client.receive(&id, &status, &response)) {
+        cerr << "Control pipe connection broken!" << endl;
+        return ECODE_CONTROL;
+    }
+    if (status != SvcIpcOk) {
+        cerr << "Service doesn't report threads!" << endl;
+        return ECODE_CONTROL;
+    }
+
+    // Parse report lines, the name is last and may contain spaces
+    struct ThreadInfo {
+        unsigned long tid;
+        char role[32];
+        double percent;
+        unsigned long long cpuMs;
+        std::string name;
+    };
+    std::vector<ThreadInfo> entries;
+    size_t pos = 0;
+    while (pos < response.size()) {
+        size_t end = response.find('\n', pos);
+        if (end == std::string::npos)
+            end = response.size();
+        std::string text = response.substr(pos, end - pos);
+        pos = end + 1;
+        ThreadInfo info;
+        int nameOffset = 0;
+        if (sscanf(text.c_str(), "tid=%lu role=%31s cpu_percent=%lf cpu_ms=%llu name=%n",
+                   &info.tid, info.role, &info.percent, &info.cpuMs, &nameOffset) != 4 ||
+                nameOffset == 0)
+            continue;
+        info.name = text.substr(nameOffset);
+        entries.push_back(info);
+    }
+    std::sort(entries.begin(), entries.end(), [](const ThreadInfo& a, const ThreadInfo& b) {
+        return a.percent != b.percent ? a.percent > b.percent : a.cpuMs > b.cpuMs;
+    });
+
+    // Top threads, CPU usage is in percent of one core
+    char line[200];
+    cout << "Threads of service " << m_svcName << ", " << entries.size() << " registered:\n\n";
+    snprintf(line, sizeof(line), "%7s  %10s  %8s  %-12s  %s", "CPU %", "CPU ms", "TID", "Role",
+             "Name");
+    cout << line << "\n";
+    for (size_t i = 0; i < std::min<size_t>(count, entries.size()); ++i) {
+        const ThreadInfo& info = entries[i];
+        snprintf(line, sizeof(line), "%7.1f  %10llu  %8lu  %-12s  %s", info.percent, info.cpuMs,
+                 info.tid, info.role, info.name.c_str());
+        cout << line << "\n";
+    }
+    cout << endl;
+    return ECODE_OK;
+}
+
+void SvcCli::runControlJob(ControlJob& job, const std::string& command,
+                           bool wait, DWORD timeout)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point t0 = Clock::now();
+    auto elapsed = [&]() {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    };
+
+    SC_HANDLE hSvc = OpenService(m_hSCM, job.name.c_str(),
+                                 command == "status" ? SvcAccessQuery : SvcAccessControl);
+    if (hSvc == NULL) {
+        job.error = "Failed to open service (" + std::to_string(GetLastError()) + ")";
+        return;
+    }
+    if (!SvcQueryState(hSvc, &job.fromState)) {
+        job.error = "Failed to query status (" + std::to_string(GetLastError()) + ")";
+        CloseServiceHandle(hSvc);
+        return;
+    }
+    job.toState = job.fromState;
+    job.ok = true;
+
+    // Stop service, restart always waits for it to be stopped
+    if (command == "stop" || command == "restart") {
+        SERVICE_STATUS status;
+        if (job.fromState != SERVICE_STOPPED && job.fromState != SERVICE_STOP_PENDING &&
+                !ControlService(hSvc, SERVICE_CONTROL_STOP, &status) &&
+                GetLastError() != ERROR_SERVICE_NOT_ACTIVE) {
+            job.ok = false;
+            job.error = "Failed to stop service (" + std::to_string(GetLastError()) + ")";
+        } else if ((wait || command == "restart") &&
+                   !SvcWaitForState(hSvc, SERVICE_STOPPED, timeout, &job.toState)) {
+            job.ok = false;
+            job.error = "Service didn't stop in time";
+        }
+    }
+
+    // Start service
+    if (job.ok && (command == "start" || command == "restart")) {
+        DWORD remaining = timeout - std::min(timeout, static_cast<DWORD>(elapsed()));
+        if (!StartService(hSvc, 0, NULL) && GetLastError() != ERROR_SERVICE_ALREADY_RUNNING) {
+            job.ok = false;
+            job.error = "Failed to start service (" + std::to_string(GetLastError()) + ")";
+        } else if (wait && !SvcWaitForState(hSvc, SERVICE_RUNNING, remaining, &job.toState)) {
+            job.ok = false;
+            job.error = job.toState == SERVICE_STOPPED ? "Service stopped while starting"
+                                                       : "Service didn't start in time";
+        }
+    }
+
+    // Report current state if we didn't wait for it
+    if (!wait && command != "status")
+        SvcQueryState(hSvc, &job.toState);
+    job.ms = elapsed();
+    CloseServiceHandle(hSvc);
+}
+
 int SvcCli::initSCM(ScmAccess accessLevel)
 {
     assert(m_hSCM == NULL);
@@ -299,12 +1051,12 @@ int SvcCli::initSCM(ScmAccess accessLevel)
     return ECODE_OK;
 }
 
-constexpr DWORD SvcCli::convertStartType(SvcWrapperConfig::StartType startType) const
+constexpr DWORD SvcCli::convertStartType(SvcWrapperSettings::StartType startType) const
 {
     switch (startType) {
-    case SvcWrapperConfig::StartTypeAuto: return SERVICE_AUTO_START;
-    case SvcWrapperConfig::StartTypeDemand: return SERVICE_DEMAND_START;
-    case SvcWrapperConfig::StartTypeDisabled: [[fallthrough]];
+    case SvcWrapperSettings::StartTypeAuto: return SERVICE_AUTO_START;
+    case SvcWrapperSettings::StartTypeDemand: return SERVICE_DEMAND_START;
+    case SvcWrapperSettings::StartTypeDisabled: [[fallthrough]];
     default: return SERVICE_DISABLED;
     }
 }
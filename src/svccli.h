@@ -23,8 +23,11 @@ public:
      * \param argc passed from main
      * \param argv passed from main
      * \param svcConfig Service configuration
+     * \param hostedServices Names of all services hosted by the executable,
+     * if it hosts more than one
      */
-    explicit SvcCli(int argc, char *argv[], const SvcWrapperConfig& svcConfig);
+    explicit SvcCli(int argc, char *argv[], const SvcWrapperSettings& svcConfig,
+                    const std::vector<std::string>& hostedServices = {});
     ~SvcCli();
 
     /*!
@@ -40,10 +43,10 @@ private:
      * \brief Service control manager access level
      * \details The ScmAccess enum defines permission levels used to access
      * the windows service control manager (SCM).
-     * \note This may be extended in future with e.g. read only access for
-     * querying service status.
      */
     enum ScmAccess : DWORD {
+        //! \brief Query and control existing services
+        ScmAccessQuery = SC_MANAGER_CONNECT | SC_MANAGER_ENUMERATE_SERVICE,
         //! \brief Modify service configuration
         ScmAccessModify = SC_MANAGER_ALL_ACCESS
     };
@@ -56,6 +59,8 @@ private:
     enum SvcAccess : DWORD {
         //! \brief Read service configuration and status
         SvcAccessQuery = SERVICE_QUERY_STATUS,
+        //! \brief Start and stop service, read it's status
+        SvcAccessControl = SERVICE_QUERY_STATUS | SERVICE_START | SERVICE_STOP,
         //! \brief Modify service configuration
         SvcAccessModify = SERVICE_ALL_ACCESS
     };
@@ -96,7 +101,100 @@ private:
      */
     int uninstall();
 
+    /*!
+     * \brief Send control command
+     * \details Sends a command to the control pipe of the running service and
+     * prints the response. If a count is given, the command is sent that many
+     * times, one after another and pipelined, and the round trip latencies are
+     * printed instead. Returns a different exit code in following cases:
+     * - command syntax error (will also print help)
+     * - control pipe not available (service not running or pipe disabled)
+     * - service reported failure or doesn't know the command
+     * \return Exit code (0 on success)
+     */
+    int control();
+
+    /*!
+     * \brief Query or change service state
+     * \details Executes one of the commands status, start, stop or restart
+     * for one or more services concurrently. Services may be given by name or
+     * wildcard pattern, the own service is used if none are given. Waiting
+     * for services to reach their target state uses SCM status change
+     * notifications. Prints a line with the transition timing per service
+     * and a JSON summary line at the end.
+     * \param command Command to execute
+     * \return Exit code (0 if all services succeeded)
+     */
+    int controlServices(const std::string& command);
+
+    /*!
+     * \brief Apply service manifest
+     * \details Brings the installed services in line with a manifest file
+     * (see svcmanifest.h). Each service is compared to the installed state
+     * and only the needed create, change or delete operations are executed,
+     * for all services concurrently. Defaults for all services are taken from
+     * this executable's service configuration. Prints the operation per
+     * service and a JSON summary line at the end.
+     * \return Exit code (0 if all services succeeded)
+     */
+    int apply();
+
+    /*!
+     * \brief Show run history
+     * \details Reads the run history journal of the service (see
+     * SvcWrapperSettings::historyFile) and prints the latest runs with their
+     * startup, stop and drain times, exit codes and stop reasons. Runs of
+     * the same build are summarized per deployment, with the change of the
+     * median startup time against the previous deployment. A JSON summary
+     * line follows at the end. Returns a different exit code in following
+     * cases:
+     * - run history not enabled (will also print help)
+     * - journal can't be read
+     * \return Exit code (0 on success)
+     */
+    int history();
+
+    /*!
+     * \brief Show busiest threads
+     * \details Queries the registered threads of the running service through
+     * it's control pipe (see SvcRegisterThread()) and prints the top threads
+     * by CPU usage during the last sample interval. Returns a different exit
+     * code in following cases:
+     * - command syntax error (will also print help)
+     * - control pipe not available (service not running or pipe disabled)
+     * \return Exit code (0 on success)
+     */
+    int threads();
+
     // === Helpers =============================================================
+
+    /*!
+     * \brief Service control job
+     * \details Describes the operation on and result for a single service
+     * of the controlServices command.
+     */
+    struct ControlJob {
+        std::string name;
+        DWORD fromState {0};
+        DWORD toState {0};
+        double ms {0};
+        bool ok {false};
+        std::string error;
+        size_t wave {0};
+        std::vector<size_t> dependsOn;
+    };
+
+    /*!
+     * \brief Execute service control job
+     * \details Executes a command of controlServices for a single service.
+     * \param job Job to execute, receives the result
+     * \param command Command to execute
+     * \param wait Wait for the target state to be reached
+     * \param timeout Maximum time to wait [ms]
+     */
+    void runControlJob(ControlJob& job, const std::string& command,
+                       bool wait, DWORD timeout);
+
     /*!
      * \brief Init SCM access
      * \details Initializes access to the Service Control Manager (SCM) with
@@ -113,13 +211,13 @@ private:
      * \param startType service start type
      * \return Windows service start type value
      */
-    constexpr DWORD convertStartType(SvcWrapperConfig::StartType startType) const;
+    constexpr DWORD convertStartType(SvcWrapperSettings::StartType startType) const;
 
 private:
     // Initial params
     const int    m_argc;
     std::vector<std::string> m_argv;
-    const SvcWrapperConfig& m_svcCfg;
+    const SvcWrapperSettings& m_svcCfg;
 
     // Executable information
     std::string m_binaryName;
@@ -128,6 +226,7 @@ private:
 
     // Service information
     std::string m_svcName;
+    std::vector<std::string> m_hostedServices;
 
     // SCM handles
     SC_HANDLE   m_hSCM {NULL};
@@ -0,0 +1,202 @@
+// Run history journal of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svchistory.h"
+#include "svcwrapper_impl.h"
+
+#include <psapi.h>
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+// FNV-1a hash of a record, with the checksum itself taken as 0
+static uint32_t Checksum(const SvcHistory::Record& record)
+{
+    SvcHistory::Record copy = record;
+    copy.checksum = 0;
+    uint32_t hash = 2166136261U;
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(&copy);
+    for (size_t i = 0; i < sizeof(copy); ++i)
+        hash = (hash ^ data[i]) * 16777619U;
+    return hash;
+}
+
+SvcHistory::SvcHistory(const std::string& path)
+    : m_path(path)
+{
+}
+
+SvcHistory::~SvcHistory()
+{
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+}
+
+bool SvcHistory::open(bool write)
+{
+    // Readers and the writer share the file, torn records fail the checksum
+    m_file = CreateFile(m_path.c_str(), GENERIC_READ | (write ? GENERIC_WRITE : 0),
+                        FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                        write ? OPEN_ALWAYS : OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL | (write ? FILE_FLAG_WRITE_THROUGH : 0), NULL);
+    return m_file != INVALID_HANDLE_VALUE;
+}
+
+bool SvcHistory::read(std::vector<Record>& records) const
+{
+    vector<Record> slots(Capacity);
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    DWORD bytesRead = 0;
+    if (!ReadFile(m_file, slots.data(), static_cast<DWORD>(slots.size() * sizeof(Record)),
+                  &bytesRead, &ov) && GetLastError() != ERROR_HANDLE_EOF)
+        return false;
+
+    // Skip empty, torn and misplaced slots
+    records.clear();
+    for (size_t i = 0; i < bytesRead / sizeof(Record); ++i) {
+        const Record& record = slots[i];
+        if (record.magic == RecordMagic && record.checksum == Checksum(record) &&
+            record.sequence % Capacity == i)
+            records.push_back(record);
+    }
+    sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+        return a.sequence < b.sequence;
+    });
+    return true;
+}
+
+bool SvcHistory::write(Record& record)
+{
+    record.magic = RecordMagic;
+    record.checksum = Checksum(record);
+
+    // Positioned write of the whole record to it's slot
+    ULONGLONG offset = (record.sequence % Capacity) * sizeof(Record);
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = static_cast<DWORD>(offset);
+    ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    return WriteFile(m_file, &record, sizeof(record), &written, &ov) &&
+           written == sizeof(record);
+}
+
+// Link time stamp of the executable, tells deployments apart
+static uint32_t BuildStamp()
+{
+    const BYTE* image = reinterpret_cast<const BYTE*>(GetModuleHandle(NULL));
+    const IMAGE_DOS_HEADER* dos = reinterpret_cast<const IMAGE_DOS_HEADER*>(image);
+    const IMAGE_NT_HEADERS* nt = reinterpret_cast<const IMAGE_NT_HEADERS*>(image + dos->e_lfanew);
+    return nt->FileHeader.TimeDateStamp;
+}
+
+static uint32_t Clamp32(ULONGLONG value)
+{
+    return static_cast<uint32_t>(min<ULONGLONG>(value, UINT32_MAX));
+}
+
+bool SvcHistoryStart()
+{
+    SvcHistory* history = new SvcHistory(hSvc->cfg->historyFile);
+    vector<SvcHistory::Record> records;
+    if (!history->open(true) || !history->read(records)) {
+        delete history;
+        return false;
+    }
+
+    // The previous run didn't record it's stop, so it's process died
+    uint64_t sequence = 1;
+    if (!records.empty()) {
+        SvcHistory::Record last = records.back();
+        sequence = last.sequence + 1;
+        if (last.stopReason == SvcStopNone) {
+            last.stopReason = SvcStopCrashed;
+            history->write(last);
+            char msg[100];
+            snprintf(msg, sizeof(msg), "Previous run %llu ended without stopping",
+                     static_cast<unsigned long long>(last.sequence));
+            SvcLog(Warning, msg);
+        }
+    }
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    ULONGLONG startTick = hSvc->stateTick[SERVICE_START_PENDING].load(memory_order_relaxed);
+    SvcHistory::Record& run = history->run();
+    run = SvcHistory::Record {};
+    run.sequence = sequence;
+    run.startTime = (static_cast<uint64_t>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+    run.build = BuildStamp();
+    run.launchMs = Clamp32(startTick - min(startTick, hSvc->processStartTick));
+    hSvc->history = history;
+
+    char msg[100];
+    snprintf(msg, sizeof(msg), "Recording run %llu to history journal",
+             static_cast<unsigned long long>(sequence));
+    SvcLog(Debug, msg);
+    return history->write(run);
+}
+
+void SvcHistoryRunning()
+{
+    SvcHistory* history = hSvc->history;
+    if (!history)
+        return;
+    SvcHistory::Record& run = history->run();
+    ULONGLONG startTick = hSvc->stateTick[SERVICE_START_PENDING].load(memory_order_relaxed);
+    ULONGLONG runningTick = hSvc->stateTick[SERVICE_RUNNING].load(memory_order_relaxed);
+    run.readyMs = Clamp32(runningTick - startTick);
+    if (!history->write(run))
+        SvcLog(Warning, "Failed to write run history journal!");
+}
+
+void SvcHistoryStop(DWORD win32ExitCode)
+{
+    SvcHistory* history = hSvc->history;
+    if (!history)
+        return;
+    SvcHistory::Record& run = history->run();
+    ULONGLONG now = GetTickCount64();
+    ULONGLONG stopTick = hSvc->stopTick ? hSvc->stopTick : now;
+
+    // State ticks of earlier runs are left over, if this one never got running
+    ULONGLONG startTick = hSvc->stateTick[SERVICE_START_PENDING].load(memory_order_relaxed);
+    ULONGLONG runningTick = hSvc->stateTick[SERVICE_RUNNING].load(memory_order_relaxed);
+    if (runningTick >= startTick && stopTick >= runningTick)
+        run.runSeconds = Clamp32((stopTick - runningTick) / 1000);
+    run.stopMs = Clamp32(now - min(now, stopTick));
+    if (hSvc->draining.load()) {
+        run.drainMs = Clamp32(hSvc->drainTime);
+        run.cutOff = static_cast<uint16_t>(min<ULONGLONG>(hSvc->drainCutOff, UINT16_MAX));
+    }
+    run.exitCode = hSvc->exitCode;
+    run.win32ExitCode = win32ExitCode;
+    run.stopReason = hSvc->stopReason != SvcStopNone ? hSvc->stopReason : SvcStopAppExit;
+
+    PROCESS_MEMORY_COUNTERS mem;
+    ZeroMemory(&mem, sizeof(mem));
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem)))
+        run.peakWorkingSet = Clamp32(mem.PeakWorkingSetSize / 1024);
+
+    if (!history->write(run))
+        SvcLog(Warning, "Failed to write run history journal!");
+    delete history;
+    hSvc->history = nullptr;
+}
+
+const char* SvcStopReasonName(WORD stopReason)
+{
+    switch (stopReason) {
+    case SvcStopNone: return "running";
+    case SvcStopScm: return "stopped";
+    case SvcStopIdle: return "idle";
+    case SvcStopAppExit: return "app exit";
+    case SvcStopStartFailed: return "start failed";
+    case SvcStopCrashed: return "crashed";
+    default: return "unknown";
+    }
+}
+
+const SvcDetail::HistoryFeature SvcDetail::History {SvcHistoryStart, SvcHistoryRunning,
+                                                    SvcHistoryStop};
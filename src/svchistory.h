@@ -0,0 +1,126 @@
+// Run history journal of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCHISTORY_H
+#define SVCHISTORY_H
+
+#include <windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reason the service stopped, recorded in the run history
+enum SvcStopReason : WORD {
+    SvcStopNone,        // Not stopped yet
+    SvcStopScm,         // Stop requested by the SCM
+    SvcStopIdle,        // Idle timeout expired
+    SvcStopAppExit,     // Application exited on it's own
+    SvcStopStartFailed, // Service failed to start
+    SvcStopCrashed      // Process ended before the stop was recorded
+};
+
+/*!
+ * \brief Run history journal
+ * \details Binary file of fixed size records, one per run of a service. The
+ * records form a ring: run n goes to slot n % Capacity, so the file never
+ * grows beyond Capacity records and the oldest runs are overwritten. Each
+ * record is written with a single positioned write, a checksum tells torn or
+ * foreign records apart. The journal may be read while the service writes it.
+ */
+class SvcHistory
+{
+public:
+    //! \brief Number of runs kept
+    static constexpr ULONGLONG Capacity = 1024;
+
+    //! \brief Record of a single run, as stored in the file
+    struct Record {
+        uint32_t magic;          //!< RecordMagic
+        uint32_t checksum;       //!< FNV-1a of the record with checksum 0
+        uint64_t sequence;       //!< Run number, counting from 1
+        uint64_t startTime;      //!< Start pending (FILETIME, UTC)
+        uint32_t build;          //!< Link time stamp of the executable
+        uint32_t launchMs;       //!< Process creation until start pending
+        uint32_t readyMs;        //!< Start pending until running
+        uint32_t runSeconds;     //!< Running until stop requested
+        uint32_t stopMs;         //!< Stop requested until stopped
+        uint32_t drainMs;        //!< Time spent draining
+        int32_t exitCode;        //!< Application exit code
+        uint32_t win32ExitCode;  //!< Exit code reported to the SCM
+        uint32_t peakWorkingSet; //!< Peak working set of the process [KiB]
+        uint16_t stopReason;     //!< SvcStopReason, SvcStopNone while running
+        uint16_t cutOff;         //!< Requests cut off by the drain timeout
+    };
+    static_assert(sizeof(Record) == 64, "history records must not change size");
+
+    //! \brief Record magic, "SVHJ"
+    static constexpr uint32_t RecordMagic = 0x4A485653;
+
+    /*!
+     * \param path Journal file
+     */
+    explicit SvcHistory(const std::string& path);
+    ~SvcHistory();
+
+    /*!
+     * \brief Open journal
+     * \param write Open for writing, create the file if it doesn't exist
+     * \return false if the file couldn't be opened
+     */
+    bool open(bool write);
+
+    /*!
+     * \brief Read all records
+     * \details Records with a wrong magic or checksum are skipped.
+     * \param records Receives the valid records, ordered by sequence
+     * \return false if the file couldn't be read
+     */
+    bool read(std::vector<Record>& records) const;
+
+    /*!
+     * \brief Write record
+     * \details Sets magic and checksum and writes the record to the slot of
+     * it's sequence number.
+     * \param record Record to write
+     * \return false if the record couldn't be written
+     */
+    bool write(Record& record);
+
+    //! \brief Record of the current run, maintained by the core
+    Record& run() { return m_run; }
+
+private:
+    std::string m_path;
+    HANDLE m_file {INVALID_HANDLE_VALUE};
+    Record m_run {};
+};
+
+/*!
+ * \brief Start recording a run
+ * \details Opens the history journal of the current thread's service, marks
+ * the previous run crashed if it's stop wasn't recorded and records the start
+ * of a new run.
+ * \return false if the journal couldn't be opened or written
+ */
+bool SvcHistoryStart();
+
+/*!
+ * \brief Record the service running
+ */
+void SvcHistoryRunning();
+
+/*!
+ * \brief Record the end of the run
+ * \details Records durations, exit codes and the stop reason of the current
+ * thread's service and closes the journal.
+ * \param win32ExitCode Exit code about to be reported to the SCM
+ */
+void SvcHistoryStop(DWORD win32ExitCode);
+
+/*!
+ * \brief Stop reason name
+ * \param stopReason SvcStopReason
+ * \return Name of the stop reason, "unknown" if invalid
+ */
+const char* SvcStopReasonName(WORD stopReason);
+
+#endif // SVCHISTORY_H
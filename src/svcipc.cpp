@@ -0,0 +1,466 @@
+// Control pipe of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcipc.h"
+#include "svcwrapper_impl.h"
+#include "svctimer.h"
+#include "svcthreads.h"
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <psapi.h>
+
+using namespace std;
+
+// === Command registry ========================================================
+
+// Maximum number of registered commands
+static constexpr size_t MaxCommands = 32;
+
+// Registered handler, never modified, so requests call it without holding
+// the lock. A replaced handler is deleted once no request uses it anymore.
+struct CommandHandler {
+    SvcControlHandler fn;
+    size_t users {0};
+    bool replaced {false};
+};
+
+struct ControlCommand {
+    char name[256];
+    size_t nameLen;
+    CommandHandler* handler;
+};
+
+static mutex commandLock;
+static ControlCommand commands[MaxCommands];
+static size_t commandCount {0};
+
+bool SvcRegisterControlCommand(const char* name, const SvcControlHandler& handler)
+{
+    size_t nameLen = name ? strlen(name) : 0;
+    if (!nameLen || nameLen > 255 || !handler)
+        return false;
+    CommandHandler* entry = new CommandHandler {handler};
+    lock_guard<mutex> lock(commandLock);
+
+    // Replace handler of already registered command
+    for (size_t i = 0; i < commandCount; ++i) {
+        if (commands[i].nameLen == nameLen && !memcmp(commands[i].name, name, nameLen)) {
+            CommandHandler* old = commands[i].handler;
+            commands[i].handler = entry;
+            if (old->users == 0)
+                delete old;
+            else
+                old->replaced = true;
+            return true;
+        }
+    }
+    if (commandCount == MaxCommands) {
+        delete entry;
+        return false;
+    }
+    ControlCommand& cmd = commands[commandCount++];
+    memcpy(cmd.name, name, nameLen + 1);
+    cmd.nameLen = nameLen;
+    cmd.handler = entry;
+    return true;
+}
+
+// === Builtin commands ========================================================
+
+static const char* const LogLevelNames[] = {"Critical", "Warning", "Info", "Debug"};
+
+void SvcIpcRegisterBuiltins()
+{
+    // Echo payload, e.g. for measuring round trip latency
+    SvcRegisterControlCommand("ping", [](const char* req, size_t len, char* resp, size_t* respLen) {
+        memcpy(resp, req, len);
+        *respLen = len;
+        return 0;
+    });
+
+    // Report service status
+    SvcRegisterControlCommand("stats", [](const char*, size_t, char* resp, size_t* respLen) {
+        if (!hSvc)
+            return 1;
+        ULONGLONG now = GetTickCount64();
+        PROCESS_MEMORY_COUNTERS mem;
+        ZeroMemory(&mem, sizeof(mem));
+        GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem));
+        int n = snprintf(resp, *respLen,
+                         "service=%s\n"
+                         "pid=%lu\n"
+                         "hosted_services=%zu\n"
+                         "state=%lu\n"
+                         "uptime_ms=%llu\n"
+                         "idle_ms=%llu\n"
+                         "loglevel=%s\n"
+                         "working_set=%llu\n"
+                         "peak_working_set=%llu\n"
+                         "prewarm_bytes=%llu\n"
+                         "prewarm_ms=%llu\n"
+                         "inflight=%zu\n"
+                         "drain_ms=%llu\n"
+                         "drain_cut_off=%llu\n"
+                         "log_rate_limited=%llu\n"
+                         "log_deduplicated=%llu\n"
+                         "log_sampled=%llu\n",
+                         hSvc->cfg->svcName,
+                         GetCurrentProcessId(),
+                         hSvcCount,
+                         SvcState(),
+                         now - hSvc->processStartTick,
+                         now - min(now, hSvc->lastActivity.load(memory_order_relaxed)),
+                         LogLevelNames[hSvc->logLevel.load(memory_order_relaxed)],
+                         static_cast<ULONGLONG>(mem.WorkingSetSize),
+                         static_cast<ULONGLONG>(mem.PeakWorkingSetSize),
+                         hSvc->prewarmBytes,
+                         hSvc->prewarmTime,
+                         SvcWorkInFlight(),
+                         hSvc->drainTime,
+                         hSvc->drainCutOff,
+                         hSvc->logRateLimited.load(memory_order_relaxed),
+                         hSvc->logDeduplicated.load(memory_order_relaxed),
+                         hSvc->logSampled.load(memory_order_relaxed));
+        if (n > 0 && static_cast<size_t>(n) < *respLen && SvcAllocStatsHook) {
+            SvcAllocStats stats;
+            SvcAllocStatsHook(stats);
+            n += snprintf(resp + n, *respLen - n,
+                          "alloc_count=%llu\n"
+                          "alloc_bytes=%llu\n"
+                          "alloc_live_bytes=%llu\n"
+                          "alloc_per_sec=%.0f\n"
+                          "alloc_bytes_per_sec=%.0f\n",
+                          stats.allocations,
+                          stats.bytesAllocated,
+                          stats.liveBytes,
+                          stats.allocationsPerSec,
+                          stats.bytesPerSec);
+        }
+        *respLen = n > 0 ? min(static_cast<size_t>(n), *respLen) : 0;
+        return 0;
+    });
+
+    // Timers of the service and their job runtimes
+    SvcRegisterControlCommand("timers", [](const char*, size_t, char* resp, size_t* respLen) {
+        if (!hSvc)
+            return 1;
+        *respLen = SvcTimerReport(resp, *respLen);
+        return 0;
+    });
+
+    // Registered threads of the process and their CPU usage
+    SvcRegisterControlCommand("threads", [](const char*, size_t, char* resp, size_t* respLen) {
+        *respLen = SvcThreadReport(resp, *respLen);
+        return 0;
+    });
+
+    // Change log level at runtime
+    SvcRegisterControlCommand("loglevel", [](const char* req, size_t len, char* resp, size_t* respLen) {
+        if (!hSvc)
+            return 1;
+        for (int level = Critical; level <= Debug; ++level) {
+            if (strlen(LogLevelNames[level]) == len && !memcmp(LogLevelNames[level], req, len)) {
+                hSvc->logLevel.store(level, memory_order_relaxed);
+                *respLen = 0;
+                return 0;
+            }
+        }
+        *respLen = static_cast<size_t>(snprintf(resp, *respLen,
+                                                "Unknown log level, use one of "
+                                                "Critical, Warning, Info, Debug"));
+        return 1;
+    });
+}
+
+string SvcIpcPipeName(const char* svcName)
+{
+    return string("\\\\.\\pipe\\SvcWrapper.") + svcName;
+}
+
+// Read and write little endian integers
+static inline uint32_t GetU32(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+static inline void PutU32(char* p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+}
+
+// === Subsystem ===============================================================
+
+static bool SvcIpcStart()
+{
+    SvcIpcRegisterBuiltins();
+    hSvc->ipcServer = new SvcIpcServer(SvcIpcPipeName(hSvc->cfg->svcName));
+    return hSvc->ipcServer->start();
+}
+
+static void SvcIpcStop()
+{
+    delete hSvc->ipcServer;
+    hSvc->ipcServer = nullptr;
+}
+
+const SvcDetail::ControlPipeFeature SvcDetail::ControlPipe {SvcIpcStart, SvcIpcStop};
+
+// === Server ==================================================================
+
+SvcIpcServer::SvcIpcServer(const string& pipeName)
+    : m_pipeName(pipeName)
+{
+    ZeroMemory(&m_ov, sizeof(m_ov));
+}
+
+SvcIpcServer::~SvcIpcServer()
+{
+    stop();
+}
+
+bool SvcIpcServer::start()
+{
+    m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (m_stopEvent == NULL || m_ov.hEvent == NULL)
+        return false;
+    m_hThread = SvcCreateThread(threadMain, this, "control pipe");
+    return m_hThread != NULL;
+}
+
+void SvcIpcServer::stop()
+{
+    if (m_hThread != NULL) {
+        SetEvent(m_stopEvent);
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+        m_hThread = NULL;
+    }
+    if (m_stopEvent != NULL) {
+        CloseHandle(m_stopEvent);
+        m_stopEvent = NULL;
+    }
+    if (m_ov.hEvent != NULL) {
+        CloseHandle(m_ov.hEvent);
+        m_ov.hEvent = NULL;
+    }
+}
+
+DWORD SvcIpcServer::threadMain(LPVOID param)
+{
+    static_cast<SvcIpcServer*>(param)->run();
+    return ERROR_SUCCESS;
+}
+
+void SvcIpcServer::run()
+{
+    /* Single pipe instance
+     *
+     * The instance is kept for the whole run and reused for every client.
+     * Closing and creating it again would leave a gap, in which clients fail
+     * to connect and any other process could create a pipe of that name.
+     */
+    HANDLE hPipe = CreateNamedPipe(
+                m_pipeName.c_str(),
+                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                1, // Serve one client at a time
+                OutBufferSize, InBufferSize, 0, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE) {
+        char msg[80];
+        snprintf(msg, sizeof(msg), "Failed to create control pipe: %lu", GetLastError());
+        SvcLog(Warning, msg);
+        return;
+    }
+
+    while (WaitForSingleObject(m_stopEvent, 0) == WAIT_TIMEOUT) {
+        // Wait for client
+        DWORD bytes;
+        BOOL started = ConnectNamedPipe(hPipe, &m_ov);
+        if (started || GetLastError() == ERROR_PIPE_CONNECTED || waitIo(hPipe, FALSE, &bytes))
+            serve(hPipe);
+        DisconnectNamedPipe(hPipe);
+    }
+    CloseHandle(hPipe);
+}
+
+bool SvcIpcServer::waitIo(HANDLE hPipe, BOOL started, DWORD* bytes)
+{
+    if (!started && GetLastError() != ERROR_IO_PENDING)
+        return false;
+    HANDLE events[2] = {m_ov.hEvent, m_stopEvent};
+    if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0) {
+        // Stop requested, abort I/O
+        CancelIoEx(hPipe, &m_ov);
+        GetOverlappedResult(hPipe, &m_ov, bytes, TRUE);
+        return false;
+    }
+    return GetOverlappedResult(hPipe, &m_ov, bytes, FALSE) != FALSE;
+}
+
+void SvcIpcServer::serve(HANDLE hPipe)
+{
+    uint32_t fill = 0;
+    for (;;) {
+        // Read whatever the client sent
+        DWORD bytes = 0;
+        BOOL done = ReadFile(hPipe, m_in + fill, InBufferSize - fill, &bytes, &m_ov);
+        if (!waitIo(hPipe, done, &bytes) || !bytes)
+            return;
+        fill += bytes;
+
+        // Process all complete requests, batching their responses
+        uint32_t pos = 0;
+        uint32_t outLen = 0;
+        while (fill - pos >= 4) {
+            uint32_t len = GetU32(m_in + pos);
+            if (len < SvcIpcRequestHeader || len > SvcIpcMaxFrame - 4)
+                return; // Malformed, drop client
+            if (fill - pos - 4 < len)
+                break;
+            outLen += process(m_in + pos + 4, len, m_out + outLen);
+            pos += 4 + len;
+
+            // Send batch early if another response might not fit
+            if (OutBufferSize - outLen < SvcIpcMaxFrame) {
+                done = WriteFile(hPipe, m_out, outLen, &bytes, &m_ov);
+                if (!waitIo(hPipe, done, &bytes))
+                    return;
+                outLen = 0;
+            }
+        }
+        if (outLen) {
+            done = WriteFile(hPipe, m_out, outLen, &bytes, &m_ov);
+            if (!waitIo(hPipe, done, &bytes))
+                return;
+        }
+
+        // Keep incomplete request
+        fill -= pos;
+        if (fill && pos)
+            memmove(m_in, m_in + pos, fill);
+    }
+}
+
+uint32_t SvcIpcServer::process(const char* req, uint32_t len, char* out)
+{
+    uint32_t id = GetU32(req);
+    uint8_t nameLen = static_cast<uint8_t>(req[4]);
+    char* payload = out + 4 + SvcIpcResponseHeader;
+    size_t payloadLen = 0;
+    uint8_t status = SvcIpcMalformed;
+
+    if (SvcIpcRequestHeader + nameLen <= len) {
+        const char* name = req + SvcIpcRequestHeader;
+        const char* reqPayload = name + nameLen;
+        size_t reqPayloadLen = len - SvcIpcRequestHeader - nameLen;
+
+        // Look up command handler. It's invoked without holding the lock, so
+        // it may register commands and doesn't hold up other services' pipes.
+        CommandHandler* handler = nullptr;
+        {
+            lock_guard<mutex> lock(commandLock);
+            for (size_t i = 0; i < commandCount && !handler; ++i) {
+                if (commands[i].nameLen == nameLen && !memcmp(commands[i].name, name, nameLen))
+                    handler = commands[i].handler;
+            }
+            if (handler)
+                ++handler->users;
+        }
+        status = SvcIpcUnknownCommand;
+        if (handler) {
+            payloadLen = SvcIpcMaxPayload;
+            int result = handler->fn(reqPayload, reqPayloadLen, payload, &payloadLen);
+            payloadLen = min(payloadLen, static_cast<size_t>(SvcIpcMaxPayload));
+            status = result == 0 ? SvcIpcOk : SvcIpcFailed;
+
+            lock_guard<mutex> lock(commandLock);
+            if (--handler->users == 0 && handler->replaced)
+                delete handler;
+        }
+    }
+
+    // Response header
+    uint32_t frameLen = SvcIpcResponseHeader + static_cast<uint32_t>(payloadLen);
+    PutU32(out, frameLen);
+    PutU32(out + 4, id);
+    out[8] = static_cast<char>(status);
+    return 4 + frameLen;
+}
+
+// === Client ==================================================================
+
+SvcIpcClient::~SvcIpcClient()
+{
+    if (m_hPipe != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hPipe);
+}
+
+bool SvcIpcClient::connect(const string& pipeName, DWORD timeout)
+{
+    ULONGLONG deadline = GetTickCount64() + timeout;
+    for (;;) {
+        m_hPipe = CreateFile(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE,
+                             0, NULL, OPEN_EXISTING, 0, NULL);
+        if (m_hPipe != INVALID_HANDLE_VALUE)
+            return true;
+        if (GetLastError() != ERROR_PIPE_BUSY)
+            return false;
+
+        // Server is busy with another client
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline)
+            return false;
+        WaitNamedPipe(pipeName.c_str(), static_cast<DWORD>(deadline - now));
+    }
+}
+
+uint32_t SvcIpcClient::queue(const char* command, const char* payload, size_t len)
+{
+    uint8_t nameLen = static_cast<uint8_t>(min(strlen(command), static_cast<size_t>(255)));
+    len = min(len, static_cast<size_t>(SvcIpcMaxPayload));
+    char header[4 + SvcIpcRequestHeader];
+    uint32_t id = m_nextId++;
+    PutU32(header, SvcIpcRequestHeader + nameLen + static_cast<uint32_t>(len));
+    PutU32(header + 4, id);
+    header[8] = static_cast<char>(nameLen);
+    m_out.append(header, sizeof(header));
+    m_out.append(command, nameLen);
+    m_out.append(payload, len);
+    return id;
+}
+
+bool SvcIpcClient::flush()
+{
+    DWORD written = 0;
+    bool ok = WriteFile(m_hPipe, m_out.data(), static_cast<DWORD>(m_out.size()),
+                        &written, NULL) && written == m_out.size();
+    m_out.clear();
+    return ok;
+}
+
+bool SvcIpcClient::receive(uint32_t* id, SvcIpcStatus* status, string* payload)
+{
+    char buffer[16 * 1024];
+    for (;;) {
+        // Complete response available?
+        if (m_in.size() >= 4) {
+            uint32_t len = GetU32(m_in.data());
+            if (len < SvcIpcResponseHeader)
+                return false;
+            if (m_in.size() - 4 >= len) {
+                *id = GetU32(m_in.data() + 4);
+                *status = static_cast<SvcIpcStatus>(m_in[8]);
+                payload->assign(m_in, 4 + SvcIpcResponseHeader, len - SvcIpcResponseHeader);
+                m_in.erase(0, 4 + len);
+                return true;
+            }
+        }
+        DWORD bytes = 0;
+        if (!ReadFile(m_hPipe, buffer, sizeof(buffer), &bytes, NULL) || !bytes)
+            return false;
+        m_in.append(buffer, bytes);
+    }
+}
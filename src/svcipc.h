@@ -0,0 +1,177 @@
+// Control pipe of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCIPC_H
+#define SVCIPC_H
+
+#include <windows.h>
+#include <cstdint>
+#include <string>
+
+/* Control pipe protocol
+ *
+ * Clients connect to the named pipe \\.\pipe\SvcWrapper.<service name> and
+ * send request frames. Each request is answered by exactly one response
+ * frame, responses are sent in request order. Clients may send any number of
+ * requests without waiting for the responses (pipelining), the server
+ * processes all complete requests it has received and sends their responses
+ * with a single write (batching).
+ *
+ * All integers are little endian.
+ *
+ * Request frame:   u32 length of the following data
+ *                  u32 request id (echoed in the response)
+ *                  u8  length of command name
+ *                  ... command name
+ *                  ... payload
+ *
+ * Response frame:  u32 length of the following data
+ *                  u32 request id
+ *                  u8  status (SvcIpcStatus)
+ *                  ... payload
+ */
+
+// Maximum payload size of requests and responses
+constexpr uint32_t SvcIpcMaxPayload = 64 * 1024;
+
+// Size of request and response headers, excluding the length field
+constexpr uint32_t SvcIpcRequestHeader = 5;
+constexpr uint32_t SvcIpcResponseHeader = 5;
+
+// Maximum frame size, including the length field
+constexpr uint32_t SvcIpcMaxFrame = 4 + SvcIpcRequestHeader + 255 + SvcIpcMaxPayload;
+
+// Response status codes
+enum SvcIpcStatus : uint8_t {
+    SvcIpcOk = 0,               // Command succeeded
+    SvcIpcFailed = 1,           // Command handler reported an error
+    SvcIpcUnknownCommand = 2,   // No handler registered for this command
+    SvcIpcMalformed = 3         // Request couldn't be parsed
+};
+
+/*!
+ * \brief Control pipe name
+ * \param svcName Service name
+ * \return Name of the control pipe of the given service
+ */
+std::string SvcIpcPipeName(const char* svcName);
+
+/*!
+ * \brief Register builtin control commands
+ * \details Registers the commands handled by the wrapper itself: `ping`
+ * (echoes the payload), `stats` (service status as key=value lines),
+ * `timers` (timer jobs and their runtimes, one per line), `threads`
+ * (registered threads of the process and their CPU usage, one per line) and
+ * `loglevel` (sets the least severe level forwarded to the log callback,
+ * payload is the level name).
+ */
+void SvcIpcRegisterBuiltins();
+
+/*!
+ * \brief Control pipe server
+ * \details Serves the control pipe of a service in a separate thread. Clients
+ * are served one after another. All buffers are allocated along with the
+ * server, so processing requests doesn't allocate memory apart from what the
+ * command handlers do.
+ */
+class SvcIpcServer
+{
+public:
+    explicit SvcIpcServer(const std::string& pipeName);
+    ~SvcIpcServer();
+
+    /*!
+     * \brief Start server thread
+     * \return true on success
+     */
+    bool start();
+
+    /*!
+     * \brief Stop server thread
+     * \details Disconnects the current client and waits for the thread.
+     */
+    void stop();
+
+private:
+    static DWORD WINAPI threadMain(LPVOID param);
+    void run();
+
+    // Serve a connected client until it disconnects or server stops
+    void serve(HANDLE hPipe);
+
+    // Wait for overlapped I/O, returns false on error or stop request
+    bool waitIo(HANDLE hPipe, BOOL started, DWORD* bytes);
+
+    // Process request, writes response frame to out and returns it's size
+    uint32_t process(const char* req, uint32_t len, char* out);
+
+private:
+    // Buffer sizes, leaving room for several frames
+    static constexpr uint32_t InBufferSize = 2 * SvcIpcMaxFrame;
+    static constexpr uint32_t OutBufferSize = 4 * SvcIpcMaxFrame;
+
+    std::string m_pipeName;
+    HANDLE m_hThread {NULL};
+    HANDLE m_stopEvent {NULL};
+    OVERLAPPED m_ov;
+
+    char m_in[InBufferSize];
+    char m_out[OutBufferSize];
+};
+
+/*!
+ * \brief Control pipe client
+ * \details Connects to the control pipe of a service and sends requests.
+ * Requests can be queued and sent in one batch, their responses are received
+ * one by one afterwards.
+ */
+class SvcIpcClient
+{
+public:
+    SvcIpcClient() = default;
+    ~SvcIpcClient();
+
+    /*!
+     * \brief Connect to control pipe
+     * \param pipeName Control pipe name
+     * \param timeout Time to wait for the pipe to become available [ms]
+     * \return true on success
+     */
+    bool connect(const std::string& pipeName, DWORD timeout);
+
+    /*!
+     * \brief Queue request
+     * \param command Command name (max. 255 chars)
+     * \param payload Request payload
+     * \param len Payload size (max. SvcIpcMaxPayload)
+     * \return Request id
+     */
+    uint32_t queue(const char* command, const char* payload, size_t len);
+
+    /*!
+     * \brief Send queued requests
+     * \return true on success
+     */
+    bool flush();
+
+    /*!
+     * \brief Receive next response
+     * \param id Receives request id of the response
+     * \param status Receives response status
+     * \param payload Receives response payload
+     * \return true on success, false if the connection broke
+     */
+    bool receive(uint32_t* id, SvcIpcStatus* status, std::string* payload);
+
+    /*!
+     * \brief Size of queued requests not sent yet
+     */
+    size_t queued() const { return m_out.size(); }
+
+private:
+    HANDLE m_hPipe {INVALID_HANDLE_VALUE};
+    uint32_t m_nextId {1};
+    std::string m_out;
+    std::string m_in;
+};
+
+#endif // SVCIPC_H
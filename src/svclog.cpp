@@ -0,0 +1,165 @@
+// Log path of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcwrapper_impl.h"
+#include "svcalloccheck.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SVC_CALL_SITE() _ReturnAddress()
+#else
+#define SVC_CALL_SITE() __builtin_return_address(0)
+#endif
+
+using namespace std;
+
+// Forward message to the log callback, bypassing suppression
+static void SvcLogEmit(SvcLogLevel level, const char* msg)
+{
+    if (level > hSvc->logLevel.load(memory_order_relaxed))
+        return;
+    // Forward to log handler callback, which is free to allocate
+    if (hSvc->callbacks.log) {
+        SvcAllowAllocScope allowAlloc;
+        hSvc->callbacks.log(hSvc->callbacks.context, level, msg);
+        return;
+    }
+    // Fallback to stderr for critical messages
+    if (level == Critical) {
+        fputs(msg, stderr);
+        fputc('\n', stderr);
+    }
+}
+
+// Common path of SvcLog() and SvcLogMessage()
+static void SvcLogFrom(const void* site, SvcLogLevel level, const char* msg)
+{
+    if (!hSvc || level > hSvc->logLevel.load(memory_order_relaxed))
+        return;
+    if (hSvc->logFilter && !SvcLogFilter(site, level, msg))
+        return;
+    SvcLogEmit(level, msg);
+}
+
+void SvcLog(SvcLogLevel level, const char* msg)
+{
+    SvcLogFrom(SVC_CALL_SITE(), level, msg);
+}
+
+void SvcLogMessage(SvcLogLevel level, const char* msg)
+{
+    SvcAppService();
+    SvcLogFrom(SVC_CALL_SITE(), level, msg);
+}
+
+// FNV-1a hash of a message, the level is kept in the lowest two bits
+static ULONGLONG MessageHash(SvcLogLevel level, const char* msg)
+{
+    ULONGLONG hash = 14695981039346656037ULL;
+    for (; *msg; ++msg)
+        hash = (hash ^ static_cast<unsigned char>(*msg)) * 1099511628211ULL;
+    return (hash & ~3ULL) | level;
+}
+
+// Take a token from the call site's bucket
+static bool SvcLogAdmit(const void* site, SvcLogLevel level, const char* msg)
+{
+    /* Token bucket as generic cell rate algorithm
+     *
+     * Instead of tokens, each bucket keeps the theoretical arrival time [us]
+     * of the next message, which advances by one interval per message. A
+     * message is admitted unless it arrives more than a burst ahead of time,
+     * so a single compare and swap updates the bucket.
+     */
+    ULONGLONG key = reinterpret_cast<uintptr_t>(site) * 0x9E3779B97F4A7C15ULL;
+    SvcLogSite& bucket = hSvc->logSites[(key >> 32) % SvcLogSites];
+    ULONGLONG interval = max(1000000ULL / hSvc->cfg->logRateLimit, 1ULL);
+    ULONGLONG tolerance = 1000000ULL - min(interval, 1000000ULL);
+    ULONGLONG now = GetTickCount64() * 1000;
+    ULONGLONG tat = bucket.tat.load(memory_order_relaxed);
+    ULONGLONG next;
+    do {
+        ULONGLONG start = max(tat, now);
+        if (start - now > tolerance) {
+            // The first message suppressed since the last summary is kept
+            hSvc->logRateLimited.fetch_add(1, memory_order_relaxed);
+            if (bucket.suppressed.fetch_add(1, memory_order_acq_rel) == 0) {
+                bucket.level = level;
+                strncpy(bucket.text, msg, sizeof(bucket.text) - 1);
+                bucket.ready.store(true, memory_order_release);
+            }
+            return false;
+        }
+        next = start + interval;
+    } while (!bucket.tat.compare_exchange_weak(tat, next, memory_order_relaxed));
+    return true;
+}
+
+bool SvcLogFilter(const void* site, SvcLogLevel level, const char* msg)
+{
+    const SvcWrapperSettings* cfg = hSvc->cfg;
+    if (level == Critical)
+        return true;
+
+    // Pass every n-th Info and Debug message
+    unsigned int sample = level == Info ? cfg->logSampleInfo
+                                        : level == Debug ? cfg->logSampleDebug : 1;
+    if (sample > 1 &&
+            hSvc->logSampleCount[level].fetch_add(1, memory_order_relaxed) % sample != 0) {
+        hSvc->logSampled.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    // Collapse repeats of the previous message, summarize them once it changed
+    if (cfg->logDeduplicate) {
+        ULONGLONG hash = MessageHash(level, msg);
+        if (hSvc->logLastHash.load(memory_order_relaxed) == hash) {
+            hSvc->logRepeats.fetch_add(1, memory_order_relaxed);
+            hSvc->logDeduplicated.fetch_add(1, memory_order_relaxed);
+            return false;
+        }
+        ULONGLONG last = hSvc->logLastHash.exchange(hash, memory_order_relaxed);
+        ULONGLONG repeats = hSvc->logRepeats.exchange(0, memory_order_relaxed);
+        if (repeats) {
+            char summary[60];
+            snprintf(summary, sizeof(summary), "Last message repeated %llu times", repeats);
+            SvcLogEmit(static_cast<SvcLogLevel>(last & 3), summary);
+        }
+    }
+
+    return !cfg->logRateLimit || SvcLogAdmit(site, level, msg);
+}
+
+void SvcLogFlush()
+{
+    if (!hSvc->logFilter)
+        return;
+    char msg[160];
+
+    // Message still repeating
+    ULONGLONG repeats = hSvc->logRepeats.exchange(0, memory_order_relaxed);
+    if (repeats) {
+        ULONGLONG last = hSvc->logLastHash.load(memory_order_relaxed);
+        snprintf(msg, sizeof(msg), "Last message repeated %llu times", repeats);
+        SvcLogEmit(static_cast<SvcLogLevel>(last & 3), msg);
+    }
+
+    // Rate limited call sites. The text isn't written again until the count
+    // has been reset, a site suppressing meanwhile is summarized next time.
+    for (size_t i = 0; hSvc->logSites && i < SvcLogSites; ++i) {
+        SvcLogSite& bucket = hSvc->logSites[i];
+        if (!bucket.ready.load(memory_order_acquire))
+            continue;
+        SvcLogLevel level = bucket.level;
+        char text[sizeof(bucket.text)];
+        memcpy(text, bucket.text, sizeof(text));
+        bucket.ready.store(false, memory_order_relaxed);
+        ULONGLONG suppressed = bucket.suppressed.exchange(0, memory_order_acq_rel);
+        snprintf(msg, sizeof(msg), "Rate limit suppressed %llu messages like: %s",
+                 suppressed, text);
+        SvcLogEmit(level, msg);
+    }
+}
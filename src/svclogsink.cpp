@@ -0,0 +1,329 @@
+// File log sink of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "SvcWrapper/svclogsink.h"
+
+#include <windows.h>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <string>
+
+using namespace std;
+
+// Maximum length of a line's timestamp and level prefix
+static constexpr size_t PrefixSize = 40;
+
+// Flight recorder file header, the ring buffer data follows it
+struct FlightHeader {
+    char magic[8];
+    atomic<ULONGLONG> written;
+    ULONGLONG size;
+    char reserved[40];
+};
+static_assert(sizeof(FlightHeader) == 64, "Flight recorder header size changed!");
+
+struct SvcFileLogSink::Impl {
+    string path;
+    Options opt;
+
+    // Lock held shared while writing and exclusive while rotating
+    SRWLOCK lock = SRWLOCK_INIT;
+    ULONGLONG generation {0};
+
+    // Current log file
+    HANDLE hFile {INVALID_HANDLE_VALUE};
+    HANDLE hMapping {NULL};
+    char* view {nullptr};
+    atomic<size_t> offset {0};
+    ULONGLONG rotateTick {0};
+
+    // Flight recorder
+    HANDLE hFlightFile {INVALID_HANDLE_VALUE};
+    HANDLE hFlightMapping {NULL};
+    FlightHeader* flight {nullptr};
+    char* flightData {nullptr};
+
+    bool openLog();
+    void closeLog();
+    bool rotate(ULONGLONG seenGeneration);
+    void shiftFiles(const string& base, unsigned int keep);
+    bool openFlightRecorder();
+    void closeFlightRecorder();
+    void record(const char* prefix, size_t prefixLen, const char* msg, size_t msgLen);
+};
+
+// Map file of given size, returns view or nullptr
+static char* MapFile(HANDLE hFile, size_t size, HANDLE* hMapping)
+{
+    ULONGLONG size64 = size;
+    *hMapping = CreateFileMapping(hFile, NULL, PAGE_READWRITE,
+                                  static_cast<DWORD>(size64 >> 32),
+                                  static_cast<DWORD>(size64), NULL);
+    if (*hMapping == NULL)
+        return nullptr;
+    char* view = static_cast<char*>(MapViewOfFile(*hMapping, FILE_MAP_WRITE, 0, 0, size));
+    if (!view) {
+        CloseHandle(*hMapping);
+        *hMapping = NULL;
+    }
+    return view;
+}
+
+// Write two digit decimal number
+static inline char* Put2(char* p, unsigned int v)
+{
+    p[0] = static_cast<char>('0' + v / 10 % 10);
+    p[1] = static_cast<char>('0' + v % 10);
+    return p + 2;
+}
+
+// Format "YYYY-MM-DD hh:mm:ss.mmm [Level] " prefix, returns it's length
+static size_t FormatPrefix(char* p, SvcLogLevel level)
+{
+    static const char* const levelNames[] = {"[Critical] ", "[Warning] ",
+                                             "[Info] ", "[Debug] "};
+    SYSTEMTIME st;
+    GetSystemTime(&st);
+    char* s = p;
+    s = Put2(s, st.wYear / 100);
+    s = Put2(s, st.wYear % 100);
+    *s++ = '-';
+    s = Put2(s, st.wMonth);
+    *s++ = '-';
+    s = Put2(s, st.wDay);
+    *s++ = ' ';
+    s = Put2(s, st.wHour);
+    *s++ = ':';
+    s = Put2(s, st.wMinute);
+    *s++ = ':';
+    s = Put2(s, st.wSecond);
+    *s++ = '.';
+    *s++ = static_cast<char>('0' + st.wMilliseconds / 100);
+    s = Put2(s, st.wMilliseconds % 100);
+    *s++ = ' ';
+    const char* name = levelNames[level <= Debug ? level : Debug];
+    size_t nameLen = strlen(name);
+    memcpy(s, name, nameLen);
+    return static_cast<size_t>(s - p) + nameLen;
+}
+
+SvcFileLogSink::SvcFileLogSink(const char* path)
+    : SvcFileLogSink(path, Options())
+{
+}
+
+SvcFileLogSink::SvcFileLogSink(const char* path, const Options& options)
+    : d(new Impl)
+{
+    d->path = path;
+    d->opt = options;
+    if (d->opt.maxFileSize < 4096)
+        d->opt.maxFileSize = 4096;
+    if (d->opt.flightRecorderSize && d->opt.flightRecorderSize < 4096)
+        d->opt.flightRecorderSize = 4096;
+
+    // Start with fresh files, keeping the ones of the previous run
+    d->shiftFiles(d->path, d->opt.keepFiles);
+    d->openLog();
+    if (d->opt.flightRecorderSize) {
+        d->shiftFiles(d->path + ".flight", 1);
+        d->openFlightRecorder();
+    }
+}
+
+SvcFileLogSink::~SvcFileLogSink()
+{
+    d->closeLog();
+    d->closeFlightRecorder();
+    delete d;
+}
+
+bool SvcFileLogSink::isOpen() const
+{
+    return d->view != nullptr;
+}
+
+void SvcFileLogSink::operator()(SvcLogLevel level, const char* msg)
+{
+    char prefix[PrefixSize];
+    size_t prefixLen = FormatPrefix(prefix, level);
+    size_t msgLen = strlen(msg);
+
+    // Flight recorder takes everything
+    if (d->flight)
+        d->record(prefix, prefixLen, msg, msgLen);
+    if (level > d->opt.fileLevel)
+        return;
+
+    // Cut lines that would never fit into a file
+    size_t maxMsgLen = d->opt.maxFileSize - prefixLen - 1;
+    if (msgLen > maxMsgLen)
+        msgLen = maxMsgLen;
+    size_t len = prefixLen + msgLen + 1;
+
+    for (;;) {
+        AcquireSRWLockShared(&d->lock);
+        if (!d->view) {
+            // Failed to open file, drop message
+            ReleaseSRWLockShared(&d->lock);
+            return;
+        }
+        if (!d->rotateTick || GetTickCount64() < d->rotateTick) {
+            // Reserve space and copy line
+            size_t off = d->offset.fetch_add(len, memory_order_relaxed);
+            if (off + len <= d->opt.maxFileSize) {
+                char* p = d->view + off;
+                memcpy(p, prefix, prefixLen);
+                memcpy(p + prefixLen, msg, msgLen);
+                p[len - 1] = '\n';
+                ReleaseSRWLockShared(&d->lock);
+                return;
+            }
+        }
+
+        // File is full or too old, rotate and try again
+        ULONGLONG generation = d->generation;
+        ReleaseSRWLockShared(&d->lock);
+        if (!d->rotate(generation))
+            return;
+    }
+}
+
+void SvcFileLogSink::flush()
+{
+    AcquireSRWLockShared(&d->lock);
+    if (d->view)
+        FlushViewOfFile(d->view, 0);
+    ReleaseSRWLockShared(&d->lock);
+    if (d->flight)
+        FlushViewOfFile(d->flight, 0);
+}
+
+bool SvcFileLogSink::Impl::openLog()
+{
+    hFile = CreateFile(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, CREATE_ALWAYS,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    view = MapFile(hFile, opt.maxFileSize, &hMapping);
+    if (!view) {
+        CloseHandle(hFile);
+        hFile = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    offset.store(0, memory_order_relaxed);
+    rotateTick = opt.maxFileAge ? GetTickCount64() + opt.maxFileAge * 1000ULL : 0;
+    return true;
+}
+
+void SvcFileLogSink::Impl::closeLog()
+{
+    if (!view)
+        return;
+
+    // Determine end of written data, skipping unused reservations
+    size_t used = min(offset.load(memory_order_relaxed), opt.maxFileSize);
+    while (used && view[used - 1] == '\0')
+        --used;
+
+    // Cut preallocated tail off
+    UnmapViewOfFile(view);
+    CloseHandle(hMapping);
+    view = nullptr;
+    hMapping = NULL;
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(used);
+    if (SetFilePointerEx(hFile, end, NULL, FILE_BEGIN))
+        SetEndOfFile(hFile);
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+}
+
+bool SvcFileLogSink::Impl::rotate(ULONGLONG seenGeneration)
+{
+    AcquireSRWLockExclusive(&lock);
+    if (generation != seenGeneration) {
+        // Someone else rotated meanwhile
+        ReleaseSRWLockExclusive(&lock);
+        return true;
+    }
+    closeLog();
+    shiftFiles(path, opt.keepFiles);
+    bool ok = openLog();
+    ++generation;
+    ReleaseSRWLockExclusive(&lock);
+    return ok;
+}
+
+void SvcFileLogSink::Impl::shiftFiles(const string& base, unsigned int keep)
+{
+    if (!keep) {
+        DeleteFile(base.c_str());
+        return;
+    }
+    for (unsigned int i = keep - 1; i > 0; --i) {
+        MoveFileEx((base + "." + to_string(i)).c_str(),
+                   (base + "." + to_string(i + 1)).c_str(),
+                   MOVEFILE_REPLACE_EXISTING);
+    }
+    MoveFileEx(base.c_str(), (base + ".1").c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+bool SvcFileLogSink::Impl::openFlightRecorder()
+{
+    string flightPath = path + ".flight";
+    hFlightFile = CreateFile(flightPath.c_str(), GENERIC_READ | GENERIC_WRITE,
+                             FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+                             CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFlightFile == INVALID_HANDLE_VALUE)
+        return false;
+    char* v = MapFile(hFlightFile, sizeof(FlightHeader) + opt.flightRecorderSize,
+                      &hFlightMapping);
+    if (!v) {
+        CloseHandle(hFlightFile);
+        hFlightFile = INVALID_HANDLE_VALUE;
+        return false;
+    }
+    flight = new (v) FlightHeader;
+    memcpy(flight->magic, "SVCFLT1", 8);
+    flight->written.store(0, memory_order_relaxed);
+    flight->size = opt.flightRecorderSize;
+    flightData = v + sizeof(FlightHeader);
+    return true;
+}
+
+void SvcFileLogSink::Impl::closeFlightRecorder()
+{
+    if (!flight)
+        return;
+    UnmapViewOfFile(flight);
+    CloseHandle(hFlightMapping);
+    CloseHandle(hFlightFile);
+    flight = nullptr;
+}
+
+void SvcFileLogSink::Impl::record(const char* prefix, size_t prefixLen,
+                                  const char* msg, size_t msgLen)
+{
+    size_t size = opt.flightRecorderSize;
+    size_t len = prefixLen + msgLen + 1;
+    if (len > size) {
+        // Keep the end of huge messages only
+        msg += len - size;
+        msgLen -= len - size;
+        len = size;
+    }
+
+    // Reserve space in ring and copy pieces, wrapping around at the end
+    size_t pos = flight->written.fetch_add(len, memory_order_relaxed) % size;
+    auto put = [&](const char* src, size_t n) {
+        size_t first = min(n, size - pos);
+        memcpy(flightData + pos, src, first);
+        memcpy(flightData, src + first, n - first);
+        pos = (pos + n) % size;
+    };
+    put(prefix, prefixLen);
+    put(msg, msgLen);
+    put("\n", 1);
+}
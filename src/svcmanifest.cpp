@@ -0,0 +1,353 @@
+// Service manifest of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcmanifest.h"
+#include "svcscm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+
+// Trim whitespace from both ends
+static string Trim(const string& str)
+{
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == string::npos)
+        return string();
+    size_t last = str.find_last_not_of(" \t\r\n");
+    return str.substr(first, last - first + 1);
+}
+
+// Apply a key/value pair to an entry, returns false for invalid keys/values
+static bool ApplyKey(SvcManifestEntry& entry, const string& key, const string& value)
+{
+    if (key == "binary") {
+        entry.binary = value;
+    } else if (key == "args") {
+        entry.args = value;
+    } else if (key == "displayName") {
+        entry.displayName = value;
+    } else if (key == "description") {
+        entry.description = value;
+    } else if (key == "startType") {
+        if (SvcEqualsNoCase(value, "auto"))
+            entry.startType = SERVICE_AUTO_START;
+        else if (SvcEqualsNoCase(value, "demand"))
+            entry.startType = SERVICE_DEMAND_START;
+        else if (SvcEqualsNoCase(value, "disabled"))
+            entry.startType = SERVICE_DISABLED;
+        else
+            return false;
+    } else if (key == "user") {
+        entry.user = value;
+    } else if (key == "password") {
+        entry.password = value;
+    } else if (key == "dependencies") {
+        entry.dependencies = SvcParseDependencies(value);
+    } else if (key == "ensure") {
+        if (SvcEqualsNoCase(value, "present"))
+            entry.present = true;
+        else if (SvcEqualsNoCase(value, "absent"))
+            entry.present = false;
+        else
+            return false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+string SvcManifestEntry::binaryPath() const
+{
+    string path = "\"" + binary + "\"";
+    if (!args.empty())
+        path.append(" ").append(args);
+    return path;
+}
+
+bool SvcParseManifest(const string& path, const SvcManifestEntry& defaults,
+                      vector<SvcManifestEntry>& entries, string& error)
+{
+    ifstream file(path);
+    if (!file) {
+        error = "Failed to open " + path;
+        return false;
+    }
+
+    // Defaults section may only appear first, keys are applied to it directly
+    SvcManifestEntry common = defaults;
+    SvcManifestEntry* current = nullptr;
+    bool inDefaults = false;
+    string line;
+    for (unsigned int lineNo = 1; getline(file, line); ++lineNo) {
+        line = Trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == ';')
+            continue;
+
+        // Section header
+        if (line.front() == '[') {
+            if (line.back() != ']' || line.size() < 3) {
+                error = "Invalid section header in line " + to_string(lineNo);
+                return false;
+            }
+            string name = Trim(line.substr(1, line.size() - 2));
+            inDefaults = (name == "defaults");
+            if (inDefaults) {
+                if (!entries.empty()) {
+                    error = "[defaults] must precede all services (line " + to_string(lineNo) + ")";
+                    return false;
+                }
+                continue;
+            }
+            auto known = find_if(entries.begin(), entries.end(),
+                                 [&](const SvcManifestEntry& e) { return SvcEqualsNoCase(e.name, name); });
+            if (known != entries.end()) {
+                error = "Duplicate service " + name + " in line " + to_string(lineNo);
+                return false;
+            }
+            entries.push_back(common);
+            current = &entries.back();
+            current->name = name;
+            continue;
+        }
+
+        // Key/value pair
+        size_t sep = line.find('=');
+        if (sep == string::npos || (!current && !inDefaults)) {
+            error = "Syntax error in line " + to_string(lineNo);
+            return false;
+        }
+        string key = Trim(line.substr(0, sep));
+        string value = Trim(line.substr(sep + 1));
+        if (!ApplyKey(inDefaults ? common : *current, key, value)) {
+            error = "Invalid setting " + key + " in line " + to_string(lineNo);
+            return false;
+        }
+    }
+
+    // Display name defaults to the service name
+    for (SvcManifestEntry& entry : entries) {
+        if (entry.displayName.empty())
+            entry.displayName = entry.name;
+    }
+    return true;
+}
+
+string SvcAccountName(const string& user)
+{
+    if (user.empty() || SvcEqualsNoCase(user, "LocalSystem") || SvcEqualsNoCase(user, "System"))
+        return "LocalSystem";
+    if (SvcEqualsNoCase(user, "LocalService"))
+        return R"(NT AUTHORITY\LocalService)";
+    if (SvcEqualsNoCase(user, "NetworkService"))
+        return R"(NT AUTHORITY\NetworkService)";
+    return user;
+}
+
+vector<string> SvcParseDependencies(const string& value)
+{
+    vector<string> dependencies;
+    size_t pos = 0;
+    while (pos <= value.size()) {
+        size_t end = value.find(',', pos);
+        if (end == string::npos)
+            end = value.size();
+        string dep = Trim(value.substr(pos, end - pos));
+        if (!dep.empty())
+            dependencies.push_back(dep);
+        pos = end + 1;
+    }
+    return dependencies;
+}
+
+string SvcDependencyList(const vector<string>& dependencies)
+{
+    string list;
+    for (const string& dep : dependencies)
+        list.append(dep).push_back('\0');
+    if (!list.empty())
+        list.push_back('\0');
+    return list;
+}
+
+// Split double null terminated list
+static vector<string> SplitList(const char* list)
+{
+    vector<string> items;
+    for (const char* p = list; p && *p; p += strlen(p) + 1)
+        items.emplace_back(p);
+    return items;
+}
+
+// Compare dependency lists ignoring order and case
+static bool SameDependencies(vector<string> a, vector<string> b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (const string& dep : a) {
+        auto match = find_if(b.begin(), b.end(),
+                             [&](const string& other) { return SvcEqualsNoCase(dep, other); });
+        if (match == b.end())
+            return false;
+        b.erase(match);
+    }
+    return true;
+}
+
+// Create missing service
+static bool CreateEntry(SC_HANDLE hSCM, const SvcManifestEntry& entry, SvcApplyResult& result)
+{
+    string binPath = entry.binaryPath();
+    string account = SvcAccountName(entry.user);
+    string deps = SvcDependencyList(entry.dependencies);
+    SC_HANDLE hSvc = CreateService(
+                hSCM, entry.name.c_str(), entry.displayName.c_str(),
+                GENERIC_READ | GENERIC_WRITE, SERVICE_WIN32_OWN_PROCESS,
+                entry.startType, SERVICE_ERROR_NORMAL, binPath.c_str(),
+                NULL, NULL, deps.empty() ? NULL : deps.data(), account.c_str(),
+                entry.password.empty() ? NULL : entry.password.c_str());
+    if (hSvc == NULL) {
+        result.error = "CreateService failed (" + to_string(GetLastError()) + ")";
+        return false;
+    }
+    if (!entry.description.empty()) {
+        SERVICE_DESCRIPTION sd;
+        sd.lpDescription = const_cast<char*>(entry.description.c_str());
+        if (!ChangeServiceConfig2(hSvc, SERVICE_CONFIG_DESCRIPTION, &sd))
+            result.error = "Failed to set description (" + to_string(GetLastError()) + ")";
+    }
+    CloseServiceHandle(hSvc);
+    return result.error.empty();
+}
+
+// Stop (if needed) and delete service
+static bool DeleteEntry(SC_HANDLE hSvc, SvcApplyResult& result)
+{
+    SERVICE_STATUS status;
+    ControlService(hSvc, SERVICE_CONTROL_STOP, &status);
+    if (!DeleteService(hSvc) && GetLastError() != ERROR_SERVICE_MARKED_FOR_DELETE) {
+        result.error = "DeleteService failed (" + to_string(GetLastError()) + ")";
+        return false;
+    }
+    return true;
+}
+
+// Compare installed configuration to entry and update it
+static bool UpdateEntry(SC_HANDLE hSvc, const SvcManifestEntry& entry,
+                        bool dryRun, SvcApplyResult& result)
+{
+    // Query current configuration
+    DWORD bytesNeeded = 0;
+    QueryServiceConfig(hSvc, NULL, 0, &bytesNeeded);
+    unique_ptr<BYTE[]> configBuffer(new BYTE[bytesNeeded]);
+    LPQUERY_SERVICE_CONFIG config = reinterpret_cast<LPQUERY_SERVICE_CONFIG>(configBuffer.get());
+    if (!QueryServiceConfig(hSvc, config, bytesNeeded, &bytesNeeded)) {
+        result.error = "QueryServiceConfig failed (" + to_string(GetLastError()) + ")";
+        return false;
+    }
+    string description;
+    bytesNeeded = 0;
+    QueryServiceConfig2(hSvc, SERVICE_CONFIG_DESCRIPTION, NULL, 0, &bytesNeeded);
+    unique_ptr<BYTE[]> descBuffer(new BYTE[max<DWORD>(bytesNeeded, sizeof(SERVICE_DESCRIPTION))]);
+    if (QueryServiceConfig2(hSvc, SERVICE_CONFIG_DESCRIPTION, descBuffer.get(),
+                            bytesNeeded, &bytesNeeded)) {
+        const SERVICE_DESCRIPTION* sd = reinterpret_cast<const SERVICE_DESCRIPTION*>(descBuffer.get());
+        if (sd->lpDescription)
+            description = sd->lpDescription;
+    }
+
+    // Diff settings, NULL means no change
+    string binPath = entry.binaryPath();
+    string account = SvcAccountName(entry.user);
+    string deps = SvcDependencyList(entry.dependencies);
+    const char* newBinPath = NULL;
+    const char* newAccount = NULL;
+    const char* newPassword = NULL;
+    const char* newDisplayName = NULL;
+    const char* newDeps = NULL;
+    DWORD newStartType = SERVICE_NO_CHANGE;
+    if (!SvcEqualsNoCase(binPath, config->lpBinaryPathName ? config->lpBinaryPathName : "")) {
+        result.changes.push_back("binary");
+        newBinPath = binPath.c_str();
+    }
+    if (entry.startType != config->dwStartType) {
+        result.changes.push_back("startType");
+        newStartType = entry.startType;
+    }
+    if (!SvcEqualsNoCase(account, config->lpServiceStartName ? config->lpServiceStartName : "")) {
+        // Password can't be compared, so it's only set along with the user
+        result.changes.push_back("user");
+        newAccount = account.c_str();
+        newPassword = entry.password.c_str();
+    }
+    if (entry.displayName != (config->lpDisplayName ? config->lpDisplayName : "")) {
+        result.changes.push_back("displayName");
+        newDisplayName = entry.displayName.c_str();
+    }
+    if (!SameDependencies(entry.dependencies, SplitList(config->lpDependencies))) {
+        result.changes.push_back("dependencies");
+        // An empty list (two null chars) removes all dependencies
+        newDeps = deps.empty() ? "\0" : deps.data();
+    }
+    bool descriptionChanged = (entry.description != description);
+    if (descriptionChanged)
+        result.changes.push_back("description");
+
+    if (result.changes.empty()) {
+        result.action = "unchanged";
+        return true;
+    }
+    result.action = "change";
+    if (dryRun)
+        return true;
+
+    // Apply changes
+    if ((newBinPath || newAccount || newDisplayName || newDeps || newStartType != SERVICE_NO_CHANGE) &&
+            !ChangeServiceConfig(hSvc, SERVICE_NO_CHANGE, newStartType, SERVICE_NO_CHANGE,
+                                 newBinPath, NULL, NULL, newDeps, newAccount, newPassword,
+                                 newDisplayName)) {
+        result.error = "ChangeServiceConfig failed (" + to_string(GetLastError()) + ")";
+        return false;
+    }
+    if (descriptionChanged) {
+        SERVICE_DESCRIPTION sd;
+        sd.lpDescription = const_cast<char*>(entry.description.c_str());
+        if (!ChangeServiceConfig2(hSvc, SERVICE_CONFIG_DESCRIPTION, &sd)) {
+            result.error = "Failed to set description (" + to_string(GetLastError()) + ")";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SvcApplyManifestEntry(SC_HANDLE hSCM, const SvcManifestEntry& entry,
+                           bool dryRun, SvcApplyResult& result)
+{
+    SC_HANDLE hSvc = OpenService(hSCM, entry.name.c_str(),
+                                 SERVICE_QUERY_CONFIG | SERVICE_CHANGE_CONFIG |
+                                 SERVICE_QUERY_STATUS | SERVICE_STOP | DELETE);
+    if (hSvc == NULL) {
+        if (GetLastError() != ERROR_SERVICE_DOES_NOT_EXIST) {
+            result.error = "OpenService failed (" + to_string(GetLastError()) + ")";
+            return false;
+        }
+        if (!entry.present) {
+            result.action = "unchanged";
+            return true;
+        }
+        result.action = "create";
+        return dryRun || CreateEntry(hSCM, entry, result);
+    }
+
+    bool ok;
+    if (!entry.present) {
+        result.action = "delete";
+        ok = dryRun || DeleteEntry(hSvc, result);
+    } else {
+        ok = UpdateEntry(hSvc, entry, dryRun, result);
+    }
+    CloseServiceHandle(hSvc);
+    return ok;
+}
@@ -0,0 +1,130 @@
+// Service manifest of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCMANIFEST_H
+#define SVCMANIFEST_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+/* Manifest file format
+ *
+ * A manifest is an INI style text file with one section per service, the
+ * section name being the service name. Keys set in the optional [defaults]
+ * section apply to all services, unless a service section overrides them.
+ * Lines starting with '#' or ';' are comments.
+ *
+ *   [defaults]
+ *   binary = C:\Program Files\MyApp\MyAppService.exe
+ *   startType = auto
+ *
+ *   [MyApp1]
+ *   displayName = MyApp instance 1
+ *   args = --port 8001
+ *   dependencies = Tcpip, MyAppBroker
+ *
+ *   [MyAppOld]
+ *   ensure = absent
+ *
+ * Keys:
+ *   binary        Service executable (default: the executable applying it)
+ *   args          Arguments appended to the binary path
+ *   displayName   Display name (default: service name)
+ *   description   Description text
+ *   startType     auto, demand or disabled
+ *   user          LocalService, NetworkService, LocalSystem or account name
+ *   password      Password of a custom account
+ *   dependencies  Comma separated list of services this service depends on
+ *   ensure        present (default) or absent
+ */
+
+/*!
+ * \brief Manifest entry
+ * \details Desired configuration of a single service.
+ */
+struct SvcManifestEntry {
+    std::string name;
+    std::string binary;
+    std::string args;
+    std::string displayName;
+    std::string description;
+    DWORD startType {SERVICE_DEMAND_START};
+    std::string user;
+    std::string password;
+    std::vector<std::string> dependencies;
+    bool present {true};
+
+    /*!
+     * \brief Binary path as stored by the SCM
+     * \return Quoted binary followed by args
+     */
+    std::string binaryPath() const;
+};
+
+/*!
+ * \brief Manifest apply result
+ * \details Result of applying a single manifest entry.
+ */
+struct SvcApplyResult {
+    //! \brief Operation: create, change, delete or unchanged
+    std::string action;
+    //! \brief Names of changed settings
+    std::vector<std::string> changes;
+    //! \brief Error description, if failed
+    std::string error;
+};
+
+/*!
+ * \brief Parse manifest file
+ * \param path Path of the manifest file
+ * \param defaults Default values for all entries
+ * \param entries Receives the parsed entries
+ * \param error Receives a description of the first syntax error
+ * \return true on success
+ */
+bool SvcParseManifest(const std::string& path, const SvcManifestEntry& defaults,
+                      std::vector<SvcManifestEntry>& entries, std::string& error);
+
+/*!
+ * \brief Account name of user setting
+ * \details Translates the well known account aliases of the user setting to
+ * the names used by the SCM.
+ * \param user User setting
+ * \return Account name
+ */
+std::string SvcAccountName(const std::string& user);
+
+/*!
+ * \brief Parse dependencies
+ * \details Splits a comma separated list of service names, as used by the
+ * manifest and SvcWrapperConfig::svcDependencies.
+ * \param value Comma separated list
+ * \return Service names
+ */
+std::vector<std::string> SvcParseDependencies(const std::string& value);
+
+/*!
+ * \brief Build dependency list
+ * \details Converts dependencies to the double null terminated list format
+ * used by the SCM.
+ * \param dependencies Service names
+ * \return Dependency list, empty if there are no dependencies
+ */
+std::string SvcDependencyList(const std::vector<std::string>& dependencies);
+
+/*!
+ * \brief Apply manifest entry
+ * \details Compares the installed configuration of the service to the
+ * entry and creates, changes or deletes the service as needed. Settings that
+ * are already as desired aren't touched, so applying a manifest twice doesn't
+ * change anything the second time. Services to delete are stopped first.
+ * \param hSCM SCM handle with SC_MANAGER_ALL_ACCESS access
+ * \param entry Desired service configuration
+ * \param dryRun Only determine the required operation, don't apply it
+ * \param result Receives the operation and changed settings
+ * \return true on success
+ */
+bool SvcApplyManifestEntry(SC_HANDLE hSCM, const SvcManifestEntry& entry,
+                           bool dryRun, SvcApplyResult& result);
+
+#endif // SVCMANIFEST_H
@@ -0,0 +1,231 @@
+// Output forwarding of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcoutputpump.h"
+#include "svcwrapper_impl.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+SvcOutputPump::SvcOutputPump(HANDLE hRead, HANDLE hFile, SvcLogLevel level,
+                             DWORD ringSize)
+    : m_hRead(hRead), m_hFile(hFile), m_level(level),
+      m_ringSize(hFile == INVALID_HANDLE_VALUE ? ringSize : 0)
+{
+    // Ring buffer and the reader's chunk buffer share one allocation
+    if (m_ringSize) {
+        m_ring = new char[m_ringSize + BufferSize];
+        m_chunk = m_ring + m_ringSize;
+    }
+}
+
+SvcOutputPump::~SvcOutputPump()
+{
+    join();
+    CloseHandle(m_hRead);
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+    delete[] m_ring;
+}
+
+bool SvcOutputPump::start()
+{
+    m_startTick = GetTickCount64();
+    if (m_ringSize) {
+        m_ringEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (m_ringEvent == NULL)
+            return false;
+        m_hDeliveryThread = SvcCreateThread(deliveryMain, this, "output delivery");
+        if (m_hDeliveryThread == NULL)
+            return false;
+    }
+    m_hThread = SvcCreateThread(readerMain, this, "output reader");
+    if (m_hThread == NULL && m_hDeliveryThread != NULL) {
+        // Let delivery thread finish
+        m_readerDone.store(true, memory_order_release);
+        SetEvent(m_ringEvent);
+    }
+    return m_hThread != NULL;
+}
+
+void SvcOutputPump::join()
+{
+    if (m_hThread == NULL && m_hDeliveryThread == NULL)
+        return;
+    if (m_hThread != NULL) {
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+        m_hThread = NULL;
+    }
+    if (m_hDeliveryThread != NULL) {
+        WaitForSingleObject(m_hDeliveryThread, INFINITE);
+        CloseHandle(m_hDeliveryThread);
+        m_hDeliveryThread = NULL;
+    }
+    if (m_ringEvent != NULL) {
+        CloseHandle(m_ringEvent);
+        m_ringEvent = NULL;
+    }
+
+    // Report forwarding throughput
+    ULONGLONG ms = m_endTick - m_startTick;
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Forwarded %llu bytes (%llu lines, %llu bytes "
+             "dropped) of output in %llu ms, %.1f MB/s", m_bytes, m_lines,
+             m_droppedTotal, ms, ms ? m_bytes / 1000.0 / ms : 0.0);
+    SvcLog(Debug, msg);
+}
+
+DWORD SvcOutputPump::readerMain(LPVOID param)
+{
+    SvcOutputPump* pump = static_cast<SvcOutputPump*>(param);
+    if (pump->m_ringSize)
+        pump->readToRing();
+    else
+        pump->read();
+    return ERROR_SUCCESS;
+}
+
+DWORD SvcOutputPump::deliveryMain(LPVOID param)
+{
+    static_cast<SvcOutputPump*>(param)->deliver();
+    return ERROR_SUCCESS;
+}
+
+void SvcOutputPump::read()
+{
+    DWORD fill = 0;
+    DWORD bytesRead = 0;
+    while (ReadFile(m_hRead, m_buffer + fill, BufferSize - fill, &bytesRead, NULL)) {
+        m_bytes += bytesRead;
+
+        // File mode: hand the chunk over as is
+        if (m_hFile != INVALID_HANDLE_VALUE) {
+            DWORD written;
+            WriteFile(m_hFile, m_buffer, bytesRead, &written, NULL);
+            continue;
+        }
+
+        // Log mode: forward complete lines, keep the incomplete tail
+        fill += bytesRead;
+        DWORD used = forwardLines(fill, false);
+        if (!used && fill == BufferSize)
+            used = forwardLines(fill, true); // Line too long, forward in pieces
+        fill -= used;
+        if (fill && used)
+            memmove(m_buffer, m_buffer + used, fill);
+    }
+
+    // Pipe closed (ERROR_BROKEN_PIPE), forward what's left
+    if (fill)
+        forwardLines(fill, true);
+    m_endTick = GetTickCount64();
+}
+
+void SvcOutputPump::readToRing()
+{
+    DWORD bytesRead = 0;
+    while (ReadFile(m_hRead, m_chunk, BufferSize, &bytesRead, NULL)) {
+        m_bytes += bytesRead;
+
+        // Drop chunk if it doesn't fit, rather than blocking the writers
+        ULONGLONG head = m_ringHead.load(memory_order_relaxed);
+        ULONGLONG tail = m_ringTail.load(memory_order_acquire);
+        if (m_ringSize - (head - tail) < bytesRead) {
+            m_dropped.fetch_add(bytesRead, memory_order_relaxed);
+            SetEvent(m_ringEvent);
+            continue;
+        }
+
+        // Copy chunk to ring, wrapping around at it's end
+        DWORD pos = static_cast<DWORD>(head % m_ringSize);
+        DWORD first = min(bytesRead, m_ringSize - pos);
+        memcpy(m_ring + pos, m_chunk, first);
+        memcpy(m_ring, m_chunk + first, bytesRead - first);
+        m_ringHead.store(head + bytesRead, memory_order_release);
+        SetEvent(m_ringEvent);
+    }
+
+    // Pipe closed, let delivery thread finish
+    m_readerDone.store(true, memory_order_release);
+    SetEvent(m_ringEvent);
+}
+
+void SvcOutputPump::deliver()
+{
+    char msg[80];
+    DWORD fill = 0;
+    bool done = false;
+    while (!done) {
+        WaitForSingleObject(m_ringEvent, INFINITE);
+        done = m_readerDone.load(memory_order_acquire);
+
+        // Report output dropped since last wakeup
+        ULONGLONG dropped = m_dropped.exchange(0, memory_order_relaxed);
+        if (dropped) {
+            m_droppedTotal += dropped;
+            snprintf(msg, sizeof(msg), "Dropped %llu bytes of output, "
+                     "log handler is too slow!", dropped);
+            SvcLog(Warning, msg);
+        }
+
+        // Deliver everything available as one batch
+        for (;;) {
+            DWORD fetched = fetchFromRing(fill);
+            if (!fetched)
+                break;
+            fill += fetched;
+            DWORD used = forwardLines(fill, false);
+            if (!used && fill == BufferSize)
+                used = forwardLines(fill, true); // Line too long, forward in pieces
+            fill -= used;
+            if (fill && used)
+                memmove(m_buffer, m_buffer + used, fill);
+        }
+    }
+
+    // Forward what's left
+    if (fill)
+        forwardLines(fill, true);
+    m_endTick = GetTickCount64();
+}
+
+DWORD SvcOutputPump::fetchFromRing(DWORD fill)
+{
+    ULONGLONG tail = m_ringTail.load(memory_order_relaxed);
+    ULONGLONG head = m_ringHead.load(memory_order_acquire);
+    DWORD count = static_cast<DWORD>(min<ULONGLONG>(head - tail, BufferSize - fill));
+    if (!count)
+        return 0;
+    DWORD pos = static_cast<DWORD>(tail % m_ringSize);
+    DWORD first = min(count, m_ringSize - pos);
+    memcpy(m_buffer + fill, m_ring + pos, first);
+    memcpy(m_buffer + fill + first, m_ring, count - first);
+    m_ringTail.store(tail + count, memory_order_release);
+    return count;
+}
+
+DWORD SvcOutputPump::forwardLines(DWORD fill, bool flush)
+{
+    DWORD lineStart = 0;
+    for (DWORD i = 0; i < fill; ++i) {
+        if (m_buffer[i] != '\n')
+            continue;
+        // Terminate line in place, stripping CR of CRLF line endings
+        DWORD lineEnd = (i > lineStart && m_buffer[i - 1] == '\r') ? i - 1 : i;
+        m_buffer[lineEnd] = '\0';
+        SvcLog(m_level, m_buffer + lineStart);
+        ++m_lines;
+        lineStart = i + 1;
+    }
+
+    // Forward incomplete line if requested (buffer full or end of output)
+    if (flush && lineStart < fill) {
+        m_buffer[fill] = '\0';
+        SvcLog(m_level, m_buffer + lineStart);
+        ++m_lines;
+        lineStart = fill;
+    }
+    return lineStart;
+}
@@ -0,0 +1,100 @@
+// Output forwarding of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCOUTPUTPUMP_H
+#define SVCOUTPUTPUMP_H
+
+#include "SvcWrapper/svcwrapper.h"
+#include <windows.h>
+#include <atomic>
+
+/*!
+ * \brief Output pump
+ * \details Reads everything written to a pipe in a separate thread and
+ * forwards it either to a file or, split into lines, to the wrapper's log.
+ * All data passes through buffers allocated along with the pump, so
+ * forwarding doesn't allocate any memory per line or chunk.
+ *
+ * If a ring buffer size is given, reading the pipe and delivering lines to
+ * the log are decoupled by a ring buffer and a second thread. The reader then
+ * never waits for the log callback, so writers to the pipe aren't slowed down
+ * by slow log handlers. If the ring buffer is full, incoming output is
+ * dropped and a warning with the number of dropped bytes is logged as soon as
+ * the delivery thread catches up.
+ */
+class SvcOutputPump
+{
+public:
+    /*!
+     * \brief Construct output pump
+     * \details Takes ownership of both handles, they will be closed when the
+     * pump is destroyed.
+     * \param hRead Read end of the pipe to forward
+     * \param hFile File to append output to, or INVALID_HANDLE_VALUE for
+     * forwarding output to the log
+     * \param level Log level of forwarded lines
+     * \param ringSize Size of the ring buffer decoupling log delivery from
+     * reading, or 0 for delivering lines directly from the reader thread.
+     * Ignored when forwarding to a file.
+     */
+    SvcOutputPump(HANDLE hRead, HANDLE hFile, SvcLogLevel level,
+                  DWORD ringSize = 0);
+    ~SvcOutputPump();
+
+    /*!
+     * \brief Start pump thread(s)
+     * \return true on success, false if a thread couldn't be created
+     */
+    bool start();
+
+    /*!
+     * \brief Wait for pump to finish
+     * \details Blocks until the write end of the pipe has been closed and all
+     * remaining output has been forwarded. Logs the forwarding throughput.
+     */
+    void join();
+
+private:
+    // Thread entries
+    static DWORD WINAPI readerMain(LPVOID param);
+    static DWORD WINAPI deliveryMain(LPVOID param);
+    void read();
+    void readToRing();
+    void deliver();
+
+    // Forward all complete lines in m_buffer, returns number of bytes used
+    DWORD forwardLines(DWORD fill, bool flush);
+
+    // Transfer ring buffer contents to m_buffer
+    DWORD fetchFromRing(DWORD fill);
+
+private:
+    // Size of the line buffer, also the maximum length of a single line
+    static constexpr DWORD BufferSize = 64 * 1024;
+
+    HANDLE m_hRead;
+    HANDLE m_hFile;
+    SvcLogLevel m_level;
+    HANDLE m_hThread {NULL};
+
+    // Ring buffer between reader and delivery thread
+    DWORD m_ringSize;
+    char* m_ring {nullptr};
+    char* m_chunk {nullptr};
+    std::atomic<ULONGLONG> m_ringHead {0};
+    std::atomic<ULONGLONG> m_ringTail {0};
+    std::atomic<ULONGLONG> m_dropped {0};
+    std::atomic<bool> m_readerDone {false};
+    HANDLE m_ringEvent {NULL};
+    HANDLE m_hDeliveryThread {NULL};
+
+    // Statistics
+    ULONGLONG m_bytes {0};
+    ULONGLONG m_lines {0};
+    ULONGLONG m_droppedTotal {0};
+    ULONGLONG m_startTick {0};
+    ULONGLONG m_endTick {0};
+
+    char m_buffer[BufferSize + 1];
+};
+
+#endif // SVCOUTPUTPUMP_H
@@ -0,0 +1,339 @@
+// Startup prewarming of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcprewarm.h"
+#include "svcwrapper_impl.h"
+
+#include <psapi.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// PrefetchVirtualMemory() is resolved at runtime, it needs Windows 8
+struct SvcMemoryRange {
+    PVOID VirtualAddress;
+    SIZE_T NumberOfBytes;
+};
+using PrefetchVirtualMemoryFn = BOOL (WINAPI*)(HANDLE, ULONG_PTR, SvcMemoryRange*, ULONG);
+
+static PrefetchVirtualMemoryFn PrefetchFn()
+{
+    static PrefetchVirtualMemoryFn fn = reinterpret_cast<PrefetchVirtualMemoryFn>(
+        GetProcAddress(GetModuleHandle("kernel32.dll"), "PrefetchVirtualMemory"));
+    return fn;
+}
+
+static SIZE_T PageSize()
+{
+    static SIZE_T pageSize = [] {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return static_cast<SIZE_T>(info.dwPageSize);
+    }();
+    return pageSize;
+}
+
+// Stop warming once the service is asked to stop while starting, it isn't
+// reported running before warming is done
+static bool StopRequested()
+{
+    return hSvc && hSvc->stopDeferred.load(memory_order_relaxed);
+}
+
+// Keep the checkpoint advancing while warming makes progress
+static void Progress()
+{
+    if (hSvc)
+        SvcProgress();
+}
+
+// Modules loaded into the process
+static vector<MODULEINFO> Modules()
+{
+    vector<HMODULE> modules(256);
+    DWORD needed = 0;
+    for (;;) {
+        DWORD size = static_cast<DWORD>(modules.size() * sizeof(HMODULE));
+        if (!EnumProcessModules(GetCurrentProcess(), modules.data(), size, &needed))
+            return {};
+        if (needed <= size)
+            break;
+        modules.resize(needed / sizeof(HMODULE));
+    }
+    modules.resize(needed / sizeof(HMODULE));
+
+    vector<MODULEINFO> infos;
+    for (HMODULE module : modules) {
+        MODULEINFO info;
+        if (GetModuleInformation(GetCurrentProcess(), module, &info, sizeof(info)))
+            infos.push_back(info);
+    }
+    return infos;
+}
+
+// Working set quota is process wide, so services adjust it one at a time
+static mutex workingSetLock;
+
+static bool AdjustWorkingSet(SIZE_T bytes, bool grow)
+{
+    lock_guard<mutex> lock(workingSetLock);
+    SIZE_T minSize, maxSize;
+    if (!GetProcessWorkingSetSize(GetCurrentProcess(), &minSize, &maxSize))
+        return false;
+    if (grow) {
+        minSize += bytes;
+        maxSize += bytes;
+    } else {
+        minSize -= min(bytes, minSize);
+        maxSize -= min(bytes, maxSize);
+    }
+    return SetProcessWorkingSetSize(GetCurrentProcess(), minSize, maxSize) != FALSE;
+}
+
+SvcPrewarm::SvcPrewarm(const char* paths, bool images, bool lock)
+    : m_images(images), m_lock(lock)
+{
+    // Split path list, ignoring surrounding whitespace and empty entries
+    const char* p = paths;
+    while (p && *p) {
+        const char* end = strchr(p, ';');
+        if (!end)
+            end = p + strlen(p);
+        const char* first = p;
+        const char* last = end;
+        while (first < last && isspace(static_cast<unsigned char>(*first)))
+            ++first;
+        while (last > first && isspace(static_cast<unsigned char>(last[-1])))
+            --last;
+        if (first < last)
+            m_paths.emplace_back(first, last);
+        p = *end ? end + 1 : end;
+    }
+}
+
+SvcPrewarm::~SvcPrewarm()
+{
+    for (const Region& region : m_locked) {
+        VirtualUnlock(region.base, region.size);
+        if (region.mapped)
+            UnmapViewOfFile(region.base);
+    }
+    if (m_reserved)
+        AdjustWorkingSet(m_reserved, false);
+}
+
+bool SvcPrewarm::run()
+{
+    ULONGLONG start = GetTickCount64();
+    for (size_t i = 0; i < m_paths.size() && !StopRequested(); ++i)
+        collect(m_paths[i]);
+
+    // Locking needs a working set large enough to hold all locked pages
+    if (m_lock) {
+        SIZE_T total = 0;
+        for (const auto& file : m_fileList)
+            total += static_cast<SIZE_T>(file.second);
+        if (m_images) {
+            for (const MODULEINFO& module : Modules())
+                total += module.SizeOfImage;
+        }
+        if (AdjustWorkingSet(total, true))
+            m_reserved = total;
+        else
+            m_ok = false;
+    }
+
+    // Warm files in parallel, this thread warms images and joins afterwards
+    vector<HANDLE> threads;
+    size_t threadCount = min(MaxThreads, m_fileList.size());
+    for (size_t i = 0; i < threadCount; ++i) {
+        HANDLE hThread = SvcCreateThread(threadMain, this, "prewarm");
+        if (hThread != NULL)
+            threads.push_back(hThread);
+    }
+    if (m_images && !warmImages())
+        m_ok = false;
+    threadMain(this);
+    if (!threads.empty())
+        WaitForMultipleObjects(static_cast<DWORD>(threads.size()), threads.data(),
+                               TRUE, INFINITE);
+    for (HANDLE hThread : threads)
+        CloseHandle(hThread);
+
+    m_elapsed = GetTickCount64() - start;
+    return m_ok;
+}
+
+DWORD SvcPrewarm::threadMain(LPVOID param)
+{
+    SvcPrewarm* self = static_cast<SvcPrewarm*>(param);
+    for (;;) {
+        size_t i = self->m_next.fetch_add(1);
+        if (i >= self->m_fileList.size() || StopRequested())
+            break;
+        if (self->warmFile(self->m_fileList[i].first))
+            ++self->m_files;
+        else
+            self->m_ok = false;
+        Progress();
+    }
+    return 0;
+}
+
+void SvcPrewarm::collect(const string& path)
+{
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes)) {
+        m_ok = false;
+        return;
+    }
+    if (!(attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        ULONGLONG size = (static_cast<ULONGLONG>(attributes.nFileSizeHigh) << 32) |
+                         attributes.nFileSizeLow;
+        m_fileList.emplace_back(path, size);
+        return;
+    }
+
+    // Recurse into directory
+    WIN32_FIND_DATA data;
+    HANDLE hFind = FindFirstFile((path + "\\*").c_str(), &data);
+    if (hFind == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if (!strcmp(data.cFileName, ".") || !strcmp(data.cFileName, ".."))
+            continue;
+        // Junctions and directory symlinks may point back up the tree
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+            (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+            continue;
+        collect(path + "\\" + data.cFileName);
+    } while (!StopRequested() && FindNextFile(hFind, &data));
+    FindClose(hFind);
+}
+
+bool SvcPrewarm::warmFile(const string& path)
+{
+    HANDLE hFile = CreateFile(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    size.QuadPart = -1;
+    if (!GetFileSizeEx(hFile, &size) || size.QuadPart == 0) {
+        // Empty files can't be mapped, but there's nothing to warm anyway
+        CloseHandle(hFile);
+        return size.QuadPart == 0;
+    }
+    HANDLE hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (hMapping == NULL)
+        return false;
+
+    // Map in views, so large files don't exhaust the address space
+    bool ok = true;
+    ULONGLONG fileSize = static_cast<ULONGLONG>(size.QuadPart);
+    for (ULONGLONG offset = 0; offset < fileSize && ok && !StopRequested(); offset += ViewSize) {
+        SIZE_T viewSize = static_cast<SIZE_T>(min(ViewSize, fileSize - offset));
+        void* view = MapViewOfFile(hMapping, FILE_MAP_READ, static_cast<DWORD>(offset >> 32),
+                                   static_cast<DWORD>(offset), viewSize);
+        if (!view) {
+            ok = false;
+            break;
+        }
+        ok = warmRange(view, viewSize, true);
+        if (!m_lock || !ok)
+            UnmapViewOfFile(view);
+    }
+    CloseHandle(hMapping);
+    return ok;
+}
+
+bool SvcPrewarm::warmImages()
+{
+    // Warm committed, readable regions of each image
+    bool ok = true;
+    for (const MODULEINFO& module : Modules()) {
+        if (StopRequested())
+            break;
+        char* p = static_cast<char*>(module.lpBaseOfDll);
+        char* end = p + module.SizeOfImage;
+        MEMORY_BASIC_INFORMATION mbi;
+        while (p < end && VirtualQuery(p, &mbi, sizeof(mbi))) {
+            char* regionEnd = min(end, static_cast<char*>(mbi.BaseAddress) + mbi.RegionSize);
+            const DWORD readable = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY |
+                                   PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE |
+                                   PAGE_EXECUTE_WRITECOPY;
+            if (mbi.State == MEM_COMMIT && (mbi.Protect & readable) &&
+                !(mbi.Protect & PAGE_GUARD)) {
+                if (!warmRange(p, static_cast<SIZE_T>(regionEnd - p), false))
+                    ok = false;
+            }
+            p = regionEnd;
+        }
+        Progress();
+    }
+    return ok;
+}
+
+bool SvcPrewarm::warmRange(void* base, SIZE_T size, bool mapped)
+{
+    // Let the memory manager read the range with large concurrent I/Os...
+    if (PrefetchVirtualMemoryFn prefetch = PrefetchFn()) {
+        SvcMemoryRange range {base, size};
+        prefetch(GetCurrentProcess(), 1, &range, 0);
+    }
+
+    // ...and make sure every page is resident, prefetching is just a hint
+    const volatile char* p = static_cast<const volatile char*>(base);
+    for (SIZE_T offset = 0; offset < size; offset += PageSize())
+        (void) p[offset];
+    m_bytes += size;
+
+    if (!m_lock)
+        return true;
+    if (!VirtualLock(base, size))
+        return false;
+    lock_guard<mutex> lock(m_lockedLock);
+    m_locked.push_back({base, size, mapped});
+    return true;
+}
+
+bool SvcPrewarmStart()
+{
+    const SvcWrapperSettings* cfg = hSvc->cfg;
+    SvcLog(Debug, "Prewarming files and images");
+    SvcPrewarm* prewarm = new SvcPrewarm(cfg->prewarmPaths, cfg->prewarmImages,
+                                         cfg->prewarmLock);
+    bool ok = prewarm->run();
+    hSvc->prewarmBytes = prewarm->bytes();
+    hSvc->prewarmTime = prewarm->elapsed();
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Prewarmed %zu files%s, %llu KiB in %llu ms%s",
+             prewarm->files(), cfg->prewarmImages ? " and images" : "",
+             prewarm->bytes() / 1024, prewarm->elapsed(),
+             cfg->prewarmLock ? ", locked" : "");
+    SvcLog(Info, msg);
+    if (StopRequested())
+        SvcLog(Info, "Prewarming cancelled, stop was requested while starting");
+    else if (!ok)
+        SvcLog(Warning, "Some files or pages couldn't be prewarmed!");
+
+    // Keep locked pages until the service stops
+    if (cfg->prewarmLock)
+        hSvc->prewarm = prewarm;
+    else
+        delete prewarm;
+    return ok;
+}
+
+void SvcPrewarmStop()
+{
+    delete hSvc->prewarm;
+    hSvc->prewarm = nullptr;
+}
+
+const SvcDetail::PrewarmFeature SvcDetail::Prewarm {SvcPrewarmStart, SvcPrewarmStop};
@@ -0,0 +1,120 @@
+// Startup prewarming of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCPREWARM_H
+#define SVCPREWARM_H
+
+#include <windows.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Startup prewarming
+ * \details Faults in the pages of data files and of the process' mapped
+ * images before the service reports readiness, so the first requests don't
+ * pay for lazy page faults. Files are mapped and prefetched with
+ * PrefetchVirtualMemory() (Windows 8 and later) by several threads in
+ * parallel, then every page is touched to make sure it is resident.
+ * Optionally the pages are locked into the working set until the service
+ * stops.
+ */
+class SvcPrewarm
+{
+public:
+    /*!
+     * \param paths Semicolon separated list of files and directories,
+     * directories are warmed recursively without following junctions and
+     * directory symlinks. May be nullptr.
+     * \param images Warm the executable and all loaded libraries
+     * \param lock Lock warmed pages into the working set
+     */
+    SvcPrewarm(const char* paths, bool images, bool lock);
+
+    /*!
+     * \brief Release warmed pages
+     * \details Unlocks and unmaps locked pages and gives back the working set
+     * quota reserved for them.
+     */
+    ~SvcPrewarm();
+
+    /*!
+     * \brief Warm all pages
+     * \details Blocks until all files and images have been warmed. Files that
+     * can't be opened or mapped are skipped.
+     * \return false if any file or range couldn't be warmed or locked
+     */
+    bool run();
+
+    //! \brief Number of bytes warmed
+    ULONGLONG bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+    //! \brief Number of files warmed, not counting images
+    size_t files() const { return m_files.load(std::memory_order_relaxed); }
+
+    //! \brief Time [ms] spent warming
+    ULONGLONG elapsed() const { return m_elapsed; }
+
+private:
+    // Range of memory kept locked until destruction
+    struct Region {
+        void* base;
+        SIZE_T size;
+        bool mapped;
+    };
+
+    static DWORD WINAPI threadMain(LPVOID param);
+
+    // Collect files of a path, recursing into directories
+    void collect(const std::string& path);
+
+    // Warm a file, view by view
+    bool warmFile(const std::string& path);
+
+    // Warm the readable pages of all loaded modules
+    bool warmImages();
+
+    // Prefetch and touch a range, lock it if requested
+    bool warmRange(void* base, SIZE_T size, bool mapped);
+
+private:
+    // Number of threads warming files in parallel
+    static constexpr size_t MaxThreads = 4;
+
+    // Size of the file views mapped at once
+    static constexpr ULONGLONG ViewSize = 64ULL * 1024 * 1024;
+
+    std::vector<std::string> m_paths;
+    std::vector<std::pair<std::string, ULONGLONG>> m_fileList;
+    bool m_images;
+    bool m_lock;
+
+    std::atomic<size_t> m_next {0};
+    std::atomic<ULONGLONG> m_bytes {0};
+    std::atomic<size_t> m_files {0};
+    std::atomic<bool> m_ok {true};
+    ULONGLONG m_elapsed {0};
+
+    // Working set quota [bytes] reserved for locking
+    SIZE_T m_reserved {0};
+
+    std::mutex m_lockedLock;
+    std::vector<Region> m_locked;
+};
+
+/*!
+ * \brief Prewarm the current service
+ * \details Warms the files and images configured for the current thread's
+ * service and logs the result. Blocks until done, the core keeps the service
+ * start pending meanwhile. A stop while starting cancels warming after the
+ * current file view or module.
+ * \return false if anything couldn't be warmed
+ */
+bool SvcPrewarmStart();
+
+/*!
+ * \brief Release the current service's prewarmed pages
+ */
+void SvcPrewarmStop();
+
+#endif // SVCPREWARM_H
@@ -0,0 +1,208 @@
+// Service Control Manager helpers of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcscm.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+using namespace std;
+
+const char* SvcStateName(DWORD state)
+{
+    switch (state) {
+    case SERVICE_STOPPED: return "STOPPED";
+    case SERVICE_START_PENDING: return "START_PENDING";
+    case SERVICE_STOP_PENDING: return "STOP_PENDING";
+    case SERVICE_RUNNING: return "RUNNING";
+    case SERVICE_CONTINUE_PENDING: return "CONTINUE_PENDING";
+    case SERVICE_PAUSE_PENDING: return "PAUSE_PENDING";
+    case SERVICE_PAUSED: return "PAUSED";
+    default: return "UNKNOWN";
+    }
+}
+
+bool SvcWildcardMatch(const char* pattern, const char* str)
+{
+    // Iterative matching with backtracking to the last star
+    const char* star = nullptr;
+    const char* retry = nullptr;
+    while (*str) {
+        if (*pattern == '?' ||
+                tolower(static_cast<unsigned char>(*pattern)) ==
+                tolower(static_cast<unsigned char>(*str))) {
+            ++pattern;
+            ++str;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            retry = str;
+        } else if (star) {
+            pattern = star + 1;
+            str = ++retry;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*')
+        ++pattern;
+    return *pattern == '\0';
+}
+
+bool SvcEqualsNoCase(const string& a, const string& b)
+{
+    return a.size() == b.size() &&
+            equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return tolower(static_cast<unsigned char>(x)) == tolower(static_cast<unsigned char>(y));
+    });
+}
+
+bool SvcIsWildcard(const string& str)
+{
+    return str.find_first_of("*?") != string::npos;
+}
+
+bool SvcEnumServices(SC_HANDLE hSCM, const string& pattern, vector<string>& names)
+{
+    vector<BYTE> buffer;
+    DWORD bytesNeeded = 0;
+    DWORD count = 0;
+    DWORD resume = 0;
+    BOOL done = FALSE;
+    do {
+        // Ask for required buffer size first, then fetch the entries
+        done = EnumServicesStatusEx(hSCM, SC_ENUM_PROCESS_INFO, SERVICE_WIN32,
+                                    SERVICE_STATE_ALL, buffer.data(),
+                                    static_cast<DWORD>(buffer.size()),
+                                    &bytesNeeded, &count, &resume, NULL);
+        if (!done && GetLastError() != ERROR_MORE_DATA)
+            return false;
+        const ENUM_SERVICE_STATUS_PROCESS* services =
+                reinterpret_cast<const ENUM_SERVICE_STATUS_PROCESS*>(buffer.data());
+        for (DWORD i = 0; i < count; ++i) {
+            if (SvcWildcardMatch(pattern.c_str(), services[i].lpServiceName))
+                names.emplace_back(services[i].lpServiceName);
+        }
+        if (!done)
+            buffer.resize(buffer.size() + bytesNeeded);
+    } while (!done);
+    return true;
+}
+
+bool SvcQueryState(SC_HANDLE hSvc, DWORD* state)
+{
+    SERVICE_STATUS_PROCESS status;
+    DWORD bytesNeeded;
+    if (!QueryServiceStatusEx(hSvc, SC_STATUS_PROCESS_INFO,
+                              reinterpret_cast<LPBYTE>(&status),
+                              sizeof(status), &bytesNeeded))
+        return false;
+    *state = status.dwCurrentState;
+    return true;
+}
+
+// Status change notification callback, invoked as APC on the waiting thread
+static void CALLBACK NotifyCallback(LPVOID param)
+{
+    SERVICE_NOTIFY* notify = static_cast<SERVICE_NOTIFY*>(param);
+    *static_cast<bool*>(notify->pContext) = true;
+}
+
+bool SvcWaitForState(SC_HANDLE hSvc, DWORD target, DWORD timeout, DWORD* state)
+{
+    if (!SvcQueryState(hSvc, state))
+        return false;
+    if (*state == target)
+        return true;
+
+    // Get notified when reaching the target state (or failing to start)
+    DWORD mask = (target == SERVICE_RUNNING) ? SERVICE_NOTIFY_RUNNING | SERVICE_NOTIFY_STOPPED :
+                 (target == SERVICE_STOPPED) ? SERVICE_NOTIFY_STOPPED : 0;
+    if (!mask)
+        return false;
+    ULONGLONG deadline = GetTickCount64() + timeout;
+    bool fired = false;
+    SERVICE_NOTIFY notify;
+    ZeroMemory(&notify, sizeof(notify));
+    notify.dwVersion = SERVICE_NOTIFY_STATUS_CHANGE;
+    notify.pfnNotifyCallback = NotifyCallback;
+    notify.pContext = &fired;
+    if (NotifyServiceStatusChange(hSvc, mask, &notify) != ERROR_SUCCESS)
+        return false;
+
+    // Sleep alertable, so the notification callback can be delivered
+    while (!fired) {
+        ULONGLONG now = GetTickCount64();
+        if (now >= deadline) {
+            SvcQueryState(hSvc, state);
+            return false;
+        }
+        SleepEx(static_cast<DWORD>(deadline - now), TRUE);
+    }
+    if (notify.dwNotificationStatus != ERROR_SUCCESS)
+        return false;
+    *state = notify.ServiceStatus.dwCurrentState;
+    return *state == target;
+}
+
+bool SvcQueryDependencies(SC_HANDLE hSCM, const string& name, vector<string>& dependencies)
+{
+    dependencies.clear();
+    SC_HANDLE hSvc = OpenService(hSCM, name.c_str(), SERVICE_QUERY_CONFIG);
+    if (hSvc == NULL)
+        return false;
+    DWORD bytesNeeded = 0;
+    QueryServiceConfig(hSvc, NULL, 0, &bytesNeeded);
+    vector<char> buffer(max<DWORD>(bytesNeeded, sizeof(QUERY_SERVICE_CONFIG)));
+    LPQUERY_SERVICE_CONFIG config = reinterpret_cast<LPQUERY_SERVICE_CONFIG>(buffer.data());
+    bool ok = QueryServiceConfig(hSvc, config, static_cast<DWORD>(buffer.size()), &bytesNeeded);
+    CloseServiceHandle(hSvc);
+    if (!ok)
+        return false;
+
+    // Double null terminated list, groups are prefixed by SC_GROUP_IDENTIFIER
+    for (const char* p = config->lpDependencies; p && *p; p += strlen(p) + 1) {
+        if (*p != SC_GROUP_IDENTIFIER)
+            dependencies.emplace_back(p);
+    }
+    return true;
+}
+
+bool SvcDependencyWaves(const vector<string>& names,
+                        const vector<vector<string>>& dependencies,
+                        vector<size_t>& waves)
+{
+    // Dependencies within the list, as indices
+    size_t count = names.size();
+    vector<vector<size_t>> deps(count);
+    for (size_t i = 0; i < count; ++i) {
+        for (const string& dep : dependencies[i]) {
+            for (size_t j = 0; j < count; ++j) {
+                if (j != i && SvcEqualsNoCase(names[j], dep))
+                    deps[i].push_back(j);
+            }
+        }
+    }
+
+    // Each round places the services whose dependencies all have been placed
+    const size_t Unplaced = static_cast<size_t>(-1);
+    waves.assign(count, Unplaced);
+    size_t placed = 0;
+    for (size_t wave = 0; placed < count; ++wave) {
+        vector<size_t> ready;
+        for (size_t i = 0; i < count; ++i) {
+            if (waves[i] != Unplaced)
+                continue;
+            bool ok = all_of(deps[i].begin(), deps[i].end(), [&](size_t d) {
+                return waves[d] != Unplaced && waves[d] < wave;
+            });
+            if (ok)
+                ready.push_back(i);
+        }
+        if (ready.empty())
+            return false; // Cycle
+        for (size_t i : ready)
+            waves[i] = wave;
+        placed += ready.size();
+    }
+    return true;
+}
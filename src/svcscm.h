@@ -0,0 +1,104 @@
+// Service Control Manager helpers of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCSCM_H
+#define SVCSCM_H
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Service state name
+ * \param state Service state (SERVICE_RUNNING etc.)
+ * \return Printable name of the state, e.g. "RUNNING"
+ */
+const char* SvcStateName(DWORD state);
+
+/*!
+ * \brief Match wildcard pattern
+ * \details Matches a string against a pattern containing `*` (any number of
+ * characters) and `?` (any single character), ignoring case as Windows does
+ * for service names.
+ * \param pattern Wildcard pattern
+ * \param str String to match
+ * \return true if the string matches the pattern
+ */
+bool SvcWildcardMatch(const char* pattern, const char* str);
+
+/*!
+ * \brief Compare strings ignoring case
+ * \param a First string
+ * \param b Second string
+ * \return true if both strings are equal, ignoring case
+ */
+bool SvcEqualsNoCase(const std::string& a, const std::string& b);
+
+/*!
+ * \brief Check for wildcard pattern
+ * \param str String to check
+ * \return true if the string contains wildcard characters
+ */
+bool SvcIsWildcard(const std::string& str);
+
+/*!
+ * \brief Enumerate services
+ * \details Lists the names of all Win32 services matching a pattern.
+ * \param hSCM SCM handle with SC_MANAGER_ENUMERATE_SERVICE access
+ * \param pattern Wildcard pattern
+ * \param names Receives the service names
+ * \return true on success
+ */
+bool SvcEnumServices(SC_HANDLE hSCM, const std::string& pattern,
+                     std::vector<std::string>& names);
+
+/*!
+ * \brief Query service state
+ * \param hSvc Service handle with SERVICE_QUERY_STATUS access
+ * \param state Receives the current state
+ * \return true on success
+ */
+bool SvcQueryState(SC_HANDLE hSvc, DWORD* state);
+
+/*!
+ * \brief Wait for service state
+ * \details Waits for a service to reach the given state using status change
+ * notifications of the SCM, rather than polling it's status. Waiting for
+ * SERVICE_RUNNING fails early if the service stops instead.
+ * \param hSvc Service handle with SERVICE_QUERY_STATUS access
+ * \param target State to wait for
+ * \param timeout Maximum time to wait [ms]
+ * \param state Receives the last known state of the service
+ * \return true if the service reached the target state in time
+ * \note If the wait timed out, the notification is still registered. Close
+ * hSvc before the calling thread does any other alertable wait.
+ */
+bool SvcWaitForState(SC_HANDLE hSvc, DWORD target, DWORD timeout, DWORD* state);
+
+/*!
+ * \brief Query service dependencies
+ * \details Lists the services a service depends on. Dependencies on load
+ * order groups are skipped.
+ * \param hSCM SCM handle with SC_MANAGER_CONNECT access
+ * \param name Service name
+ * \param dependencies Receives the names of the services it depends on
+ * \return true on success
+ */
+bool SvcQueryDependencies(SC_HANDLE hSCM, const std::string& name,
+                          std::vector<std::string>& dependencies);
+
+/*!
+ * \brief Order services by dependencies
+ * \details Assigns a wave number to each service, so that services only
+ * depend on services of earlier waves. Services of the same wave don't depend
+ * on each other and can be started in parallel. Dependencies on services not
+ * in the list are ignored.
+ * \param names Service names
+ * \param dependencies Dependencies of each service
+ * \param waves Receives the wave of each service, starting with 0
+ * \return false if the dependencies are cyclic
+ */
+bool SvcDependencyWaves(const std::vector<std::string>& names,
+                        const std::vector<std::vector<std::string>>& dependencies,
+                        std::vector<size_t>& waves);
+
+#endif // SVCSCM_H
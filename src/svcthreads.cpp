@@ -0,0 +1,169 @@
+// Thread registry of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcthreads.h"
+#include "svcwrapper_impl.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+using namespace std;
+
+// Maximum number of registered threads
+static constexpr size_t MaxThreads = 256;
+
+struct ThreadEntry {
+    DWORD threadId;
+    HANDLE handle;
+    char name[64];
+    char role[32];
+    ULONGLONG cpuTime;  // CPU time at the last sample [100 ns]
+    ULONGLONG cpuDelta; // CPU time used during the last interval [100 ns]
+};
+
+static mutex threadLock;
+static ThreadEntry threads[MaxThreads];
+static size_t threadCount {0};
+
+// Tick count [ms] of the last sample and the interval it covered
+static ULONGLONG sampleTick {0};
+static ULONGLONG sampleTime {0};
+
+// SetThreadDescription() is resolved at runtime, it needs Windows 10 1607
+using SetThreadDescriptionFn = HRESULT (WINAPI*)(HANDLE, PCWSTR);
+
+static SetThreadDescriptionFn SetDescriptionFn()
+{
+    static SetThreadDescriptionFn fn = reinterpret_cast<SetThreadDescriptionFn>(
+        GetProcAddress(GetModuleHandle("kernel32.dll"), "SetThreadDescription"));
+    return fn;
+}
+
+static ULONGLONG ThreadCpuTime(HANDLE handle)
+{
+    FILETIME ftCreation, ftExit, ftKernel, ftUser;
+    if (!GetThreadTimes(handle, &ftCreation, &ftExit, &ftKernel, &ftUser))
+        return 0;
+    ULONGLONG kernel = (static_cast<ULONGLONG>(ftKernel.dwHighDateTime) << 32) |
+                       ftKernel.dwLowDateTime;
+    ULONGLONG user = (static_cast<ULONGLONG>(ftUser.dwHighDateTime) << 32) |
+                     ftUser.dwLowDateTime;
+    return kernel + user;
+}
+
+// Copy string, truncating and replacing whitespace if requested
+static void CopyName(char* dest, size_t size, const char* src, bool noSpaces)
+{
+    size_t len = min(strlen(src), size - 1);
+    for (size_t i = 0; i < len; ++i)
+        dest[i] = noSpaces && isspace(static_cast<unsigned char>(src[i])) ? '_' : src[i];
+    dest[len] = '\0';
+}
+
+bool SvcRegisterThread(const char* name, const char* role)
+{
+    if (!name || !*name)
+        return false;
+
+    // Name the thread for debuggers and profilers as well
+    SetThreadDescriptionFn setDescription = SetDescriptionFn();
+    if (setDescription) {
+        WCHAR wideName[64];
+        int len = MultiByteToWideChar(CP_UTF8, 0, name, -1, wideName, 64);
+        if (len > 0)
+            setDescription(GetCurrentThread(), wideName);
+    }
+
+    lock_guard<mutex> lock(threadLock);
+    DWORD threadId = GetCurrentThreadId();
+    ThreadEntry* entry = nullptr;
+    for (size_t i = 0; i < threadCount && !entry; ++i) {
+        if (threads[i].threadId == threadId)
+            entry = &threads[i];
+    }
+
+    // Thread IDs are reused, an exited thread's entry belongs to a new thread
+    bool reused = entry && WaitForSingleObject(entry->handle, 0) == WAIT_OBJECT_0;
+
+    // New thread, keep a handle to query it's CPU time
+    if (!entry || reused) {
+        HANDLE handle;
+        if ((!entry && threadCount == MaxThreads) ||
+                !DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(),
+                                 &handle, THREAD_QUERY_LIMITED_INFORMATION | SYNCHRONIZE,
+                                 FALSE, 0))
+            return false;
+        if (reused)
+            CloseHandle(entry->handle);
+        else
+            entry = &threads[threadCount++];
+        entry->threadId = threadId;
+        entry->handle = handle;
+        entry->cpuTime = ThreadCpuTime(handle);
+        entry->cpuDelta = 0;
+    }
+    CopyName(entry->name, sizeof(entry->name), name, false);
+    CopyName(entry->role, sizeof(entry->role), role && *role ? role : "-", true);
+    return true;
+}
+
+// Drop entry, the last one takes it's place
+static void DropEntry(size_t index)
+{
+    CloseHandle(threads[index].handle);
+    threads[index] = threads[--threadCount];
+}
+
+void SvcUnregisterThread()
+{
+    lock_guard<mutex> lock(threadLock);
+    DWORD threadId = GetCurrentThreadId();
+    for (size_t i = 0; i < threadCount; ++i) {
+        if (threads[i].threadId == threadId) {
+            DropEntry(i);
+            return;
+        }
+    }
+}
+
+void SvcThreadSample()
+{
+    lock_guard<mutex> lock(threadLock);
+    ULONGLONG now = GetTickCount64();
+    if (now - sampleTick < SvcThreadSampleInterval / 2)
+        return;
+    sampleTime = sampleTick ? now - sampleTick : 0;
+    sampleTick = now;
+
+    for (size_t i = 0; i < threadCount;) {
+        ThreadEntry& entry = threads[i];
+        if (WaitForSingleObject(entry.handle, 0) == WAIT_OBJECT_0) {
+            DropEntry(i);
+            continue;
+        }
+        ULONGLONG cpuTime = ThreadCpuTime(entry.handle);
+        entry.cpuDelta = cpuTime - min(cpuTime, entry.cpuTime);
+        entry.cpuTime = cpuTime;
+        ++i;
+    }
+}
+
+size_t SvcThreadReport(char* buffer, size_t size)
+{
+    lock_guard<mutex> lock(threadLock);
+    size_t len = 0;
+    for (size_t i = 0; i < threadCount && len < size; ++i) {
+        const ThreadEntry& entry = threads[i];
+        // CPU time [100 ns] per interval [ms] in percent of one core
+        double percent = sampleTime ? entry.cpuDelta / (sampleTime * 100.0) : 0;
+        int n = snprintf(buffer + len, size - len,
+                         "tid=%lu role=%s cpu_percent=%.1f cpu_ms=%llu name=%s\n",
+                         entry.threadId, entry.role, percent, entry.cpuTime / 10000,
+                         entry.name);
+        if (n > 0)
+            len = min(size, len + static_cast<size_t>(n));
+    }
+    return len;
+}
@@ -0,0 +1,32 @@
+// Thread registry of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCTHREADS_H
+#define SVCTHREADS_H
+
+#include <cstddef>
+
+// Interval [ms] of sampling the CPU time of registered threads
+static constexpr unsigned int SvcThreadSampleInterval = 2000;
+
+/*!
+ * \brief Sample thread CPU times
+ * \details Queries the CPU time of all registered threads and computes their
+ * usage since the previous sample. Threads that exited without unregistering
+ * are dropped. Runs as timer job of every service, samples taken less than
+ * half an interval apart are skipped, so co-hosted services don't sample the
+ * process twice.
+ */
+void SvcThreadSample();
+
+/*!
+ * \brief Report threads
+ * \details Writes all registered threads of the process and their CPU usage
+ * to the buffer, one line per thread. The name comes last, as it may contain
+ * spaces.
+ * \param buffer Output buffer
+ * \param size Buffer size
+ * \return Number of characters written
+ */
+size_t SvcThreadReport(char* buffer, size_t size);
+
+#endif // SVCTHREADS_H
@@ -0,0 +1,414 @@
+// Timer service of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svctimer.h"
+#include "svcwrapper_impl.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// Histogram bucket of a runtime [us]
+static size_t RuntimeBucket(ULONGLONG us)
+{
+    size_t bucket = 0;
+    while (bucket < SvcTimerStats::Buckets - 1 && us >= (1ULL << bucket))
+        ++bucket;
+    return bucket;
+}
+
+SvcTimerWheel::SvcTimerWheel()
+{
+    for (int32_t& head : m_slots)
+        head = -1;
+    m_base = GetTickCount64();
+}
+
+SvcTimerWheel::~SvcTimerWheel()
+{
+    stop();
+}
+
+bool SvcTimerWheel::start()
+{
+    if (m_hThread != NULL)
+        return true;
+    m_stop = false;
+    m_hThread = SvcCreateThread(threadMain, this, "timer");
+    return m_hThread != NULL;
+}
+
+void SvcTimerWheel::stop()
+{
+    if (m_hThread == NULL)
+        return;
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_one();
+    WaitForSingleObject(m_hThread, INFINITE);
+    CloseHandle(m_hThread);
+    m_hThread = NULL;
+}
+
+SvcTimerId SvcTimerWheel::schedule(const char* name, unsigned int interval, bool periodic,
+                                   const SvcTimerJob& job, GlobalHandles* owner)
+{
+    if (!job)
+        return 0;
+    lock_guard<mutex> lock(m_lock);
+
+    // Reuse a free timer or add one
+    int32_t index;
+    if (!m_free.empty()) {
+        index = m_free.back();
+        m_free.pop_back();
+    } else {
+        if (m_timers.size() >= static_cast<size_t>(INT32_MAX))
+            return 0;
+        index = static_cast<int32_t>(m_timers.size());
+        m_timers.emplace_back();
+        m_timers.back().generation = 0;
+    }
+    Timer& timer = m_timers[index];
+    timer.job = job;
+    snprintf(timer.name, sizeof(timer.name), "%s", name ? name : "");
+    timer.owner = owner;
+    timer.intervalMs = interval;
+    timer.interval = max<ULONGLONG>(1, (interval + Tick - 1) / Tick);
+    timer.periodic = periodic;
+    timer.cancelled = false;
+    timer.stats = SvcTimerStats();
+
+    // Expire at the first tick not before the interval has elapsed
+    ULONGLONG now = GetTickCount64() - m_base;
+    timer.expiry = max(m_tick, (now + interval + Tick - 1) / Tick);
+    link(index);
+
+    // Wake up the thread if it sleeps past the expiry
+    if (timer.expiry < m_wakeTick)
+        m_wake.notify_one();
+    return (static_cast<SvcTimerId>(timer.generation) << 32) | static_cast<uint32_t>(index + 1);
+}
+
+bool SvcTimerWheel::cancel(SvcTimerId id)
+{
+    lock_guard<mutex> lock(m_lock);
+    int32_t index;
+    Timer* timer = find(id, &index);
+    if (!timer)
+        return false;
+    if (timer->state == Scheduled)
+        release(index);
+    else
+        timer->cancelled = true;
+    return true;
+}
+
+void SvcTimerWheel::cancelAll(GlobalHandles* owner)
+{
+    unique_lock<mutex> lock(m_lock);
+    for (size_t i = 0; i < m_timers.size(); ++i) {
+        Timer& timer = m_timers[i];
+        if (timer.state == Free || timer.owner != owner)
+            continue;
+        if (timer.state == Scheduled)
+            release(static_cast<int32_t>(i));
+        else
+            timer.cancelled = true;
+    }
+    if (GetCurrentThreadId() != m_threadId)
+        m_idle.wait(lock, [this, owner] { return m_runningOwner != owner; });
+}
+
+bool SvcTimerWheel::query(SvcTimerId id, SvcTimerStats& stats)
+{
+    lock_guard<mutex> lock(m_lock);
+    Timer* timer = find(id, nullptr);
+    if (!timer)
+        return false;
+    stats = timer->stats;
+    return true;
+}
+
+size_t SvcTimerWheel::report(GlobalHandles* owner, char* buffer, size_t size)
+{
+    lock_guard<mutex> lock(m_lock);
+    size_t len = 0;
+    for (const Timer& timer : m_timers) {
+        if (timer.state == Free || timer.cancelled || timer.owner != owner || len >= size)
+            continue;
+        int n = snprintf(buffer + len, size - len,
+                         "%s interval_ms=%u periodic=%d runs=%llu avg_us=%llu max_us=%llu\n",
+                         timer.name, timer.intervalMs, timer.periodic ? 1 : 0,
+                         timer.stats.runs,
+                         timer.stats.runs ? timer.stats.totalTime / timer.stats.runs : 0,
+                         timer.stats.maxTime);
+        if (n > 0)
+            len = min(size, len + static_cast<size_t>(n));
+    }
+    return len;
+}
+
+DWORD SvcTimerWheel::threadMain(LPVOID param)
+{
+    static_cast<SvcTimerWheel*>(param)->run();
+    return 0;
+}
+
+void SvcTimerWheel::run()
+{
+    m_threadId = GetCurrentThreadId();
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    unique_lock<mutex> lock(m_lock);
+    while (!m_stop) {
+        // Catch up with the time, collecting expired timers
+        ULONGLONG now = (GetTickCount64() - m_base) / Tick;
+        while (m_tick <= now)
+            processTick();
+
+        // Run jobs without holding the lock, so they may start and cancel
+        // timers themselves
+        for (int32_t index : m_expired) {
+            Timer& timer = m_timers[index];
+            if (timer.cancelled) {
+                release(index);
+                continue;
+            }
+            timer.state = Running;
+            m_runningOwner = timer.owner;
+            lock.unlock();
+
+            LARGE_INTEGER begin, end;
+            QueryPerformanceCounter(&begin);
+            hSvc = timer.owner;
+            timer.job();
+            QueryPerformanceCounter(&end);
+
+            lock.lock();
+            m_runningOwner = nullptr;
+            ULONGLONG us = static_cast<ULONGLONG>(end.QuadPart - begin.QuadPart) * 1000000 /
+                           static_cast<ULONGLONG>(frequency.QuadPart);
+            ++timer.stats.runs;
+            timer.stats.totalTime += us;
+            timer.stats.maxTime = max(timer.stats.maxTime, us);
+            ++timer.stats.histogram[RuntimeBucket(us)];
+            if (timer.cancelled || !timer.periodic) {
+                release(index);
+            } else {
+                // Keep the schedule, skipping missed runs
+                timer.expiry += timer.interval;
+                if (timer.expiry < m_tick)
+                    timer.expiry += (m_tick - timer.expiry + timer.interval - 1) /
+                                    timer.interval * timer.interval;
+                link(index);
+            }
+        }
+        bool ranJobs = !m_expired.empty();
+        m_expired.clear();
+        if (ranJobs)
+            m_idle.notify_all();
+
+        // Sleep until the next tick that needs processing
+        m_wakeTick = nextTick();
+        if (m_wakeTick == UINT64_MAX) {
+            m_wake.wait(lock);
+        } else {
+            ULONGLONG due = m_base + m_wakeTick * Tick;
+            ULONGLONG current = GetTickCount64();
+            if (due > current)
+                m_wake.wait_for(lock, chrono::milliseconds(due - current));
+        }
+        m_wakeTick = UINT64_MAX;
+    }
+}
+
+void SvcTimerWheel::processTick()
+{
+    // Cascade the next slot of the upper levels once a level wraps around
+    for (int level = 1; level < Levels; ++level) {
+        if ((m_tick >> ((level - 1) * SlotBits)) & (Slots - 1))
+            break;
+        int slot = level * Slots + ((m_tick >> (level * SlotBits)) & (Slots - 1));
+        int32_t index = m_slots[slot];
+        m_slots[slot] = -1;
+        m_occupied[level] &= ~(1ULL << (slot % Slots));
+        while (index != -1) {
+            int32_t next = m_timers[index].next;
+            m_timers[index].slot = -1;
+            link(index);
+            index = next;
+        }
+    }
+
+    // Collect timers of the current slot
+    int slot = static_cast<int>(m_tick & (Slots - 1));
+    int32_t index = m_slots[slot];
+    m_slots[slot] = -1;
+    m_occupied[0] &= ~(1ULL << slot);
+    while (index != -1) {
+        int32_t next = m_timers[index].next;
+        m_timers[index].slot = -1;
+        m_timers[index].state = Expired;
+        m_expired.push_back(index);
+        index = next;
+    }
+    ++m_tick;
+}
+
+ULONGLONG SvcTimerWheel::nextTick() const
+{
+    // Occupied slot of the lowest level...
+    ULONGLONG next = UINT64_MAX;
+    for (int i = 0; i < Slots && m_occupied[0]; ++i) {
+        if (m_occupied[0] & (1ULL << ((m_tick + i) & (Slots - 1)))) {
+            next = m_tick + i;
+            break;
+        }
+    }
+
+    // ...or the next cascade
+    for (int level = 1; level < Levels; ++level) {
+        if (m_occupied[level])
+            return min(next, (m_tick + Slots - 1) & ~static_cast<ULONGLONG>(Slots - 1));
+    }
+    return next;
+}
+
+void SvcTimerWheel::link(int32_t index)
+{
+    Timer& timer = m_timers[index];
+
+    // Pick the level covering the remaining time, beyond the top level the
+    // timer is parked in the farthest slot and cascaded again later
+    ULONGLONG expiry = max(timer.expiry, m_tick);
+    ULONGLONG delta = expiry - m_tick;
+    int level = 0;
+    while (level < Levels - 1 && delta >= (1ULL << ((level + 1) * SlotBits)))
+        ++level;
+    if (delta >= (1ULL << (Levels * SlotBits)))
+        expiry = m_tick + (1ULL << (Levels * SlotBits)) - 1;
+    int slot = static_cast<int>((expiry >> (level * SlotBits)) & (Slots - 1));
+
+    timer.slot = level * Slots + slot;
+    timer.state = Scheduled;
+    timer.prev = -1;
+    timer.next = m_slots[timer.slot];
+    if (timer.next != -1)
+        m_timers[timer.next].prev = index;
+    m_slots[timer.slot] = index;
+    m_occupied[level] |= 1ULL << slot;
+}
+
+void SvcTimerWheel::unlink(int32_t index)
+{
+    Timer& timer = m_timers[index];
+    if (timer.slot == -1)
+        return;
+    if (timer.prev != -1)
+        m_timers[timer.prev].next = timer.next;
+    else
+        m_slots[timer.slot] = timer.next;
+    if (timer.next != -1)
+        m_timers[timer.next].prev = timer.prev;
+    if (m_slots[timer.slot] == -1)
+        m_occupied[timer.slot / Slots] &= ~(1ULL << (timer.slot % Slots));
+    timer.slot = -1;
+}
+
+void SvcTimerWheel::release(int32_t index)
+{
+    unlink(index);
+    Timer& timer = m_timers[index];
+    timer.job = nullptr;
+    timer.state = Free;
+    ++timer.generation;
+    m_free.push_back(index);
+}
+
+SvcTimerWheel::Timer* SvcTimerWheel::find(SvcTimerId id, int32_t* index)
+{
+    uint32_t i = static_cast<uint32_t>(id);
+    if (i == 0 || i > m_timers.size())
+        return nullptr;
+    Timer& timer = m_timers[i - 1];
+    if (timer.state == Free || timer.cancelled || timer.generation != static_cast<uint32_t>(id >> 32))
+        return nullptr;
+    if (index)
+        *index = static_cast<int32_t>(i - 1);
+    return &timer;
+}
+
+// === Process wide timer service ==============================================
+
+static mutex timerLock;
+static SvcTimerWheel* timerWheel {nullptr};
+static size_t timerUsers {0};
+
+bool SvcTimerAttach()
+{
+    lock_guard<mutex> lock(timerLock);
+    if (!timerWheel) {
+        timerWheel = new SvcTimerWheel;
+        if (!timerWheel->start()) {
+            delete timerWheel;
+            timerWheel = nullptr;
+            return false;
+        }
+    }
+    ++timerUsers;
+    return true;
+}
+
+void SvcTimerDetach()
+{
+    // Jobs may use the timer API, so don't hold the lock while waiting for
+    // them. The wheel stays alive as long as this service uses it.
+    SvcTimerWheel* wheel;
+    {
+        lock_guard<mutex> lock(timerLock);
+        wheel = timerWheel;
+    }
+    if (!wheel)
+        return;
+    wheel->cancelAll(hSvc);
+
+    {
+        lock_guard<mutex> lock(timerLock);
+        if (--timerUsers)
+            return;
+        timerWheel = nullptr;
+    }
+    delete wheel;
+}
+
+size_t SvcTimerReport(char* buffer, size_t size)
+{
+    lock_guard<mutex> lock(timerLock);
+    return timerWheel ? timerWheel->report(hSvc, buffer, size) : 0;
+}
+
+SvcTimerId SvcStartTimer(const char* name, unsigned int interval, bool periodic,
+                         const SvcTimerJob& job)
+{
+    lock_guard<mutex> lock(timerLock);
+    if (!timerWheel || !SvcAppService())
+        return 0;
+    return timerWheel->schedule(name, interval, periodic, job, hSvc);
+}
+
+bool SvcCancelTimer(SvcTimerId id)
+{
+    lock_guard<mutex> lock(timerLock);
+    return timerWheel && timerWheel->cancel(id);
+}
+
+bool SvcQueryTimer(SvcTimerId id, SvcTimerStats& stats)
+{
+    lock_guard<mutex> lock(timerLock);
+    return timerWheel && timerWheel->query(id, stats);
+}
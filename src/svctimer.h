@@ -0,0 +1,198 @@
+// Timer service of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#ifndef SVCTIMER_H
+#define SVCTIMER_H
+
+#include "SvcWrapper/svcwrapper.h"
+#include <windows.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct GlobalHandles;
+
+/*!
+ * \brief Hierarchical timer wheel
+ * \details Runs one-shot and periodic jobs on a single thread. Timers are
+ * kept in 4 levels of 64 slots, each level covering 64 times the range of
+ * the level below at 1/64th of it's resolution. Timers are linked into the
+ * slot of their expiry tick, so scheduling and cancelling is O(1). Once the
+ * lowest level wraps around, the next slot of the level above is cascaded
+ * down. The thread only wakes up for occupied slots of the lowest level and
+ * for cascades, so idle timers don't cost anything.
+ *
+ * Jobs are run late by at most one tick plus the resolution of the system
+ * timer, unless a previous job is still running. Periodic jobs keep their
+ * schedule and skip runs they missed.
+ */
+class SvcTimerWheel
+{
+public:
+    //! \brief Resolution of the wheel [ms]
+    static constexpr ULONGLONG Tick = 10;
+
+    SvcTimerWheel();
+
+    /*!
+     * \brief Destroy timer wheel
+     * \details Stops the timer thread and drops all timers.
+     */
+    ~SvcTimerWheel();
+
+    /*!
+     * \brief Start timer thread
+     * \return true on success
+     */
+    bool start();
+
+    /*!
+     * \brief Stop timer thread
+     * \details Waits for a running job to return, timers stay scheduled.
+     */
+    void stop();
+
+    /*!
+     * \brief Schedule timer
+     * \param name Job name for reporting, truncated to 63 characters
+     * \param interval Time [ms] until the job runs and between runs
+     * \param periodic Run repeatedly until cancelled
+     * \param job Job to run
+     * \param owner Service the job runs for, nullptr for none
+     * \return Timer id, 0 on failure
+     */
+    SvcTimerId schedule(const char* name, unsigned int interval, bool periodic,
+                        const SvcTimerJob& job, GlobalHandles* owner);
+
+    /*!
+     * \brief Cancel timer
+     * \details A job that is running meanwhile isn't run again, but may not
+     * have returned yet.
+     * \param id Timer id
+     * \return true if the timer was scheduled
+     */
+    bool cancel(SvcTimerId id);
+
+    /*!
+     * \brief Cancel all timers of a service
+     * \details Waits for a running job of the service to return, unless
+     * called from the timer thread itself.
+     * \param owner Service
+     */
+    void cancelAll(GlobalHandles* owner);
+
+    /*!
+     * \brief Query timer statistics
+     * \param id Timer id
+     * \param stats Filled with the statistics of the timer
+     * \return true if the timer is scheduled
+     */
+    bool query(SvcTimerId id, SvcTimerStats& stats);
+
+    /*!
+     * \brief Report timers of a service
+     * \details Writes one line per timer of the service to the buffer.
+     * \param owner Service
+     * \param buffer Output buffer
+     * \param size Buffer size
+     * \return Number of characters written
+     */
+    size_t report(GlobalHandles* owner, char* buffer, size_t size);
+
+private:
+    enum State : uint8_t {
+        Free,       // Unused, in the free list
+        Scheduled,  // Linked into the wheel
+        Expired,    // Waiting to be run by the timer thread
+        Running     // Job is running
+    };
+
+    struct Timer {
+        SvcTimerJob job;
+        char name[64];
+        GlobalHandles* owner;
+        ULONGLONG expiry;       // Tick the timer expires at
+        ULONGLONG interval;     // Interval [ticks]
+        unsigned int intervalMs;
+        uint32_t generation;    // Counted up on reuse, part of the id
+        int32_t prev;
+        int32_t next;
+        int32_t slot;           // Index into m_slots while scheduled
+        State state;
+        bool periodic;
+        bool cancelled;
+        SvcTimerStats stats;
+    };
+
+    static constexpr int Levels = 4;
+    static constexpr int SlotBits = 6;
+    static constexpr int Slots = 1 << SlotBits;
+
+    static DWORD WINAPI threadMain(LPVOID param);
+    void run();
+
+    // Process the current tick, collects expired timers
+    void processTick();
+
+    // Next tick that needs processing, UINT64_MAX if there are no timers
+    ULONGLONG nextTick() const;
+
+    // Link timer into the slot of it's expiry, unlink it
+    void link(int32_t index);
+    void unlink(int32_t index);
+    void release(int32_t index);
+
+    // Timer for an id, nullptr if it doesn't exist anymore
+    Timer* find(SvcTimerId id, int32_t* index);
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    HANDLE m_hThread {NULL};
+    DWORD m_threadId {0};
+    bool m_stop {false};
+
+    // Tick count [ms] tick 0 refers to, next tick to process and the tick
+    // the thread sleeps until
+    ULONGLONG m_base {0};
+    ULONGLONG m_tick {0};
+    ULONGLONG m_wakeTick {UINT64_MAX};
+
+    // Timers, deque keeps them in place while their job runs unlocked
+    std::deque<Timer> m_timers;
+    std::vector<int32_t> m_free;
+    std::vector<int32_t> m_expired;
+    GlobalHandles* m_runningOwner {nullptr};
+
+    // Heads of the slot lists and occupied slots by level
+    int32_t m_slots[Levels * Slots];
+    uint64_t m_occupied[Levels] {};
+};
+
+/*!
+ * \brief Attach service to the timer service
+ * \details Starts the process' timer thread with the first service.
+ * \return true on success
+ */
+bool SvcTimerAttach();
+
+/*!
+ * \brief Detach service from the timer service
+ * \details Cancels all timers of the current thread's service and stops the
+ * timer thread with the last service.
+ */
+void SvcTimerDetach();
+
+/*!
+ * \brief Report timers
+ * \details Writes the timers of the current thread's service and their
+ * statistics to the buffer, one line per timer.
+ * \param buffer Output buffer
+ * \param size Buffer size
+ * \return Number of characters written
+ */
+size_t SvcTimerReport(char* buffer, size_t size);
+
+#endif // SVCTIMER_H
@@ -0,0 +1,54 @@
+// In-flight work tracking of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "svcwrapper_impl.h"
+
+using namespace std;
+
+/*
+ * Admission and draining pair up like Dekker's algorithm: a guard counts
+ * itself in before it checks the draining flag, the drain sets the flag
+ * before it sums up the counters. With sequentially consistent ordering,
+ * either the guard sees the flag and backs out, or the drain sees it's count.
+ */
+SvcWorkGuard::SvcWorkGuard()
+{
+    GlobalHandles* svc = SvcAppService();
+    if (!svc)
+        return;
+    SvcWorkShard* shard = &svc->workShards[GetCurrentProcessorNumber() % SvcWorkShards];
+    shard->count.fetch_add(1, memory_order_seq_cst);
+    if (svc->draining.load(memory_order_seq_cst)) {
+        shard->count.fetch_sub(1, memory_order_release);
+        m_admitted = false;
+        return;
+    }
+    m_shard = shard;
+}
+
+SvcWorkGuard::SvcWorkGuard(SvcWorkGuard&& other) noexcept
+    : m_shard(other.m_shard), m_admitted(other.m_admitted)
+{
+    other.m_shard = nullptr;
+}
+
+SvcWorkGuard::~SvcWorkGuard()
+{
+    if (m_shard)
+        m_shard->count.fetch_sub(1, memory_order_release);
+}
+
+LONGLONG SvcWorkCount(const GlobalHandles* svc)
+{
+    LONGLONG count = 0;
+    for (const SvcWorkShard& shard : svc->workShards)
+        count += shard.count.load(memory_order_seq_cst);
+    return count;
+}
+
+size_t SvcWorkInFlight()
+{
+    if (!SvcAppService())
+        return 0;
+    LONGLONG count = SvcWorkCount(hSvc);
+    return count > 0 ? static_cast<size_t>(count) : 0;
+}
@@ -0,0 +1,56 @@
+// Runtime configured front end of the SvcWrapper library.
+// Copyright (c) LASERVORM GmbH 2023
+#include "SvcWrapper/svcwrapper.h"
+#include "SvcWrapper/svcwrapper_static.h"
+
+#include <vector>
+
+using namespace std;
+
+// Callback trampolines, context is the service's SvcWrapperConfig
+static int CallMain(void* context, int argc, char** argv)
+{
+    return static_cast<const SvcWrapperConfig*>(context)->svcCallbackMain(argc, argv);
+}
+
+static void CallStop(void* context)
+{
+    static_cast<const SvcWrapperConfig*>(context)->svcCallbackStop();
+}
+
+static void CallLog(void* context, SvcLogLevel level, const char* msg)
+{
+    static_cast<const SvcWrapperConfig*>(context)->svcLogCallback(level, msg);
+}
+
+int SvcWrapper(int argc, char* argv[], const SvcWrapperConfig &svcConfig)
+{
+    return SvcWrapper(argc, argv, &svcConfig, 1);
+}
+
+int SvcWrapper(int argc, char* argv[], const SvcWrapperConfig* svcConfigs, size_t svcCount)
+{
+    if (!svcConfigs || !svcCount)
+        return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+
+    // Translate configurations, unset callbacks stay unset
+    vector<SvcDetail::Service> services(svcCount);
+    for (size_t i = 0; i < svcCount; ++i) {
+        const SvcWrapperConfig& cfg = svcConfigs[i];
+        services[i].settings = &cfg;
+        services[i].callbacks.main = cfg.svcCallbackMain ? CallMain : nullptr;
+        services[i].callbacks.stop = cfg.svcCallbackStop ? CallStop : nullptr;
+        services[i].callbacks.log = cfg.svcLogCallback ? CallLog : nullptr;
+        services[i].callbacks.context = const_cast<SvcWrapperConfig*>(&cfg);
+    }
+
+    // Runtime configuration may use any subsystem
+    SvcDetail::Features features;
+    features.cli = &SvcDetail::Cli;
+    features.child = &SvcDetail::Child;
+    features.capture = &SvcDetail::Capture;
+    features.controlPipe = &SvcDetail::ControlPipe;
+    features.prewarm = &SvcDetail::Prewarm;
+    features.history = &SvcDetail::History;
+    return SvcDetail::Run(argc, argv, services.data(), svcCount, features);
+}
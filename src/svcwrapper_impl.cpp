@@ -1,32 +1,99 @@
 // Private implementation of the SvcWrapper library.
 // Copyright (c) LASERVORM GmbH 2023
 #include "svcwrapper_impl.h"
-#include "svccli.h"
+#include "svcchild.h"
+#include "svcscm.h"
+#include "svcarena.h"
+#include "svcalloccheck.h"
+#include "svctimer.h"
+#include "svcthreads.h"
 
+#include <psapi.h>
+#include <cstdio>
 #include <cstring>
 #include <cassert>
-#include <iostream>
+#include <new>
+#include <vector>
 
-GlobalHandles *hSvc {nullptr};
+GlobalHandles *hSvcTable {nullptr};
+size_t hSvcCount {0};
+thread_local GlobalHandles *hSvc {hSvcTable};
+void (*SvcAllocStatsHook)(SvcAllocStats& stats) {nullptr};
+SvcScmBackend svcScm {StartServiceCtrlDispatcher, RegisterServiceCtrlHandlerEx,
+                      SetServiceStatus};
+
+// Subsystems linked by the front end
+static SvcDetail::Features svcFeatures;
 
 using namespace std;
 
-static void SvcLog(SvcLogLevel level, const char* msg)
+// Time [ms] a co-hosted service runs before it's footprint is reported
+static constexpr ULONGLONG SharedFootprintSettleTime = 10000;
+
+// Wait hint [ms] reported while waiting for the application to be ready
+static constexpr DWORD StartPendingWaitHint = 5000;
+
+// Wait hint [ms] reported while stopping without shutdown timeout
+static constexpr DWORD StopPendingWaitHint = 30000;
+
+// Interval [ms] of checkpoints reported while start or stop is pending
+static constexpr unsigned int CheckpointInterval = 1000;
+
+// Interval [ms] of checking the work in flight while draining
+static constexpr DWORD DrainPollInterval = 10;
+
+// Interval [ms] of summarizing suppressed log messages
+static constexpr unsigned int LogFlushInterval = 1000;
+
+// Working set [bytes] of the process before any service was started
+static ULONGLONG processWorkingSet {0};
+
+static ULONGLONG FileTimeToUll(const FILETIME& ft)
 {
-    if (!hSvc)
-        return;
-    // Forward to log handler callback
-    if (hSvc->cfg->svcLogCallback) {
-        hSvc->cfg->svcLogCallback(level, msg);
-        return;
-    }
-    // Fallback to stderr for critical messages
-    if (level == Critical)
-        cerr << msg << endl;
+    return (static_cast<ULONGLONG>(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
 }
 
-int SvcWrapperVerifyConfig(const SvcWrapperConfig &svcCfg)
+static ULONGLONG WorkingSetSize()
 {
+    PROCESS_MEMORY_COUNTERS mem;
+    ZeroMemory(&mem, sizeof(mem));
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &mem, sizeof(mem)))
+        return 0;
+    return mem.WorkingSetSize;
+}
+
+// Start parameters of threads created by SvcCreateThread
+struct SvcThreadStart {
+    LPTHREAD_START_ROUTINE startAddress;
+    LPVOID param;
+    GlobalHandles* svc;
+    const char* name;
+};
+
+static DWORD WINAPI SvcThreadMain(LPVOID param)
+{
+    SvcThreadStart start = *static_cast<SvcThreadStart*>(param);
+    delete static_cast<SvcThreadStart*>(param);
+    hSvc = start.svc;
+    SvcRegisterThread(start.name, "wrapper");
+    DWORD result = start.startAddress(start.param);
+    SvcUnregisterThread();
+    return result;
+}
+
+HANDLE SvcCreateThread(LPTHREAD_START_ROUTINE startAddress, LPVOID param, const char* name)
+{
+    SvcThreadStart* start = new SvcThreadStart {startAddress, param, hSvc, name};
+    HANDLE hThread = CreateThread(NULL, 0, SvcThreadMain, start, 0, NULL);
+    if (hThread == NULL)
+        delete start;
+    return hThread;
+}
+
+int SvcWrapperVerifyConfig(const SvcDetail::Service& service)
+{
+    const SvcWrapperSettings& svcCfg = *service.settings;
+
     // Name and DisplayName may not be empty
     if (!svcCfg.svcName || strlen(svcCfg.svcName) > 255 ||
         !svcCfg.svcDisplayName || strlen(svcCfg.svcDisplayName) > 255)
@@ -36,182 +103,799 @@ int SvcWrapperVerifyConfig(const SvcWrapperConfig &svcCfg)
     if (svcCfg.svcDescription != nullptr && strlen(svcCfg.svcDescription) > 255)
         return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
 
-    // Check for required callbacks
-    if (!svcCfg.svcCallbackMain || !svcCfg.svcCallbackStop)
+    // Trigger pipe name is optional, but limited to 256 chars by Windows
+    if (svcCfg.svcTriggerPipe != nullptr &&
+        (!strlen(svcCfg.svcTriggerPipe) || strlen(svcCfg.svcTriggerPipe) > 256))
+        return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+
+    // Check for required callbacks, unless running a child process
+    if (svcCfg.childExecutable != nullptr) {
+        if (!strlen(svcCfg.childExecutable) || !svcFeatures.child || svcCfg.drainTimeout)
+            return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+    } else if (!service.callbacks.main || !service.callbacks.stop) {
+        return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+    }
+
+    // Check for subsystems required by the settings
+    if ((svcCfg.captureOutput && !svcFeatures.capture) ||
+        (svcCfg.controlPipe && !svcFeatures.controlPipe) ||
+        ((svcCfg.prewarmPaths || svcCfg.prewarmImages) && !svcFeatures.prewarm) ||
+        (svcCfg.historyFile && (!strlen(svcCfg.historyFile) || !svcFeatures.history)))
         return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
 
     // Config ok
     return SVCWRAPPER_EXITCODE_OK;
 }
 
-int SvcWrapper(int argc, char* argv[], const SvcWrapperConfig &svcConfig)
+int SvcDetail::Run(int argc, char* argv[], const SvcDetail::Service* services,
+                   size_t count, const SvcDetail::Features& features)
 {
-    assert(hSvc == nullptr);
-    hSvc = new GlobalHandles;
+    assert(hSvcTable == nullptr);
+    if (!services || !count)
+        return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+    svcFeatures = features;
 
-    // Verify supplied SvcWrapper configuration
-    int exitCode = SvcWrapperVerifyConfig(svcConfig);
-    if (exitCode != 0) {
-        SvcLog(Critical, "Invalid service configuration!");
-        return exitCode;
+    // All wrapper state lives in the arena, nothing is allocated later on.
+    // Size it for the services and their rate limiting buckets.
+    size_t arenaSize = sizeof(GlobalHandles) * count + alignof(GlobalHandles);
+    for (size_t i = 0; i < count; ++i) {
+        if (services[i].settings && services[i].settings->logRateLimit)
+            arenaSize += sizeof(SvcLogSite) * SvcLogSites + alignof(SvcLogSite);
     }
+    void* table = nullptr;
+    if (SvcArena::reserve(arenaSize))
+        table = SvcArena::allocate(sizeof(GlobalHandles) * count, alignof(GlobalHandles));
+    if (!table) {
+        // There's no service state to log with yet, use the first callback
+        const char* msg = "Failed to allocate service state!";
+        if (services[0].callbacks.log) {
+            services[0].callbacks.log(services[0].callbacks.context, Critical, msg);
+        } else {
+            fputs(msg, stderr);
+            fputc('\n', stderr);
+        }
+        return SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+    }
+    hSvcTable = static_cast<GlobalHandles*>(table);
+    for (size_t i = 0; i < count; ++i)
+        new (&hSvcTable[i]) GlobalHandles;
+    hSvcCount = count;
+    hSvc = hSvcTable;
 
-    // Store config pointer and startup args
-    hSvc->cfg = &svcConfig;
-    hSvc->argc = argc;
-    hSvc->argv = argv;
+    // Store config pointers and startup args
+    for (size_t i = 0; i < count; ++i) {
+        const SvcWrapperSettings* cfg = services[i].settings;
+        hSvcTable[i].cfg = cfg;
+        hSvcTable[i].callbacks = services[i].callbacks;
+        hSvcTable[i].logLevel.store(cfg->logLevel, memory_order_relaxed);
+        hSvcTable[i].logFilter = cfg->logRateLimit || cfg->logDeduplicate ||
+                                 cfg->logSampleInfo > 1 || cfg->logSampleDebug > 1;
+        hSvcTable[i].argc = argc;
+        hSvcTable[i].argv = argv;
+    }
 
-    // Parse CLI args
-    if (argc > 1) {
-        SvcCli p(argc, argv, svcConfig);
-        return p.run();
+    // Verify supplied SvcWrapper configurations, names must be unique
+    int exitCode = SVCWRAPPER_EXITCODE_OK;
+    for (size_t i = 0; i < count && exitCode == SVCWRAPPER_EXITCODE_OK; ++i) {
+        hSvc = &hSvcTable[i];
+        exitCode = SvcWrapperVerifyConfig(services[i]);
+        for (size_t j = 0; j < i && exitCode == SVCWRAPPER_EXITCODE_OK; ++j) {
+            if (SvcEqualsNoCase(services[i].settings->svcName, services[j].settings->svcName))
+                exitCode = SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+        }
+        if (exitCode != SVCWRAPPER_EXITCODE_OK)
+            SvcLog(Critical, "Invalid service configuration!");
+
+        // Rate limiting buckets
+        if (exitCode == SVCWRAPPER_EXITCODE_OK && services[i].settings->logRateLimit) {
+            void* sites = SvcArena::allocate(sizeof(SvcLogSite) * SvcLogSites,
+                                             alignof(SvcLogSite));
+            if (!sites) {
+                SvcLog(Critical, "Too many services with log rate limiting!");
+                exitCode = SVCWRAPPER_EXITCODE_INVALID_CONFIG;
+                continue;
+            }
+            hSvc->logSites = static_cast<SvcLogSite*>(sites);
+            for (size_t j = 0; j < SvcLogSites; ++j)
+                new (&hSvc->logSites[j]) SvcLogSite;
+        }
+    }
+    hSvc = hSvcTable;
+
+    if (exitCode == SVCWRAPPER_EXITCODE_OK && argc > 1 && svcFeatures.cli) {
+        // Parse CLI args, (un)install all services hosted by this executable
+        vector<const char*> hosted;
+        for (size_t i = 0; i < count && count > 1; ++i)
+            hosted.push_back(services[i].settings->svcName);
+        bool all = !strcmp(argv[1], "install") || !strcmp(argv[1], "uninstall");
+        for (size_t i = 0; i < (all ? count : 1); ++i) {
+            int code = svcFeatures.cli->run(argc, argv, *services[i].settings,
+                                            hosted.data(), hosted.size());
+            if (code != SVCWRAPPER_EXITCODE_OK)
+                exitCode = code;
+        }
+    } else if (exitCode == SVCWRAPPER_EXITCODE_OK) {
+        // Startup services
+        processWorkingSet = WorkingSetSize();
+        exitCode = SvcInit();
     }
 
-    // Startup service
-    exitCode =  SvcInit(svcConfig);
-    delete hSvc;
+    hSvc = nullptr;
+    for (size_t i = 0; i < count; ++i) {
+        if (hSvcTable[i].stopEvent != NULL)
+            CloseHandle(hSvcTable[i].stopEvent);
+        hSvcTable[i].~GlobalHandles();
+    }
+    hSvcTable = nullptr;
+    hSvcCount = 0;
+    SvcArena::reset();
     return exitCode;
 }
 
-int SvcInit(const SvcWrapperConfig &svcCfg)
+SvcHandle SvcCurrentService()
+{
+    return reinterpret_cast<SvcHandle>(SvcAppService());
+}
+
+bool SvcBindThread(SvcHandle service)
+{
+    GlobalHandles* svc = reinterpret_cast<GlobalHandles*>(service);
+    for (size_t i = 0; i < hSvcCount; ++i) {
+        if (svc == &hSvcTable[i]) {
+            hSvc = svc;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SvcTouch()
 {
-    // Define ServiceTable entry for our service
-    const SERVICE_TABLE_ENTRY ServiceTable[] = {
-        // Entry for our service:
-        {
+    if (!SvcAppService())
+        return;
+    ULONGLONG now = GetTickCount64();
+    hSvc->lastActivity.store(now, memory_order_relaxed);
+    // Remember the very first activity for reporting activation latency
+    if (hSvc->firstActivity.load(memory_order_relaxed) == 0) {
+        ULONGLONG none = 0;
+        hSvc->firstActivity.compare_exchange_strong(none, now,
+                                                    memory_order_relaxed);
+    }
+}
+
+int SvcInit()
+{
+    // Define ServiceTable entries for our services
+    vector<SERVICE_TABLE_ENTRY> serviceTable;
+    for (size_t i = 0; i < hSvcCount; ++i) {
+        serviceTable.push_back({
             // Cast away const from service name for sucking Windows API
-            const_cast<LPSTR>(svcCfg.svcName),
+            const_cast<LPSTR>(hSvcTable[i].cfg->svcName),
             // Specify service's main function
-            (LPSERVICE_MAIN_FUNCTION) SvcMain},
-        // End of service table definition
-        {NULL, NULL}
-    };
+            SvcMain});
+    }
+    // End of service table definition
+    serviceTable.push_back({NULL, NULL});
 
     // Pass ServiceTable to service control dispatcher
-    if (!StartServiceCtrlDispatcher(ServiceTable)) {
-        cout << "This application is a Windows Service executable!\n"
-             << "Add help argument for supported CLI commands." << endl;
+    if (!svcScm.startDispatcher(serviceTable.data())) {
+        puts("This application is a Windows Service executable!\n"
+             "Add help argument for supported CLI commands.");
         return SVCWRAPPER_EXITCODE_SVC_CTRL_DISPATCHER_FAILED;
     }
 
     return 0;
 }
 
-void SvcMain()
+// Advance the checkpoint periodically, as long as the pending state is
+// within it's wait hint
+static void SvcCheckpointTimer()
 {
+    if (GetTickCount64() < hSvc->pendingDeadline.load(memory_order_relaxed))
+        SvcCheckpoint();
+}
+
+// Wait hint of STOP_PENDING, the time the application may take to stop
+static DWORD SvcStopWaitHint()
+{
+    return hSvc->cfg->shutdownTimeout ? hSvc->cfg->shutdownTimeout : StopPendingWaitHint;
+}
+
+// Report a failed start, recording it in the run history
+static void SvcStartFailed(DWORD error)
+{
+    hSvc->stopReason = SvcStopStartFailed;
+    hSvc->stopTick = GetTickCount64();
+    if (hSvc->cfg->historyFile)
+        svcFeatures.history->stop(error);
+    SvcSetState(SERVICE_STOPPED, 0, error);
+}
+
+void SvcMain(DWORD argc, LPSTR* argv)
+{
+    // Find the service to start, SCM passes it's name as first argument
+    for (size_t i = 0; i < hSvcCount && argc > 0; ++i) {
+        if (SvcEqualsNoCase(hSvcTable[i].cfg->svcName, argv[0]))
+            hSvc = &hSvcTable[i];
+    }
     assert(hSvc->cfg != nullptr);
 
     // Register service control handler
     SvcLog(Debug, "Registering at service control manager...");
-    hSvc->statusHandle = RegisterServiceCtrlHandler(hSvc->cfg->svcName, SvcCtrlHandler);
+    hSvc->statusHandle = svcScm.registerHandler(hSvc->cfg->svcName,
+                                                SvcCtrlHandler, hSvc);
     if (hSvc->statusHandle == NULL) {
         SvcLog(Critical, "Failed to register service control handler!");
         return;
     }
 
-    // Inform SCM we are starting...
+    // Determine process creation time to measure activation latency
+    hSvc->processStartTick = GetTickCount64();
+    FILETIME ftCreation, ftExit, ftKernel, ftUser, ftNow;
+    if (GetProcessTimes(GetCurrentProcess(), &ftCreation, &ftExit, &ftKernel, &ftUser)) {
+        GetSystemTimeAsFileTime(&ftNow);
+        ULONGLONG age = (FileTimeToUll(ftNow) - FileTimeToUll(ftCreation)) / 10000;
+        hSvc->processStartTick -= min(age, hSvc->processStartTick);
+    }
+    if (hSvcCount > 1)
+        hSvc->sharedWorkingSet = WorkingSetSize();
+
+    // Create stop event to wait on later, before the control handler may
+    // set it while starting
+    DWORD eventError = NO_ERROR;
+    if (hSvc->stopEvent == NULL)
+        hSvc->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (hSvc->stopEvent == NULL)
+        eventError = GetLastError();
+    else
+        ResetEvent(hSvc->stopEvent);
+
+    // Inform SCM we are starting, a co-hosted service may be started again
     SvcLog(Info, "Starting service");
-    ZeroMemory(&hSvc->status, sizeof(hSvc->status));
-    hSvc->status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
-    hSvc->status.dwControlsAccepted = 0; // none
-    hSvc->status.dwCurrentState = SERVICE_START_PENDING;
-    hSvc->status.dwWin32ExitCode = NO_ERROR;
-    hSvc->status.dwServiceSpecificExitCode = NO_ERROR;
-    hSvc->status.dwCheckPoint = 0;
-    if (!SetServiceStatus(hSvc->statusHandle, &hSvc->status)) {
-        SvcLog(Warning, "Failed to set service status!");
+    hSvc->stopRequested.store(false);
+    hSvc->stopDeferred.store(false);
+    hSvc->stopReason = SvcStopNone;
+    hSvc->draining.store(false);
+    hSvc->exitCode = SVCWRAPPER_EXITCODE_OK;
+    hSvc->firstActivity.store(0, memory_order_relaxed);
+    hSvc->activationReported = false;
+    if (hSvc->cfg->childExecutable) {
+        lock_guard<mutex> lock(hSvc->childLock);
+        hSvc->childStopPending = false;
     }
+    SvcSetState(SERVICE_START_PENDING, StartPendingWaitHint);
+
+    // Record the run in the history journal
+    if (hSvc->cfg->historyFile && !svcFeatures.history->start())
+        SvcLog(Warning, "Failed to open run history journal!");
 
-    // Create stop event to wait on later
-    hSvc->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
     if (hSvc->stopEvent == NULL) {
-        hSvc->status.dwControlsAccepted = 0; // none
-        hSvc->status.dwCurrentState = SERVICE_STOPPED;
-        hSvc->status.dwWin32ExitCode = GetLastError();
-        hSvc->status.dwCheckPoint = 1;
-        if (SetServiceStatus(hSvc->statusHandle, &hSvc->status) == FALSE) {
-            SvcLog(Warning, "Failed to set service status!");
-        }
+        SvcStartFailed(eventError);
         return;
     }
 
-    // Inform SCM we are started.
-    hSvc->status.dwControlsAccepted = SERVICE_ACCEPT_STOP;
-    hSvc->status.dwCurrentState = SERVICE_RUNNING;
-    hSvc->status.dwWin32ExitCode = NO_ERROR;
-    hSvc->status.dwCheckPoint = 0;
-    if (SetServiceStatus(hSvc->statusHandle, &hSvc->status) == FALSE) {
-        SvcLog(Warning, "Failed to set service status!");
+    // Tell SCM we're making progress while start or stop is pending
+    if (!SvcTimerAttach()) {
+        DWORD error = GetLastError();
+        SvcLog(Critical, "Failed to start timer thread!");
+        SvcStartFailed(error);
+        return;
+    }
+    SvcStartTimer("checkpoint", CheckpointInterval, true, SvcCheckpointTimer);
+    if (hSvc->logFilter)
+        SvcStartTimer("log", LogFlushInterval, true, SvcLogFlush);
+
+    // Start serving the control pipe, thread CPU usage is only reported there
+    if (hSvc->cfg->controlPipe) {
+        if (!svcFeatures.controlPipe->start())
+            SvcLog(Warning, "Failed to start control pipe server!");
+        SvcStartTimer("threads", SvcThreadSampleInterval, true, SvcThreadSample);
     }
 
-    // Start a thread for running our encapsulated application
+    // Fault in files and images before reporting readiness, a stop while
+    // starting cancels it
+    if (hSvc->cfg->prewarmPaths || hSvc->cfg->prewarmImages) {
+        HANDLE hPrewarmThread = SvcCreateThread(SvcPrewarmThread, NULL, "prewarm");
+        if (hPrewarmThread == NULL) {
+            SvcPrewarmThread(NULL);
+        } else {
+            WaitForSingleObject(hPrewarmThread, INFINITE);
+            CloseHandle(hPrewarmThread);
+        }
+    }
+
+    // Start a thread for running our encapsulated application. A stop
+    // deferred while starting must not reach the application before it's
+    // main callback has been entered, so wait for the thread to get there.
+    if (hSvc->cfg->readyNotify && !hSvc->cfg->childExecutable)
+        hSvc->readyEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
     SvcLog(Debug, "Creating worker thread");
-    HANDLE hWorkerThread = CreateThread(NULL, 0, SvcWorkerThread, NULL, 0, NULL);
+    HANDLE hMainEntered = CreateEvent(NULL, TRUE, FALSE, NULL);
+    HANDLE hWorkerThread = SvcCreateThread(SvcWorkerThread, hMainEntered, "service main");
+    if (hMainEntered != NULL) {
+        if (hWorkerThread != NULL) {
+            HANDLE enteredHandles[] = {hMainEntered, hWorkerThread};
+            WaitForMultipleObjects(2, enteredHandles, FALSE, INFINITE);
+        }
+        CloseHandle(hMainEntered);
+    }
 
-    // Wait for stop event to be set
+    // Inform SCM we are started, unless the application reports readiness
+    if (hSvc->readyEvent == NULL)
+        SvcReportRunning();
+
+    // Wait for the application to be ready, if it reports readiness. A stop
+    // while starting or the application exiting ends the wait as well.
     SvcLog(Info, "Started worker thread");
-    WaitForSingleObject(hSvc->stopEvent, INFINITE);
-    CloseHandle(hSvc->stopEvent);
+    DWORD waitResult = WAIT_OBJECT_0 + 1;
+    DWORD startError = NO_ERROR;
+    if (hSvc->readyEvent != NULL) {
+        HANDLE waitHandles[] = {hSvc->stopEvent, hSvc->readyEvent};
+        DWORD readyTimeout = hSvc->cfg->readyTimeout;
+        SvcSetState(SERVICE_START_PENDING, readyTimeout ? readyTimeout : StartPendingWaitHint);
+        waitResult = WaitForMultipleObjects(2, waitHandles, FALSE,
+                                            readyTimeout ? readyTimeout : INFINITE);
+        if (waitResult == WAIT_OBJECT_0 + 1) {
+            SvcReportRunning();
+        } else if (waitResult == WAIT_TIMEOUT) {
+            SvcLog(Warning, "Application didn't report readiness within ready timeout!");
+            startError = ERROR_SERVICE_START_HANG;
+            SvcRequestStop("Stopping service, start timed out", SvcStopStartFailed);
+        } else if (hSvc->stopDeferred.load()) {
+            SvcRequestStop("Stopping service, stop was requested while starting", SvcStopScm);
+        }
+    }
+
+    // Wait for stop event to be set, checking for idle timeout meanwhile
+    if (waitResult == WAIT_OBJECT_0 + 1) {
+        DWORD pollInterval = 1000;
+        if (hSvc->cfg->idleTimeout)
+            pollInterval = static_cast<DWORD>(min(1000ULL, hSvc->cfg->idleTimeout * 250ULL));
+        SvcStartTimer("housekeeping", pollInterval, true, SvcCheckIdle);
+        if (hSvc->cfg->historyFile)
+            svcFeatures.history->running();
+        WaitForSingleObject(hSvc->stopEvent, INFINITE);
+    }
+
+    // Let the work in flight finish before asking the application to stop,
+    // unless it exited meanwhile
+    if (hSvc->draining.load()) {
+        if (hSvc->cfg->controlPipe && hSvc->cfg->drainControlPipe)
+            svcFeatures.controlPipe->stop();
+        SvcDrain(hWorkerThread);
+        if (WaitForSingleObject(hWorkerThread, 0) == WAIT_TIMEOUT) {
+            SvcLog(Debug, "Executing service stop callback");
+            hSvc->callbacks.stop(hSvc->callbacks.context);
+        }
+        SvcSetState(SERVICE_STOP_PENDING, SvcStopWaitHint());
+    }
 
     // Wait for worker thread to finish
-    WaitForSingleObject(hWorkerThread, hSvc->cfg->shutdownTimeout ?
-                            hSvc->cfg->shutdownTimeout : INFINITE);
+    waitResult = WaitForSingleObject(hWorkerThread, hSvc->cfg->shutdownTimeout ?
+                                               hSvc->cfg->shutdownTimeout : INFINITE);
+    if (waitResult == WAIT_TIMEOUT && hSvc->cfg->childExecutable) {
+        // Child process didn't stop in time, kill it
+        svcFeatures.child->kill();
+        WaitForSingleObject(hWorkerThread, SvcChildKillTimeout);
+    }
     CloseHandle(hWorkerThread);
     SvcLog(Info, "Service thread shutdown complete");
+    SvcLogAllocStats();
 
-    // Tell SCM we stopped
-    hSvc->status.dwControlsAccepted = 0; // none
-    hSvc->status.dwCurrentState = SERVICE_STOPPED;
-    if (hSvc->exitCode != 0) {
-        hSvc->status.dwWin32ExitCode = ERROR_SERVICE_SPECIFIC_ERROR;
-        hSvc->status.dwServiceSpecificExitCode = hSvc->exitCode;
-    } else {
-        hSvc->status.dwWin32ExitCode = NO_ERROR;
+    // Cancel all timers of the service, waiting for running jobs
+    SvcTimerDetach();
+    SvcLogFlush();
+
+    // Stop serving the control pipe and release prewarmed pages
+    if (hSvc->cfg->controlPipe)
+        svcFeatures.controlPipe->stop();
+    if (hSvc->cfg->prewarmPaths || hSvc->cfg->prewarmImages)
+        svcFeatures.prewarm->stop();
+    if (hSvc->readyEvent != NULL) {
+        CloseHandle(hSvc->readyEvent);
+        hSvc->readyEvent = NULL;
+    }
+
+    // Record the end of the run while the process is still alive, then
+    // tell SCM we stopped
+    DWORD win32ExitCode = startError;
+    if (win32ExitCode == NO_ERROR && hSvc->exitCode != 0)
+        win32ExitCode = ERROR_SERVICE_SPECIFIC_ERROR;
+    if (hSvc->cfg->historyFile)
+        svcFeatures.history->stop(win32ExitCode);
+    SvcSetState(SERVICE_STOPPED, 0, win32ExitCode);
+}
+
+DWORD SvcState()
+{
+    return static_cast<DWORD>(hSvc->stateWord.load(memory_order_acquire) & 0xFF);
+}
+
+// Check lifecycle state machine transition
+static bool SvcValidTransition(DWORD from, DWORD to)
+{
+    switch (to) {
+    case SERVICE_START_PENDING:
+        return from == SERVICE_STOPPED || from == SERVICE_START_PENDING;
+    case SERVICE_RUNNING:
+        return from == SERVICE_START_PENDING;
+    case SERVICE_STOP_PENDING:
+        return from == SERVICE_START_PENDING || from == SERVICE_RUNNING ||
+               from == SERVICE_STOP_PENDING;
+    case SERVICE_STOPPED:
+        return from != SERVICE_STOPPED;
+    default:
+        return false;
+    }
+}
+
+bool SvcSetState(DWORD state, DWORD waitHint, DWORD win32ExitCode)
+{
+    SvcNoAllocScope noAlloc("status");
+
+    // Apply transition, pending states count their checkpoint up
+    ULONGLONG word = hSvc->stateWord.load(memory_order_acquire);
+    ULONGLONG next;
+    DWORD from;
+    do {
+        from = static_cast<DWORD>(word & 0xFF);
+        if (!SvcValidTransition(from, state)) {
+            char msg[80];
+            snprintf(msg, sizeof(msg), "Invalid service state transition %s -> %s",
+                     SvcStateName(from), SvcStateName(state));
+            SvcLog(Warning, msg);
+            return false;
+        }
+        ULONGLONG checkPoint = 0;
+        if (state == SERVICE_START_PENDING || state == SERVICE_STOP_PENDING) {
+            checkPoint = (from == state ? ((word >> 8) & 0xFFFFFF) + 1 : 1);
+            hSvc->pendingDeadline.store(GetTickCount64() + waitHint, memory_order_relaxed);
+        }
+        next = (((word >> 32) + 1) << 32) | (checkPoint << 8) | state;
+        hSvc->waitHint.store(waitHint, memory_order_relaxed);
+        hSvc->win32ExitCode.store(win32ExitCode, memory_order_relaxed);
+    } while (!hSvc->stateWord.compare_exchange_weak(word, next, memory_order_acq_rel,
+                                                    memory_order_acquire));
+
+    // Remember when the state was entered
+    if (from != state) {
+        ULONGLONG now = GetTickCount64();
+        ULONGLONG since = hSvc->stateTick[from].load(memory_order_relaxed);
+        hSvc->stateTick[state].store(now, memory_order_relaxed);
+        char msg[100];
+        snprintf(msg, sizeof(msg), "Service state %s -> %s after %llu ms",
+                 SvcStateName(from), SvcStateName(state), since ? now - since : 0);
+        SvcLog(Debug, msg);
     }
-    hSvc->status.dwCheckPoint = 3;
-    if (SetServiceStatus(hSvc->statusHandle, &hSvc->status) == FALSE) {
+    SvcReportStatus();
+    return true;
+}
+
+void SvcCheckpoint()
+{
+    SvcNoAllocScope noAlloc("status");
+    ULONGLONG word = hSvc->stateWord.load(memory_order_acquire);
+    ULONGLONG next;
+    do {
+        DWORD state = static_cast<DWORD>(word & 0xFF);
+        if (state != SERVICE_START_PENDING && state != SERVICE_STOP_PENDING)
+            return;
+        ULONGLONG checkPoint = ((word >> 8) & 0xFFFFFF) + 1;
+        next = (((word >> 32) + 1) << 32) | (checkPoint << 8) | state;
+    } while (!hSvc->stateWord.compare_exchange_weak(word, next, memory_order_acq_rel,
+                                                    memory_order_acquire));
+    SvcReportStatus();
+}
+
+void SvcProgress()
+{
+    ULONGLONG deadline = GetTickCount64() + hSvc->waitHint.load(memory_order_relaxed);
+    hSvc->pendingDeadline.store(deadline, memory_order_relaxed);
+}
+
+// Report state word to the SCM
+static void SvcSetServiceStatus(ULONGLONG word)
+{
+    SERVICE_STATUS status;
+    ZeroMemory(&status, sizeof(status));
+    status.dwServiceType = hSvcCount > 1 ? SERVICE_WIN32_SHARE_PROCESS
+                                         : SERVICE_WIN32_OWN_PROCESS;
+    status.dwCurrentState = static_cast<DWORD>(word & 0xFF);
+    status.dwCheckPoint = static_cast<DWORD>((word >> 8) & 0xFFFFFF);
+    status.dwControlsAccepted = status.dwCurrentState == SERVICE_RUNNING ?
+                                    SERVICE_ACCEPT_STOP : 0;
+    status.dwWaitHint = hSvc->waitHint.load(memory_order_relaxed);
+    status.dwWin32ExitCode = NO_ERROR;
+    status.dwServiceSpecificExitCode = NO_ERROR;
+    if (status.dwCurrentState == SERVICE_STOPPED) {
+        status.dwWin32ExitCode = hSvc->win32ExitCode.load(memory_order_relaxed);
+        if (status.dwWin32ExitCode == ERROR_SERVICE_SPECIFIC_ERROR)
+            status.dwServiceSpecificExitCode = hSvc->exitCode;
+    }
+    if (svcScm.setStatus(hSvc->statusHandle, &status) == FALSE) {
         SvcLog(Warning, "Failed to set service status!");
     }
 }
 
-void SvcCtrlHandler(DWORD CtrlCode)
+void SvcReportStatus()
+{
+    SvcNoAllocScope noAlloc("status");
+
+    // Only one thread reports at a time, others leave their request to it.
+    // Reports of concurrent threads could overtake each other otherwise, and
+    // an older state could be reported after SERVICE_STOPPED.
+    ULONGLONG requests = 1;
+    if (hSvc->reportRequests.fetch_add(requests, memory_order_acq_rel) != 0)
+        return;
+    do {
+        // Report the latest state, SERVICE_STOPPED only once
+        ULONGLONG word = hSvc->stateWord.load(memory_order_acquire);
+        if ((word & 0xFF) != SERVICE_STOPPED || word != hSvc->reportedWord) {
+            hSvc->reportedWord = word;
+            SvcSetServiceStatus(word);
+        }
+
+        // Report again for the requests that arrived meanwhile
+        requests = hSvc->reportRequests.fetch_sub(requests, memory_order_acq_rel) - requests;
+    } while (requests != 0);
+}
+
+void SvcReportRunning()
+{
+    SvcSetState(SERVICE_RUNNING);
+    ULONGLONG runningTick = hSvc->stateTick[SERVICE_RUNNING].load(memory_order_relaxed);
+    hSvc->lastActivity.store(runningTick, memory_order_relaxed);
+    char msg[80];
+    snprintf(msg, sizeof(msg), "Service running %llu ms after process start",
+             runningTick - hSvc->processStartTick);
+    SvcLog(Info, msg);
+
+    // The control handler checks the state after deferring a stop, so one
+    // of both sees the other's change
+    atomic_thread_fence(memory_order_seq_cst);
+    if (hSvc->stopDeferred.load())
+        SvcRequestStop("Stopping service, stop was requested while starting", SvcStopScm);
+}
+
+void SvcReady()
+{
+    if (SvcAppService() && hSvc->readyEvent != NULL)
+        SetEvent(hSvc->readyEvent);
+}
+
+DWORD SvcCtrlHandler(DWORD CtrlCode, DWORD, LPVOID, LPVOID Context)
 {
+    // All services share the dispatcher thread, so pick the addressed one
+    hSvc = static_cast<GlobalHandles*>(Context);
     switch (CtrlCode) {
-    case SERVICE_CONTROL_STOP:
+    case SERVICE_CONTROL_STOP: {
+        SvcNoAllocScope noAlloc("stop");
         SvcLog(Debug, "Received service stop command");
-        if (hSvc->status.dwCurrentState != SERVICE_RUNNING) {
-            SvcLog(Warning, "Received stop command while service is inactive!");
-            break;
+        DWORD state = SvcState();
+        if (state == SERVICE_START_PENDING) {
+            // Stop once running, unless it got running meanwhile. Wake up
+            // SvcMain, in case it waits for the application to be ready.
+            hSvc->stopDeferred.store(true);
+            atomic_thread_fence(memory_order_seq_cst);
+            state = SvcState();
+            if (state == SERVICE_START_PENDING) {
+                SvcLog(Info, "Received stop command while starting, stopping once running");
+                SetEvent(hSvc->stopEvent);
+                break;
+            }
         }
+        if (state == SERVICE_RUNNING)
+            SvcRequestStop("Stopping service on request of SCM", SvcStopScm);
+        else if (state == SERVICE_STOP_PENDING)
+            SvcLog(Debug, "Service stop is already in progress");
+        else
+            SvcLog(Warning, "Received stop command while service is inactive!");
+        break;
+    }
+    case SERVICE_CONTROL_INTERROGATE: {
+        SvcNoAllocScope noAlloc("interrogate");
+        SvcReportStatus();
+        break;
+    }
+    default:
+        return ERROR_CALL_NOT_IMPLEMENTED;
+    }
+    return NO_ERROR;
+}
+
+void SvcRequestStop(const char* reason, SvcStopReason stopReason)
+{
+    // Stop only once, no matter who asked first
+    if (hSvc->stopRequested.exchange(true)) {
+        SvcLog(Debug, "Service stop is already in progress");
+        return;
+    }
+    hSvc->stopReason = stopReason;
+    hSvc->stopTick = GetTickCount64();
+    SvcLog(Info, reason);
+
+    // Refuse new work and let SvcMain drain the work in flight first
+    if (hSvc->cfg->drainTimeout) {
+        hSvc->draining.store(true);
+        SvcSetState(SERVICE_STOP_PENDING, hSvc->cfg->drainTimeout + CheckpointInterval);
+        SetEvent(hSvc->stopEvent);
+        return;
+    }
 
-        // Execute serice stop callback
+    // Execute serice stop callback or signal child process
+    if (hSvc->cfg->childExecutable) {
+        SvcLog(Debug, "Signaling child process to stop");
+        svcFeatures.child->stop();
+    } else {
         SvcLog(Debug, "Executing service stop callback");
-        hSvc->cfg->svcCallbackStop();
-
-        // Tell SCM we're stopping
-        hSvc->status.dwControlsAccepted = 0; // none
-        hSvc->status.dwCurrentState = SERVICE_STOP_PENDING;
-        hSvc->status.dwWin32ExitCode = NO_ERROR;
-        hSvc->status.dwCheckPoint = 4;
-        if (SetServiceStatus(hSvc->statusHandle, &hSvc->status) == FALSE) {
-            SvcLog(Warning, "Failed to set service status!");
+        SvcAllowAllocScope allowAlloc;
+        hSvc->callbacks.stop(hSvc->callbacks.context);
+    }
+
+    // Tell SCM we're stopping
+    SvcSetState(SERVICE_STOP_PENDING, SvcStopWaitHint());
+
+    // Set stop event to let SvcMain resume
+    SetEvent(hSvc->stopEvent);
+}
+
+void SvcCheckIdle()
+{
+    char msg[120];
+    ULONGLONG now = GetTickCount64();
+    SvcReportSharedFootprint();
+
+    // Report cold activation latency once
+    ULONGLONG first = hSvc->firstActivity.load(memory_order_relaxed);
+    if (first && !hSvc->activationReported) {
+        hSvc->activationReported = true;
+        snprintf(msg, sizeof(msg), "Cold activation: first activity %llu ms "
+                 "after process start (%llu ms after running)",
+                 first - min(first, hSvc->processStartTick),
+                 first - min(first, hSvc->stateTick[SERVICE_RUNNING].load(memory_order_relaxed)));
+        SvcLog(Info, msg);
+    }
+
+    // Stop if there hasn't been any activity for too long, work in flight
+    // counts as activity
+    if (!hSvc->cfg->idleTimeout || hSvc->stopRequested.load())
+        return;
+    if (SvcWorkCount(hSvc) > 0) {
+        hSvc->lastActivity.store(now, memory_order_relaxed);
+        return;
+    }
+    ULONGLONG last = hSvc->lastActivity.load(memory_order_relaxed);
+    if (last >= now || now - last < hSvc->cfg->idleTimeout * 1000ULL)
+        return;
+    snprintf(msg, sizeof(msg), "Stopping service after being idle for %llu s",
+             (now - last) / 1000);
+    SvcRequestStop(msg, SvcStopIdle);
+}
+
+void SvcDrain(HANDLE hWorkerThread)
+{
+    char msg[120];
+    ULONGLONG start = GetTickCount64();
+    LONGLONG inFlight = SvcWorkCount(hSvc);
+    if (inFlight > 0) {
+        snprintf(msg, sizeof(msg), "Draining %lld requests in flight", inFlight);
+        SvcLog(Info, msg);
+    }
+
+    // Report progress while the work in flight goes down
+    LONGLONG reported = inFlight;
+    ULONGLONG logged = start;
+    while (inFlight > 0 && GetTickCount64() - start < hSvc->cfg->drainTimeout) {
+        if (WaitForSingleObject(hWorkerThread, DrainPollInterval) != WAIT_TIMEOUT)
+            break;
+        inFlight = SvcWorkCount(hSvc);
+        if (inFlight >= reported)
+            continue;
+        reported = inFlight;
+        SvcCheckpoint();
+        ULONGLONG now = GetTickCount64();
+        if (now - logged >= CheckpointInterval) {
+            logged = now;
+            snprintf(msg, sizeof(msg), "Draining, %lld requests left", inFlight);
+            SvcLog(Debug, msg);
         }
+    }
 
-        // Set stop event to let SvcMain resume
-        SetEvent(hSvc->stopEvent);
-        break;
-    default:
-        break;
+    // Whatever is left is cut off by the stop callback
+    hSvc->drainTime = GetTickCount64() - start;
+    hSvc->drainCutOff = inFlight > 0 ? static_cast<ULONGLONG>(inFlight) : 0;
+    if (hSvc->drainCutOff) {
+        snprintf(msg, sizeof(msg), "Drain ended after %llu ms, cutting off %llu requests",
+                 hSvc->drainTime, hSvc->drainCutOff);
+        SvcLog(Warning, msg);
+    } else {
+        snprintf(msg, sizeof(msg), "Drained work in flight in %llu ms", hSvc->drainTime);
+        SvcLog(Info, msg);
+    }
+}
+
+void SvcReportSharedFootprint()
+{
+    ULONGLONG runningTick = hSvc->stateTick[SERVICE_RUNNING].load(memory_order_relaxed);
+    if (!hSvc->sharedWorkingSet || GetTickCount64() - runningTick < SharedFootprintSettleTime)
+        return;
+
+    /* Report footprint
+     *
+     * Services starting concurrently add to the same working set, so the
+     * delta is only an estimate. A service in it's own process would need at
+     * least the working set the process had before starting any service.
+     */
+    ULONGLONG workingSet = WorkingSetSize();
+    ULONGLONG added = workingSet - min(workingSet, hSvc->sharedWorkingSet);
+    char msg[200];
+    snprintf(msg, sizeof(msg), "Co-hosted service added %llu KiB to the shared "
+             "working set of %llu KiB, saving %llu KiB of process baseline",
+             added / 1024, workingSet / 1024, processWorkingSet / 1024);
+    SvcLog(Info, msg);
+    hSvc->sharedWorkingSet = 0;
+}
+
+void SvcLogAllocStats()
+{
+    if (!SvcAllocStatsHook)
+        return;
+    SvcAllocStats stats;
+    SvcAllocStatsHook(stats);
+    char msg[200];
+    snprintf(msg, sizeof(msg), "Allocation stats: %llu allocations (%.0f/s), "
+             "%llu KiB allocated (%.0f KiB/s), %llu KiB live",
+             stats.allocations, stats.allocationsPerSec, stats.bytesAllocated / 1024,
+             stats.bytesPerSec / 1024, stats.liveBytes / 1024);
+    SvcLog(Info, msg);
+
+    // Size class histogram
+    int n = snprintf(msg, sizeof(msg), "Allocation sizes:");
+    for (size_t i = 0; i < SvcAllocStats::SizeClasses && n > 0 &&
+                       static_cast<size_t>(n) < sizeof(msg); ++i) {
+        if (i + 1 < SvcAllocStats::SizeClasses)
+            n += snprintf(msg + n, sizeof(msg) - n, " <=%zu:%llu", size_t(16) << i,
+                          stats.sizeClasses[i]);
+        else
+            n += snprintf(msg + n, sizeof(msg) - n, " more:%llu", stats.sizeClasses[i]);
     }
+    SvcLog(Debug, msg);
+}
+
+DWORD SvcPrewarmThread(LPVOID)
+{
+    svcFeatures.prewarm->start();
+    return ERROR_SUCCESS;
 }
 
-DWORD SvcWorkerThread(LPVOID)
+DWORD SvcWorkerThread(LPVOID param)
 {
-    // Run service main procedure and store it's exit code
-    hSvc->exitCode = hSvc->cfg->svcCallbackMain(hSvc->argc, hSvc->argv);
+    // Let SvcMain know the application is about to run, see SvcMain()
+    HANDLE hMainEntered = static_cast<HANDLE>(param);
+    if (hMainEntered != NULL)
+        SetEvent(hMainEntered);
+
+    // Run service main procedure or child process and store it's exit code
+    if (hSvc->cfg->childExecutable) {
+        hSvc->exitCode = svcFeatures.child->run();
+    } else {
+        bool captured = hSvc->cfg->captureOutput && svcFeatures.capture->start();
+        hSvc->exitCode = hSvc->callbacks.main(hSvc->callbacks.context,
+                                              hSvc->argc, hSvc->argv);
+        if (captured)
+            svcFeatures.capture->stop();
+    }
     char msg[60];
     sprintf(msg, "Worker thread has finished with exit code %d",
             hSvc->exitCode);
     SvcLog(Info, msg);
+
+    // Let SvcMain report the service stopped, if the app exited on it's own
+    if (!hSvc->stopRequested.exchange(true)) {
+        hSvc->stopReason = SvcStopAppExit;
+        hSvc->stopTick = GetTickCount64();
+        SvcLog(Warning, "Application exited without stop request");
+        SetEvent(hSvc->stopEvent);
+    }
     return ERROR_SUCCESS;
 }
@@ -4,21 +4,78 @@
 #define SVCWRAPPER_IMPL_H
 
 #include "SvcWrapper/svcwrapper.h"
+#include "SvcWrapper/svcwrapper_static.h"
+#include "SvcWrapper/svcallocstats.h"
+#include "svchistory.h"
 #include <windows.h>
+#include <atomic>
+#include <mutex>
 
-// Global handles required for service operation
+class SvcIpcServer;
+class SvcPrewarm;
+
+// Number of in-flight work counters per service
+static constexpr size_t SvcWorkShards = 16;
+
+// In-flight work counter, one cache line each. Guards may be released on
+// another core than they were created on, so single shards may go negative.
+struct alignas(64) SvcWorkShard {
+    std::atomic<LONGLONG> count {0};
+};
+
+// Number of log rate limiting buckets per service, call sites hashing to
+// the same bucket share it
+static constexpr size_t SvcLogSites = 64;
+
+// Log rate limiting bucket, see SvcLogFilter(). The text of the first
+// message suppressed since the last summary is written by the thread which
+// suppressed it and published by the ready flag.
+struct alignas(64) SvcLogSite {
+    std::atomic<ULONGLONG> tat {0};
+    std::atomic<ULONGLONG> suppressed {0};
+    std::atomic<bool> ready {false};
+    SvcLogLevel level {Debug};
+    char text[80] {};
+};
+
+// Handles required for service operation, one instance per hosted service
 struct GlobalHandles {
     // Service configuration
-    const SvcWrapperConfig* cfg {nullptr};
+    const SvcWrapperSettings* cfg {nullptr};
+
+    // Application callbacks
+    SvcDetail::Callbacks callbacks;
+
+    // Lifecycle state machine, see SvcSetState(). Packs the current state
+    // (bits 0-7), it's checkpoint (bits 8-31) and a version counter
+    // incremented on every change (bits 32-63) into one atomic word.
+    std::atomic<ULONGLONG> stateWord {SERVICE_STOPPED};
+
+    // Tick counts [ms] of entering each state, indexed by state
+    std::atomic<ULONGLONG> stateTick[SERVICE_PAUSED + 1] {};
+
+    // Wait hint and exit code reported along with the state
+    std::atomic<DWORD> waitHint {0};
+    std::atomic<DWORD> win32ExitCode {NO_ERROR};
 
-    // Current status of the service
-    SERVICE_STATUS status;
+    // Tick count [ms] until which the checkpoint timer advances the
+    // checkpoint of a pending state, see SvcProgress()
+    std::atomic<ULONGLONG> pendingDeadline {0};
+
+    // Pending status reports and the state word reported last, only
+    // accessed by the reporting thread, see SvcReportStatus()
+    std::atomic<ULONGLONG> reportRequests {0};
+    ULONGLONG reportedWord {0};
 
     // Service manager status handle
     SERVICE_STATUS_HANDLE statusHandle {NULL};
 
-    // Service stop event
-    HANDLE stopEvent {INVALID_HANDLE_VALUE};
+    // Service stop event, created on the first start and kept until the
+    // dispatcher returned, so the control handler may always set it
+    HANDLE stopEvent {NULL};
+
+    // Readiness event, if the application reports readiness
+    HANDLE readyEvent {NULL};
 
     // Original argc & argv
     int argc {0};
@@ -26,45 +83,315 @@ struct GlobalHandles {
 
     // Wrapped application exit code
     int exitCode {SVCWRAPPER_EXITCODE_OK};
+
+    // Set once stopping the service has been initiated
+    std::atomic<bool> stopRequested {false};
+
+    // Set if stop was requested while starting, see SvcReportRunning()
+    std::atomic<bool> stopDeferred {false};
+
+    // Reason and tick count [ms] of the stop, set along with stopRequested
+    SvcStopReason stopReason {SvcStopNone};
+    ULONGLONG stopTick {0};
+
+    // Tick count [ms] of process creation
+    ULONGLONG processStartTick {0};
+
+    // Process working set [bytes] when the service started, if sharing the
+    // process with other services (0 once the footprint has been reported)
+    ULONGLONG sharedWorkingSet {0};
+
+    // Tick counts [ms] of the first and the latest application activity
+    std::atomic<ULONGLONG> firstActivity {0};
+    std::atomic<ULONGLONG> lastActivity {0};
+    bool activationReported {false};
+
+    // Child process, if running in child process mode. A stop requested
+    // before the child was spawned is kept pending until it is.
+    std::mutex childLock;
+    HANDLE childProcess {NULL};
+    DWORD childPid {0};
+    bool childStopPending {false};
+
+    // Least severe level forwarded to the log callback
+    std::atomic<int> logLevel {Debug};
+
+    // Log suppression state, see SvcLogFilter(). Set if any suppression is
+    // configured, the rate limiting buckets live in the arena.
+    bool logFilter {false};
+    SvcLogSite* logSites {nullptr};
+    std::atomic<ULONGLONG> logLastHash {0};
+    std::atomic<ULONGLONG> logRepeats {0};
+    std::atomic<ULONGLONG> logSampleCount[Debug + 1] {};
+
+    // Number of log messages suppressed by each stage
+    std::atomic<ULONGLONG> logRateLimited {0};
+    std::atomic<ULONGLONG> logDeduplicated {0};
+    std::atomic<ULONGLONG> logSampled {0};
+
+    // Control pipe server, if enabled
+    SvcIpcServer* ipcServer {nullptr};
+
+    // Prewarmed pages, if they are kept locked
+    SvcPrewarm* prewarm {nullptr};
+
+    // Amount of data [bytes] and time [ms] spent prewarming
+    ULONGLONG prewarmBytes {0};
+    ULONGLONG prewarmTime {0};
+
+    // Work in flight, see SvcWorkGuard
+    SvcWorkShard workShards[SvcWorkShards];
+
+    // Set while draining, guards refuse new work then
+    std::atomic<bool> draining {false};
+
+    // Time [ms] the last drain took and the number of requests cut off
+    ULONGLONG drainTime {0};
+    ULONGLONG drainCutOff {0};
+
+    // Run history journal, if enabled
+    SvcHistory* history {nullptr};
 };
 
+// Service control manager functions used by the core. They point to the
+// Windows API, but may be replaced by a stand-in for stress testing the
+// lifecycle without installing a service.
+struct SvcScmBackend {
+    decltype(&StartServiceCtrlDispatcher) startDispatcher;
+    decltype(&RegisterServiceCtrlHandlerEx) registerHandler;
+    decltype(&SetServiceStatus) setStatus;
+};
+extern SvcScmBackend svcScm;
+
+// Allocation statistics, set if SvcWrapper::AllocStats is linked
+extern void (*SvcAllocStatsHook)(SvcAllocStats& stats);
+
+// Handles of all services hosted by this process
+extern GlobalHandles *hSvcTable;
+extern size_t hSvcCount;
+
+// Handles of the service the current thread is working for. Threads not
+// created by the wrapper default to the first service of the process.
+extern thread_local GlobalHandles *hSvc;
+
+// Service of the calling application thread. A thread that used hSvc before
+// the services were set up picks up the first service once they are.
+inline GlobalHandles* SvcAppService()
+{
+    if (!hSvc)
+        hSvc = hSvcTable;
+    return hSvc;
+}
+
+/*!
+ * \brief Create wrapper thread
+ * \details Creates a thread like CreateThread(), which works for the same
+ * service as the calling thread. Use this for all threads started by the
+ * wrapper, so they log to and report for the right service. The thread is
+ * registered in the thread registry for as long as it runs.
+ * \param startAddress Thread function
+ * \param param Thread function parameter
+ * \param name Thread name
+ * \return Thread handle, NULL on failure
+ */
+HANDLE SvcCreateThread(LPTHREAD_START_ROUTINE startAddress, LPVOID param, const char* name);
+
+/*!
+ * \brief Log message
+ * \details Forwards a message to the configured log callback, falls back to
+ * stderr for critical messages if there is none.
+ * \param level Log level
+ * \param msg Message text
+ */
+void SvcLog(SvcLogLevel level, const char* msg);
+
+/*!
+ * \brief Filter log message
+ * \details Suppression stage in front of the log callback, applies sampling,
+ * deduplication and rate limiting as configured. Logs pending "repeated"
+ * summaries before the message if it's passed. Lock free, doesn't allocate.
+ * \param site Call site of the message, e.g. it's return address
+ * \param level Log level
+ * \param msg Message text
+ * \return true if the message should be passed to the log callback
+ */
+bool SvcLogFilter(const void* site, SvcLogLevel level, const char* msg);
+
+/*!
+ * \brief Log suppression summaries
+ * \details Logs how many messages were collapsed or rate limited since the
+ * last summary. Runs as timer job once per second and when the service stops.
+ */
+void SvcLogFlush();
+
 /*!
  * \brief Verify service configuration
- * \details Verifies the service configuration settings.
- * \param svcCfg Service configuration
+ * \details Verifies the service configuration settings and callbacks, and
+ * checks the subsystems it requires are available.
+ * \param service Service configuration
  * \return Exit code 0 if configuration is okay, exit code != 0 otherwise.
  */
-int SvcWrapperVerifyConfig(const SvcWrapperConfig& svcCfg);
+int SvcWrapperVerifyConfig(const SvcDetail::Service& service);
 
 /*!
- * \brief Init service
- * \details Initializes the service be registering with and dispatching control
- * to Windows Service Control Manager.
- * \param svcCfg Service configuration
+ * \brief Init services
+ * \details Initializes all services of hSvcTable by registering with and
+ * dispatching control to Windows Service Control Manager. Returns once all
+ * services of the process have stopped.
  * \return Exit code
  */
-int SvcInit(const SvcWrapperConfig& svcCfg);
+int SvcInit();
 
 /*!
  * \brief Service main function
  * \details Will be invoked through Windows Service Control Manager and controls
- * the lifecycle of the service.
+ * the lifecycle of the service. Each hosted service is started in it's own
+ * thread, the first argument is the name of the service to start.
+ * \param argc Number of service start arguments
+ * \param argv Service start arguments
+ */
+void WINAPI SvcMain(DWORD argc, LPSTR* argv);
+
+/*!
+ * \brief Current service state
+ * \return State of the current thread's service (SERVICE_RUNNING etc.)
+ */
+DWORD SvcState();
+
+/*!
+ * \brief Change service state
+ * \details Moves the lifecycle state machine of the current thread's service
+ * to a new state and reports it to the SCM. Valid transitions are
+ * STOPPED -> START_PENDING -> RUNNING -> STOP_PENDING -> STOPPED, as well as
+ * START_PENDING -> STOP_PENDING and any state to STOPPED. Setting the current
+ * pending state again advances it's checkpoint. This is lock free and
+ * doesn't allocate, so it may be called from any thread at any time.
+ * \param state New state
+ * \param waitHint Time [ms] the SCM should expect until the next change
+ * \param win32ExitCode Exit code reported with SERVICE_STOPPED. For
+ * ERROR_SERVICE_SPECIFIC_ERROR, the application's exit code is reported too.
+ * \return true if the transition was valid and has been applied
+ */
+bool SvcSetState(DWORD state, DWORD waitHint = 0, DWORD win32ExitCode = NO_ERROR);
+
+/*!
+ * \brief Advance checkpoint
+ * \details Counts up the checkpoint of the current thread's service and
+ * reports it to the SCM, if start or stop is pending. Does nothing in any
+ * other state, so it may be called without racing state changes. Call this
+ * when a pending start or stop made progress.
+ */
+void SvcCheckpoint();
+
+/*!
+ * \brief Report progress
+ * \details Tells the checkpoint timer that a pending start or stop of the
+ * current thread's service made progress. The timer advances the checkpoint
+ * only until the wait hint passed since entering the pending state or the
+ * last progress, so the SCM detects a start or stop that hangs. Cheaper than
+ * SvcCheckpoint() for frequent progress, as nothing is reported.
+ */
+void SvcProgress();
+
+/*!
+ * \brief Report service status
+ * \details Reports the current state of the current thread's service to the
+ * SCM. If another thread is reporting meanwhile, the report is left to it,
+ * which reports once more with the latest state. So reports never overtake
+ * each other and the SCM ends up with the latest state, without blocking.
+ * SERVICE_STOPPED is reported only once.
+ */
+void SvcReportStatus();
+
+/*!
+ * \brief Report service running
+ * \details Reports SERVICE_RUNNING to the SCM and starts accepting stop
+ * commands and measuring idle time. Requests the service to stop right away,
+ * if a stop command arrived while it was starting.
  */
-void WINAPI SvcMain();
+void SvcReportRunning();
 
 /*!
  * \brief Servicce control handler
  * \details Processes control commands from Windows Service Control Manager.
+ * A stop command arriving while the service is starting is deferred until it
+ * is running, duplicate stop commands are ignored. Commands may arrive from
+ * any thread.
  * \param CtrlCode Control code from SCM
+ * \param EventType Event type, unused
+ * \param EventData Event data, unused
+ * \param Context Handles of the service the command is meant for
+ * \return NO_ERROR if the command was handled
+ */
+DWORD WINAPI SvcCtrlHandler(DWORD CtrlCode, DWORD EventType, LPVOID EventData, LPVOID Context);
+
+/*!
+ * \brief Request service stop
+ * \details Invokes the application's stop callback, reports SERVICE_STOP_PENDING
+ * to the SCM and wakes up SvcMain. If a drain timeout is configured, only new
+ * work is refused and SvcMain invokes the stop callback after draining. Only
+ * the first call has any effect, so this may be called from the control
+ * handler and the idle monitor concurrently.
+ * \param reason Reason for stopping the service, used for logging
+ * \param stopReason Reason recorded in the run history
+ */
+void SvcRequestStop(const char* reason, SvcStopReason stopReason);
+
+/*!
+ * \brief Work in flight
+ * \param svc Service
+ * \return Sum of the in-flight work counters of the service
+ */
+LONGLONG SvcWorkCount(const GlobalHandles* svc);
+
+/*!
+ * \brief Drain work in flight
+ * \details Waits until all work guards of the current thread's service have
+ * been released, the drain timeout expired or the application exited on it's
+ * own. Checkpoints are reported as the work in flight goes down.
+ * \param hWorkerThread Worker thread running the application
+ */
+void SvcDrain(HANDLE hWorkerThread);
+
+/*!
+ * \brief Check for idle timeout
+ * \details Checks the time elapsed since the last application activity
+ * against the configured idle timeout and requests the service to stop if it
+ * has been exceeded. Also reports the cold activation latency once the first
+ * activity has been seen. Runs as timer job while the service is running.
+ */
+void SvcCheckIdle();
+
+/*!
+ * \brief Report shared process footprint
+ * \details If the service shares it's process with other services, reports
+ * the working set it added to the process once it has settled, compared to
+ * the working set of a bare wrapper process it would need otherwise.
+ */
+void SvcReportSharedFootprint();
+
+/*!
+ * \brief Log allocation statistics
+ * \details Logs the process' allocation statistics, if SvcWrapper::AllocStats
+ * is linked. The size class histogram is logged at debug level.
+ */
+void SvcLogAllocStats();
+
+/*!
+ * \brief Prewarm thread
+ * \details Faults in the configured files and images while SvcMain keeps the
+ * service start pending.
+ * \return Always exit code 0.
  */
-void WINAPI SvcCtrlHandler(DWORD CtrlCode);
+DWORD SvcPrewarmThread(LPVOID);
 
 /*!
  * \brief Service worker thread
  * \details Runs the application wrapped by SvcWrapper in it's own thread.
+ * \param param Event to set right before the application is run, or NULL
  * \return Always exit code 0. (Return value unused but required by Windows
  * thread API.)
  */
-DWORD SvcWorkerThread(LPVOID);
+DWORD SvcWorkerThread(LPVOID param);
 
 #endif // SVCWRAPPER_IMPL_H